@@ -0,0 +1,69 @@
+#include "dcmtk/oflog/oflog.h"
+
+#include "AnonymOutputWriter.hpp"
+#include "DicomAnonymizer.hpp"
+
+OFCondition AnonymOutputWriter::open(const std::string &filename,
+                                     bool fragment) {
+  std::scoped_lock lock{m_mutex};
+
+  m_out = &m_file;
+  m_file.open(filename, std::ios::out);
+  if (!m_file.is_open()) {
+    OFCondition cond{0, 0, OF_error, "error while creating output csv file"};
+    OFLOG_ERROR(mainLogger, cond.text() << " `" << filename << "`");
+    return cond;
+  }
+
+  this->writeHeader(fragment);
+  return EC_Normal;
+};
+
+void AnonymOutputWriter::openInMemory(bool fragment) {
+  std::scoped_lock lock{m_mutex};
+  m_out = &m_buffer;
+  this->writeHeader(fragment);
+};
+
+void AnonymOutputWriter::writeHeader(bool fragment) {
+  if (fragment)
+    *m_out << STUDY_NUMBER_COLUMN;
+  *m_out << HEADER;
+};
+
+void AnonymOutputWriter::close() {
+  std::scoped_lock lock{m_mutex};
+  if (m_file.is_open())
+    m_file.close();
+};
+
+std::string AnonymOutputWriter::contents() {
+  std::scoped_lock lock{m_mutex};
+  return m_buffer.str();
+};
+
+void AnonymOutputWriter::write(std::size_t index, const std::string &row) {
+  this->submit(index, row);
+};
+
+void AnonymOutputWriter::skip(std::size_t index) {
+  this->submit(index, std::nullopt);
+};
+
+void AnonymOutputWriter::submit(std::size_t index,
+                                std::optional<std::string> row) {
+  std::scoped_lock lock{m_mutex};
+
+  m_pending.emplace(index, std::move(row));
+
+  // flush every row whose predecessors are already written
+  auto it = m_pending.begin();
+  while (it != m_pending.end() && it->first == m_next_index) {
+    if (it->second.has_value()) {
+      *m_out << *it->second;
+    }
+    it = m_pending.erase(it);
+    ++m_next_index;
+  }
+  m_out->flush();
+};
@@ -0,0 +1,75 @@
+#include <vector>
+
+#include "AnonymizationProfile.hpp"
+
+const ProfileTable &
+selectProfileTable(const std::set<E_ADDIT_ANONYM_METHODS> &methods) {
+  unsigned int combination{0};
+  if (methods.contains(M_113108))
+    combination |= profile::RETAIN_PATIENT_CHARACTERISTICS;
+  if (methods.contains(M_113109))
+    combination |= profile::RETAIN_DEVICE;
+  if (methods.contains(M_113112))
+    combination |= profile::RETAIN_INSTITUTION;
+
+  return PROFILE_TABLES[combination];
+};
+
+unsigned long applyProfileTable(DcmDataset *dataset, const ProfileTable &table,
+                                const std::string &pseudoname) {
+  const auto valueOf = [&pseudoname](E_TAG_ACTION action) -> const char * {
+    switch (action) {
+    case T_PSEUDONAME:
+      return pseudoname.c_str();
+    case T_PATIENT_SEX:
+      return "O";
+    default:
+      return "";
+    }
+  };
+
+  std::array<bool, profile::MAX_ACTIONS> found{};
+  std::vector<DcmObject *> removed{};
+
+  // both the dataset and the table are sorted by tag, advance them together
+  const TagAction *rule = table.begin();
+  DcmObject *object = nullptr;
+  while (rule != table.end() &&
+         (object = dataset->nextInContainer(object)) != nullptr) {
+    const DcmTagKey tag = object->getTag();
+    const std::uint32_t key =
+        static_cast<std::uint32_t>(tag.getGroup()) << 16 | tag.getElement();
+
+    while (rule != table.end() && rule->key() < key) {
+      ++rule;
+    }
+    if (rule == table.end() || rule->key() != key)
+      continue;
+
+    if (rule->action == T_REMOVE) {
+      removed.push_back(object);
+    } else if (object->isaString()) {
+      static_cast<DcmElement *>(object)->putString(valueOf(rule->action));
+    } else {
+      // e.g. read as UN, re-created with dictionary VR below
+      continue;
+    }
+    found[static_cast<std::size_t>(rule - table.begin())] = true;
+  }
+
+  for (DcmObject *object : removed) {
+    delete dataset->remove(object);
+  }
+
+  // replaced values are inserted even if the element was missing
+  for (std::size_t i = 0; i < table.size; ++i) {
+    const TagAction &action = table.actions[i];
+    if (found[i] || action.action == T_REMOVE)
+      continue;
+
+    dataset->putAndInsertString(DcmTagKey(action.group, action.element),
+                                valueOf(action.action));
+  }
+
+  return static_cast<unsigned long>(removed.size());
+};
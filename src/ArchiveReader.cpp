@@ -0,0 +1,465 @@
+#include "ArchiveReader.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <set>
+
+#include <zlib.h>
+
+namespace {
+constexpr std::size_t TAR_BLOCK{512};
+constexpr std::size_t INFLATE_CHUNK{256 * 1024};
+
+constexpr std::uint32_t ZIP_LOCAL_SIG{0x04034b50};
+constexpr std::uint32_t ZIP_CENTRAL_SIG{0x02014b50};
+constexpr std::uint32_t ZIP_END_SIG{0x06054b50};
+constexpr std::uint32_t ZIP64_LOCATOR_SIG{0x07064b50};
+constexpr std::uint32_t ZIP64_END_SIG{0x06064b50};
+// end of central directory record without comment, comment is at most 64KB
+constexpr std::size_t ZIP_END_SIZE{22};
+constexpr std::size_t ZIP_END_SEARCH{ZIP_END_SIZE + 0xffff};
+
+std::uint16_t le16(const char *p) {
+  const auto *u = reinterpret_cast<const unsigned char *>(p);
+  return static_cast<std::uint16_t>(u[0] | u[1] << 8);
+}
+
+std::uint32_t le32(const char *p) {
+  return le16(p) | static_cast<std::uint32_t>(le16(p + 2)) << 16;
+}
+
+std::uint64_t le64(const char *p) {
+  return le32(p) | static_cast<std::uint64_t>(le32(p + 4)) << 32;
+}
+
+bool hasSuffix(const std::string &s, std::string_view suffix) {
+  return s.size() >= suffix.size() &&
+         std::equal(suffix.rbegin(), suffix.rend(), s.rbegin(),
+                    [](char a, char b) {
+                      return a == std::tolower(static_cast<unsigned char>(b));
+                    });
+}
+
+// tar numeric field: octal text, or base-256 if the high bit is set
+std::uint64_t tarNumber(const char *field, std::size_t length) {
+  std::uint64_t value{0};
+  if (static_cast<unsigned char>(field[0]) & 0x80) {
+    for (std::size_t i = 1; i < length; ++i)
+      value = value << 8 | static_cast<unsigned char>(field[i]);
+    return value;
+  }
+  for (std::size_t i = 0; i < length; ++i) {
+    if (field[i] >= '0' && field[i] <= '7')
+      value = value << 3 | static_cast<unsigned>(field[i] - '0');
+    else if (field[i] != ' ' || value != 0)
+      break;
+  }
+  return value;
+}
+
+std::string tarString(const char *field, std::size_t length) {
+  return {field, strnlen(field, length)};
+}
+
+// "path" record of a pax extended header: "<len> path=<value>\n"
+std::string paxPath(const std::vector<char> &data) {
+  std::size_t pos{0};
+  while (pos < data.size()) {
+    const std::size_t space =
+        std::find(data.begin() + static_cast<std::ptrdiff_t>(pos), data.end(),
+                  ' ') -
+        data.begin();
+    if (space == data.size())
+      break;
+    const std::size_t length =
+        std::strtoull(std::string(&data[pos], space - pos).c_str(), nullptr,
+                      10);
+    if (length == 0 || pos + length > data.size())
+      break;
+    const std::string_view record(&data[space + 1], pos + length - space - 2);
+    if (record.starts_with("path="))
+      return std::string(record.substr(5));
+    pos += length;
+  }
+  return {};
+}
+
+std::string normalizeName(std::string name) {
+  while (name.starts_with("./"))
+    name.erase(0, 2);
+  return name;
+}
+} // namespace
+
+// zlib inflate state reading compressed bytes from the archive file
+struct ArchiveReader::Inflater {
+  z_stream stream{};
+  std::vector<char> input = std::vector<char>(INFLATE_CHUNK);
+  bool initialized{false};
+  bool finished{false};
+
+  ~Inflater() {
+    if (initialized)
+      inflateEnd(&stream);
+  }
+
+  // window_bits 15 + 32: gzip or zlib header, -15: raw deflate (zip)
+  OFCondition init(int window_bits) {
+    if (inflateInit2(&stream, window_bits) != Z_OK)
+      return {0, 0, OF_error, "zlib initialization failed"};
+    initialized = true;
+    return EC_Normal;
+  }
+
+  // read exactly `length` inflated bytes, `limit` compressed bytes at most
+  // are taken from `file`
+  OFCondition inflate(std::ifstream &file, char *buffer, std::uint64_t length,
+                      std::uint64_t &limit, bool concatenated) {
+    stream.next_out = reinterpret_cast<Bytef *>(buffer);
+    while (length > 0) {
+      const auto chunk = static_cast<uInt>(
+          std::min<std::uint64_t>(length, std::numeric_limits<uInt>::max()));
+      stream.avail_out = chunk;
+      while (stream.avail_out > 0) {
+        if (finished)
+          return {0, 0, OF_error, "Unexpected end of compressed data"};
+        if (stream.avail_in == 0) {
+          const auto want = static_cast<std::streamsize>(
+              std::min<std::uint64_t>(input.size(), limit));
+          file.read(input.data(), want);
+          const auto got = file.gcount();
+          if (got <= 0)
+            return {0, 0, OF_error, "Unexpected end of archive"};
+          limit -= static_cast<std::uint64_t>(got);
+          stream.next_in = reinterpret_cast<Bytef *>(input.data());
+          stream.avail_in = static_cast<uInt>(got);
+        }
+        const int result = ::inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END) {
+          // gzip files may consist of several members
+          if (concatenated && (stream.avail_in > 0 || file.peek() != EOF)) {
+            inflateReset(&stream);
+            continue;
+          }
+          finished = true;
+        } else if (result != Z_OK) {
+          return {0, 0, OF_error, "Corrupt compressed data"};
+        }
+      }
+      length -= chunk;
+    }
+    return EC_Normal;
+  }
+};
+
+E_ARCHIVE_TYPE archiveType(const std::filesystem::path &path) {
+  const std::string name = path.filename().string();
+  if (hasSuffix(name, ".zip"))
+    return A_ZIP;
+  if (hasSuffix(name, ".tar"))
+    return A_TAR;
+  if (hasSuffix(name, ".tar.gz") || hasSuffix(name, ".tgz"))
+    return A_TAR_GZ;
+  return A_NONE;
+}
+
+bool splitArchivePath(const std::filesystem::path &path,
+                      std::filesystem::path &archive, std::string &folder) {
+  std::error_code error{};
+  if (archiveType(path) != A_NONE &&
+      std::filesystem::is_regular_file(path, error)) {
+    archive = path;
+    folder.clear();
+    return true;
+  }
+  const std::filesystem::path parent = path.parent_path();
+  if (archiveType(parent) != A_NONE &&
+      std::filesystem::is_regular_file(parent, error)) {
+    archive = parent;
+    folder = path.filename().string();
+    return true;
+  }
+  return false;
+}
+
+ArchiveReader::ArchiveReader() = default;
+
+ArchiveReader::~ArchiveReader() = default;
+
+OFCondition ArchiveReader::open(const std::filesystem::path &path) {
+  m_type = archiveType(path);
+  if (m_type == A_NONE)
+    return {0, 0, OF_error, "Unknown archive type"};
+  m_file.open(path, std::ios::binary);
+  if (!m_file)
+    return {0, 0, OF_error, "Cannot open archive"};
+  m_status = EC_Normal;
+  m_remaining = m_padding = 0;
+  m_gzip.reset();
+  m_zip_entries.clear();
+  m_zip_next = 0;
+
+  if (m_type == A_TAR_GZ) {
+    m_gzip = std::make_unique<Inflater>();
+    return m_gzip->init(15 + 32);
+  }
+  if (m_type != A_ZIP)
+    return EC_Normal;
+
+  // zip members are listed in the central directory at the end of the file
+  m_file.seekg(0, std::ios::end);
+  const auto file_size = static_cast<std::uint64_t>(m_file.tellg());
+  const std::size_t tail_size =
+      static_cast<std::size_t>(std::min<std::uint64_t>(file_size,
+                                                       ZIP_END_SEARCH));
+  std::vector<char> tail(tail_size);
+  m_file.seekg(static_cast<std::streamoff>(file_size - tail_size));
+  m_file.read(tail.data(), static_cast<std::streamsize>(tail_size));
+  if (!m_file || tail_size < ZIP_END_SIZE)
+    return {0, 0, OF_error, "Not a zip archive"};
+
+  std::size_t end = tail_size - ZIP_END_SIZE + 1;
+  do {
+    --end;
+  } while (end > 0 && le32(&tail[end]) != ZIP_END_SIG);
+  if (le32(&tail[end]) != ZIP_END_SIG)
+    return {0, 0, OF_error, "Zip end of central directory not found"};
+
+  std::uint64_t entries = le16(&tail[end + 10]);
+  std::uint64_t directory_size = le32(&tail[end + 12]);
+  std::uint64_t directory_offset = le32(&tail[end + 16]);
+  if (end >= 20 && le32(&tail[end - 20]) == ZIP64_LOCATOR_SIG) {
+    std::array<char, 56> end64{};
+    m_file.seekg(static_cast<std::streamoff>(le64(&tail[end - 20 + 8])));
+    m_file.read(end64.data(), end64.size());
+    if (!m_file || le32(end64.data()) != ZIP64_END_SIG)
+      return {0, 0, OF_error, "Corrupt zip64 end of central directory"};
+    entries = le64(&end64[32]);
+    directory_size = le64(&end64[40]);
+    directory_offset = le64(&end64[48]);
+  }
+  if (directory_offset + directory_size > file_size)
+    return {0, 0, OF_error, "Corrupt zip central directory"};
+
+  std::vector<char> directory(directory_size);
+  m_file.seekg(static_cast<std::streamoff>(directory_offset));
+  m_file.read(directory.data(), static_cast<std::streamsize>(directory_size));
+  if (!m_file)
+    return {0, 0, OF_error, "Cannot read zip central directory"};
+
+  std::size_t pos{0};
+  for (std::uint64_t i = 0; i < entries; ++i) {
+    if (pos + 46 > directory.size() ||
+        le32(&directory[pos]) != ZIP_CENTRAL_SIG)
+      return {0, 0, OF_error, "Corrupt zip central directory"};
+    const char *header = &directory[pos];
+    const std::size_t name_length = le16(header + 28);
+    const std::size_t extra_length = le16(header + 30);
+    const std::size_t comment_length = le16(header + 32);
+    if (pos + 46 + name_length + extra_length > directory.size())
+      return {0, 0, OF_error, "Corrupt zip central directory"};
+
+    ZipEntry entry{};
+    entry.flags = le16(header + 8);
+    entry.method = le16(header + 10);
+    entry.compressed_size = le32(header + 20);
+    entry.size = le32(header + 24);
+    entry.local_offset = le32(header + 42);
+    entry.name = normalizeName({header + 46, name_length});
+
+    // zip64 extended information replaces fields saturated to 0xffffffff
+    const char *extra = header + 46 + name_length;
+    for (std::size_t e = 0; e + 4 <= extra_length;) {
+      const std::uint16_t id = le16(extra + e);
+      const std::uint16_t length = le16(extra + e + 2);
+      if (id == 0x0001) {
+        const char *field = extra + e + 4;
+        const char *field_end = field + std::min<std::size_t>(
+                                            length, extra_length - e - 4);
+        for (auto *value : {&entry.size, &entry.compressed_size,
+                            &entry.local_offset}) {
+          if (*value == 0xffffffff && field + 8 <= field_end) {
+            *value = le64(field);
+            field += 8;
+          }
+        }
+      }
+      e += 4 + length;
+    }
+
+    if (!entry.name.empty() && !entry.name.ends_with('/'))
+      m_zip_entries.push_back(std::move(entry));
+    pos += 46 + name_length + extra_length + comment_length;
+  }
+  return EC_Normal;
+}
+
+bool ArchiveReader::next(ArchiveMember &member) {
+  if (m_status.bad())
+    return false;
+  return m_type == A_ZIP ? this->nextZip(member) : this->nextTar(member);
+}
+
+OFCondition ArchiveReader::read(std::vector<char> &data) {
+  if (m_status.bad())
+    return m_status;
+  if (m_type == A_ZIP)
+    return this->readZip(data);
+
+  data.resize(m_remaining);
+  OFCondition cond = this->readTarStream(data.data(), m_remaining);
+  if (cond.good())
+    cond = this->skipTarStream(m_padding);
+  m_remaining = m_padding = 0;
+  if (cond.bad())
+    m_status = cond;
+  return cond;
+}
+
+OFCondition ArchiveReader::readTarStream(char *buffer, std::uint64_t length) {
+  if (m_gzip) {
+    std::uint64_t unlimited = std::numeric_limits<std::uint64_t>::max();
+    return m_gzip->inflate(m_file, buffer, length, unlimited, true);
+  }
+  m_file.read(buffer, static_cast<std::streamsize>(length));
+  if (!m_file)
+    return {0, 0, OF_error, "Unexpected end of archive"};
+  return EC_Normal;
+}
+
+OFCondition ArchiveReader::skipTarStream(std::uint64_t length) {
+  if (!m_gzip) {
+    m_file.seekg(static_cast<std::streamoff>(length), std::ios::cur);
+    return m_file ? EC_Normal
+                  : OFCondition{0, 0, OF_error, "Unexpected end of archive"};
+  }
+  // compressed data can only be skipped by inflating it
+  std::array<char, 64 * 1024> scratch{};
+  while (length > 0) {
+    const auto chunk = std::min<std::uint64_t>(length, scratch.size());
+    const OFCondition cond = this->readTarStream(scratch.data(), chunk);
+    if (cond.bad())
+      return cond;
+    length -= chunk;
+  }
+  return EC_Normal;
+}
+
+bool ArchiveReader::nextTar(ArchiveMember &member) {
+  OFCondition cond = this->skipTarStream(m_remaining + m_padding);
+  m_remaining = m_padding = 0;
+
+  // GNU long name or pax path of the following header
+  std::string long_name{};
+  std::array<char, TAR_BLOCK> header{};
+  while (cond.good()) {
+    cond = this->readTarStream(header.data(), header.size());
+    if (cond.bad())
+      break;
+    // the archive ends with zero blocks
+    if (std::all_of(header.begin(), header.end(),
+                    [](char c) { return c == 0; }))
+      return false;
+
+    const std::uint64_t size = tarNumber(&header[124], 12);
+    const std::uint64_t padding = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+    const char type = header[156];
+
+    if (type == 'L' || type == 'x') {
+      std::vector<char> data(size);
+      cond = this->readTarStream(data.data(), size);
+      if (cond.good())
+        cond = this->skipTarStream(padding);
+      if (type == 'L')
+        long_name = tarString(data.data(), data.size());
+      else if (const std::string path = paxPath(data); !path.empty())
+        long_name = path;
+      continue;
+    }
+    if (type != '0' && type != '\0' && type != '7') {
+      // directories, links, devices, global pax headers
+      cond = this->skipTarStream(size + padding);
+      long_name.clear();
+      continue;
+    }
+
+    std::string name = long_name;
+    if (name.empty()) {
+      name = tarString(&header[0], 100);
+      // ustar prefix field
+      if (std::memcmp(&header[257], "ustar", 5) == 0 && header[345] != 0)
+        name = tarString(&header[345], 155) + "/" + name;
+    }
+    member.name = normalizeName(std::move(name));
+    member.size = size;
+    m_remaining = size;
+    m_padding = padding;
+    return true;
+  }
+  m_status = cond;
+  return false;
+}
+
+bool ArchiveReader::nextZip(ArchiveMember &member) {
+  if (m_zip_next >= m_zip_entries.size())
+    return false;
+  const ZipEntry &entry = m_zip_entries[m_zip_next++];
+  member.name = entry.name;
+  member.size = entry.size;
+  return true;
+}
+
+OFCondition ArchiveReader::readZip(std::vector<char> &data) {
+  if (m_zip_next == 0)
+    return {0, 0, OF_error, "No current archive member"};
+  const ZipEntry &entry = m_zip_entries[m_zip_next - 1];
+  if (entry.flags & 0x1)
+    return {0, 0, OF_error, "Encrypted zip members are not supported"};
+  if (entry.method != Z_NO_COMPRESSION && entry.method != Z_DEFLATED)
+    return {0, 0, OF_error, "Unsupported zip compression method"};
+
+  std::array<char, 30> local{};
+  m_file.clear();
+  m_file.seekg(static_cast<std::streamoff>(entry.local_offset));
+  m_file.read(local.data(), local.size());
+  if (!m_file || le32(local.data()) != ZIP_LOCAL_SIG)
+    return {0, 0, OF_error, "Corrupt zip local header"};
+  m_file.seekg(le16(&local[26]) + le16(&local[28]), std::ios::cur);
+
+  data.resize(entry.size);
+  if (entry.method == Z_NO_COMPRESSION) {
+    m_file.read(data.data(), static_cast<std::streamsize>(entry.size));
+    if (!m_file)
+      return {0, 0, OF_error, "Unexpected end of archive"};
+    return EC_Normal;
+  }
+  Inflater inflater{};
+  OFCondition cond = inflater.init(-15);
+  std::uint64_t limit = entry.compressed_size;
+  if (cond.good())
+    cond = inflater.inflate(m_file, data.data(), entry.size, limit, false);
+  return cond;
+}
+
+OFCondition
+ArchiveReader::listTopLevelFolders(const std::filesystem::path &path,
+                                   std::vector<std::string> &folders) {
+  ArchiveReader reader{};
+  OFCondition cond = reader.open(path);
+  if (cond.bad())
+    return cond;
+  std::set<std::string> found{};
+  ArchiveMember member{};
+  while (reader.next(member)) {
+    const auto slash = member.name.find('/');
+    found.insert(slash == std::string::npos ? std::string{}
+                                            : member.name.substr(0, slash));
+  }
+  if (reader.status().bad())
+    return reader.status();
+  folders.assign(found.begin(), found.end());
+  return EC_Normal;
+}
@@ -0,0 +1,141 @@
+#include <array>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define FNODCMANON_CRC32C_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define FNODCMANON_CRC32C_ARM 1
+#endif
+
+#include "Checksum.hpp"
+
+namespace {
+// reflected Castagnoli polynomial
+constexpr std::uint32_t POLYNOMIAL{0x82F63B78};
+
+// TABLES[k][b] = CRC of byte b followed by k zero bytes
+constexpr std::array<std::array<std::uint32_t, 256>, 8> makeTables() {
+  std::array<std::array<std::uint32_t, 256>, 8> tables{};
+  for (std::uint32_t b = 0; b < 256; ++b) {
+    std::uint32_t crc = b;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ ((crc & 1) != 0 ? POLYNOMIAL : 0);
+    }
+    tables[0][b] = crc;
+  }
+  for (std::size_t k = 1; k < tables.size(); ++k) {
+    for (std::size_t b = 0; b < 256; ++b) {
+      const std::uint32_t previous = tables[k - 1][b];
+      tables[k][b] = (previous >> 8) ^ tables[0][previous & 0xFF];
+    }
+  }
+  return tables;
+};
+
+constexpr auto TABLES = makeTables();
+
+std::uint32_t crc32cSoftware(std::uint32_t crc, const std::uint8_t *data,
+                             std::size_t length) {
+  // eight bytes per step, little endian loads done byte by byte
+  for (; length >= 8; data += 8, length -= 8) {
+    const std::uint32_t low =
+        crc ^ (static_cast<std::uint32_t>(data[0]) |
+               static_cast<std::uint32_t>(data[1]) << 8 |
+               static_cast<std::uint32_t>(data[2]) << 16 |
+               static_cast<std::uint32_t>(data[3]) << 24);
+    crc = TABLES[7][low & 0xFF] ^ TABLES[6][(low >> 8) & 0xFF] ^
+          TABLES[5][(low >> 16) & 0xFF] ^ TABLES[4][low >> 24] ^
+          TABLES[3][data[4]] ^ TABLES[2][data[5]] ^ TABLES[1][data[6]] ^
+          TABLES[0][data[7]];
+  }
+  for (; length > 0; ++data, --length) {
+    crc = (crc >> 8) ^ TABLES[0][(crc ^ *data) & 0xFF];
+  }
+  return crc;
+};
+
+#if defined(FNODCMANON_CRC32C_SSE42)
+__attribute__((target("sse4.2"))) std::uint32_t
+crc32cHardware(std::uint32_t crc, const std::uint8_t *data,
+               std::size_t length) {
+  std::uint64_t crc64 = crc;
+  for (; length >= 8; data += 8, length -= 8) {
+    std::uint64_t word{};
+    std::memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<std::uint32_t>(crc64);
+  for (; length > 0; ++data, --length) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+  return crc;
+};
+
+const bool hasHardwareCrc = __builtin_cpu_supports("sse4.2");
+#elif defined(FNODCMANON_CRC32C_ARM)
+std::uint32_t crc32cHardware(std::uint32_t crc, const std::uint8_t *data,
+                             std::size_t length) {
+  for (; length >= 8; data += 8, length -= 8) {
+    std::uint64_t word{};
+    std::memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+  }
+  for (; length > 0; ++data, --length) {
+    crc = __crc32cb(crc, *data);
+  }
+  return crc;
+};
+
+constexpr bool hasHardwareCrc{true};
+#endif
+} // namespace
+
+bool parseChecksumType(const std::string &value, E_CHECKSUM_TYPE &type) {
+  if (value == "crc32c")
+    type = CS_CRC32C;
+  else if (value == "sha256")
+    type = CS_SHA256;
+  else
+    return false;
+  return true;
+};
+
+std::uint32_t crc32c(std::uint32_t crc, const void *data, std::size_t length) {
+  const auto *bytes = static_cast<const std::uint8_t *>(data);
+  crc = ~crc;
+#if defined(FNODCMANON_CRC32C_SSE42) || defined(FNODCMANON_CRC32C_ARM)
+  if (hasHardwareCrc)
+    return ~crc32cHardware(crc, bytes, length);
+#endif
+  return ~crc32cSoftware(crc, bytes, length);
+};
+
+FileChecksum::FileChecksum(bool sha256) {
+  if (sha256)
+    m_sha256.emplace();
+};
+
+void FileChecksum::update(const void *data, std::size_t length) {
+  m_size += length;
+  m_crc = ::crc32c(m_crc, data, length);
+  if (m_sha256.has_value())
+    m_sha256->update(data, length);
+};
+
+std::string FileChecksum::sha256() {
+  if (!m_sha256.has_value())
+    return {};
+  const Sha256::Digest digest = m_sha256->finish();
+  m_sha256.reset();
+  return toHex(digest.data(), digest.size());
+};
+
+offile_off_t ChecksumFileStream::Consumer::write(const void *buf,
+                                                 offile_off_t buflen) {
+  const offile_off_t written = DcmFileConsumer::write(buf, buflen);
+  if (written > 0)
+    m_checksum.update(buf, static_cast<std::size_t>(written));
+  return written;
+};
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <fstream>
+#include <set>
+
+#include "fmt/format.h"
+
+#include "Checksum.hpp"
+#include "ChecksumManifest.hpp"
+#include "MappedFile.hpp"
+
+namespace {
+constexpr std::string_view HEADER{
+    "File,Size,CRC32C,SHA256,OldSOPInstanceUID,NewSOPInstanceUID"};
+
+std::vector<std::string> splitRow(const std::string &line) {
+  std::vector<std::string> fields{};
+  std::size_t start{0};
+  for (std::size_t comma = line.find(','); comma != std::string::npos;
+       comma = line.find(',', start)) {
+    fields.push_back(line.substr(start, comma - start));
+    start = comma + 1;
+  }
+  fields.push_back(line.substr(start));
+  return fields;
+};
+
+// study directories at or below `directory`, `depth` levels deep at most
+void findStudies(const std::filesystem::path &directory, int depth,
+                 std::vector<std::filesystem::path> &studies) {
+  std::error_code error{};
+  if (std::filesystem::exists(directory / ChecksumManifest::FILENAME, error)) {
+    studies.push_back(directory);
+    return;
+  }
+  if (depth == 0)
+    return;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(directory, error)) {
+    if (entry.is_directory(error))
+      findStudies(entry.path(), depth - 1, studies);
+  }
+};
+} // namespace
+
+OFCondition
+ChecksumManifest::load(const std::filesystem::path &study_directory) {
+  const std::filesystem::path path = study_directory / FILENAME;
+  std::error_code error{};
+  if (!std::filesystem::exists(path, error))
+    return EC_Normal;
+
+  std::vector<ChecksumEntry> entries{};
+  const OFCondition cond = ChecksumManifest::read(path, entries);
+  if (cond.bad())
+    return cond;
+
+  for (ChecksumEntry &entry : entries) {
+    if (std::filesystem::exists(study_directory / entry.file, error))
+      this->add(std::move(entry));
+  }
+  return EC_Normal;
+};
+
+OFCondition ChecksumManifest::read(const std::filesystem::path &path,
+                                   std::vector<ChecksumEntry> &entries) {
+  std::ifstream in{path, std::ios::in | std::ios::binary};
+  if (!in.is_open())
+    return {0, 0, OF_error, "unable to open checksum manifest"};
+
+  std::string line{};
+  if (!std::getline(in, line) || line != HEADER)
+    return {0, 0, OF_error, "invalid header in checksum manifest"};
+
+  while (std::getline(in, line)) {
+    if (line.empty())
+      continue;
+    const std::vector<std::string> fields = splitRow(line);
+    if (fields.size() != 6)
+      return {0, 0, OF_error, "invalid row in checksum manifest"};
+    try {
+      entries.push_back({fields[0], std::stoull(fields[1]),
+                         static_cast<std::uint32_t>(
+                             std::stoul(fields[2], nullptr, 16)),
+                         fields[3], fields[4], fields[5]});
+    } catch (const std::exception &) {
+      return {0, 0, OF_error, "invalid row in checksum manifest"};
+    }
+  }
+  return EC_Normal;
+};
+
+void ChecksumManifest::add(ChecksumEntry entry) {
+  std::scoped_lock lock{m_mutex};
+  std::string file = entry.file;
+  m_entries.insert_or_assign(std::move(file), std::move(entry));
+};
+
+void ChecksumManifest::clear() {
+  std::scoped_lock lock{m_mutex};
+  m_entries.clear();
+};
+
+bool ChecksumManifest::empty() const {
+  std::scoped_lock lock{m_mutex};
+  return m_entries.empty();
+};
+
+std::string ChecksumManifest::format() const {
+  std::string text{HEADER};
+  text += '\n';
+  std::scoped_lock lock{m_mutex};
+  for (const auto &[file, entry] : m_entries) {
+    text += fmt::format("{},{},{:08x},{},{},{}\n", file, entry.size,
+                        entry.crc32c, entry.sha256, entry.old_sop_uid,
+                        entry.new_sop_uid);
+  }
+  return text;
+};
+
+OFCondition
+ChecksumManifest::save(const std::filesystem::path &study_directory) const {
+  const std::filesystem::path path = study_directory / FILENAME;
+  const std::filesystem::path tmp_path = path.string() + ".tmp";
+  {
+    std::ofstream out{tmp_path, std::ios::out | std::ios::binary};
+    if (!out.is_open())
+      return {0, 0, OF_error, "unable to write checksum manifest"};
+    out << this->format();
+    if (!out.flush())
+      return {0, 0, OF_error, "unable to write checksum manifest"};
+  }
+
+  std::error_code error{};
+  std::filesystem::rename(tmp_path, path, error);
+  if (error)
+    return {0, 0, OF_error, "unable to replace checksum manifest"};
+  return EC_Normal;
+};
+
+OFCondition OutputChecker::check(const std::filesystem::path &directory,
+                                 ThreadPool &pool) {
+  // the output directory holds study directories, `<pseudoname>` or
+  // `<pseudoname>/<study uid>` with a mapping store; a single study directory
+  // can be checked as well
+  std::vector<std::filesystem::path> studies{};
+  std::error_code error{};
+  findStudies(directory, 2, studies);
+  if (studies.empty())
+    return {0, 0, OF_error, "no checksum manifests found"};
+  std::sort(studies.begin(), studies.end());
+
+  // rows outlive the tasks checking them
+  std::vector<std::vector<ChecksumEntry>> manifests(studies.size());
+  TaskGroup tasks{pool};
+  for (std::size_t i = 0; i < studies.size(); ++i) {
+    const std::filesystem::path manifest =
+        studies[i] / ChecksumManifest::FILENAME;
+    const OFCondition cond = ChecksumManifest::read(manifest, manifests[i]);
+    if (cond.bad()) {
+      this->addProblem(manifest.string(), cond.text());
+      continue;
+    }
+    ++m_studies;
+
+    std::set<std::string> listed{};
+    for (const ChecksumEntry &entry : manifests[i]) {
+      listed.insert(entry.file);
+      tasks.run([this, &study = studies[i], &entry]() {
+        this->checkFile(study, entry);
+      });
+    }
+
+    // files added to the output after it was written
+    const std::filesystem::path dicom = studies[i] / "DICOM";
+    for (const auto &entry :
+         std::filesystem::directory_iterator(dicom, error)) {
+      const std::string file =
+          fmt::format("DICOM/{}", entry.path().filename().string());
+      if (entry.is_regular_file(error) && listed.count(file) == 0)
+        this->addProblem(entry.path().string(), "not in checksum manifest");
+    }
+  }
+  tasks.wait();
+
+  std::sort(m_problems.begin(), m_problems.end(),
+            [](const ChecksumProblem &a, const ChecksumProblem &b) {
+              return a.path < b.path;
+            });
+  return EC_Normal;
+};
+
+void OutputChecker::checkFile(const std::filesystem::path &study,
+                              const ChecksumEntry &entry) {
+  const std::filesystem::path path = study / entry.file;
+  std::error_code error{};
+  const std::uintmax_t size = std::filesystem::file_size(path, error);
+  if (error) {
+    this->addProblem(path.string(), "missing");
+    return;
+  }
+  if (size != entry.size) {
+    this->addProblem(path.string(),
+                     fmt::format("{} bytes instead of {}", size, entry.size));
+    return;
+  }
+
+  FileChecksum checksum{!entry.sha256.empty()};
+  // empty files have nothing to map
+  if (size > 0) {
+    MappedFile file{};
+    if (file.openReadOnly(path.string()).bad()) {
+      this->addProblem(path.string(), "unable to read");
+      return;
+    }
+    checksum.update(file.data(), static_cast<std::size_t>(file.size()));
+  }
+  ++m_files;
+  m_bytes += size;
+
+  if (checksum.crc32c() != entry.crc32c) {
+    this->addProblem(path.string(),
+                     fmt::format("CRC32C {:08x} instead of {:08x}",
+                                 checksum.crc32c(), entry.crc32c));
+  } else if (checksum.sha256() != entry.sha256) {
+    this->addProblem(path.string(), "SHA-256 differs");
+  }
+};
+
+void OutputChecker::addProblem(std::string path, std::string problem) {
+  std::scoped_lock lock{m_mutex};
+  m_problems.push_back({std::move(path), std::move(problem)});
+};
@@ -1,19 +1,34 @@
 //
 // Created by Vojtěch on 18.03.2025.
 //
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <random>
+#include <shared_mutex>
+#include <vector>
 
 #include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcdict.h"
+#include "dcmtk/dcmdata/dcistrmb.h"
+#include "dcmtk/dcmdata/dcostrmb.h"
+#include "dcmtk/dcmdata/dcsequen.h"
 #include "dcmtk/dcmdata/dctagkey.h"
 #include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmdata/dcwcache.h"
 #include "dcmtk/oflog/oflog.h"
 #include "dcmtk/ofstd/ofcond.h"
-#include "dcmtk/ofstd/ofexit.h"
 
 #include "fmt/format.h"
 
+#include "AnonymizationProfile.hpp"
+#include "ArchiveReader.hpp"
 #include "DicomAnonymizer.hpp"
+#include "DirectoryWalker.hpp"
+#include "FilePipeline.hpp"
+#include "PixelDataSplice.hpp"
+#include "Sha256.hpp"
 
 OFLogger mainLogger = OFLog::getLogger("");
 
@@ -25,7 +40,8 @@ std::string generate_random_string() {
   static constexpr std::string_view chars{"abcdefghijklmnopqrstuvwxyz"
                                           "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                           "0123456789"};
-  static std::mt19937_64 rng{std::random_device{}()};
+  // one generator per thread, workers never share engine state
+  thread_local std::mt19937_64 rng{std::random_device{}()};
   std::uniform_int_distribution<std::size_t> dist(0, chars.size() - 1);
 
   std::string retval(10, '\0');
@@ -36,70 +52,330 @@ std::string generate_random_string() {
   return retval;
 };
 
-OFCondition
-StudyAnonymizer::findDicomFiles(const std::filesystem::path &study_directory) {
+namespace {
+// dictionary classification of (tag, private creator), the dictionary does not
+// change during a run so every tag is looked up only once per process
+class TagClassCache {
+public:
+  bool isUnknown(const DcmTag &tag) {
+    const char *creator = tag.getPrivateCreator();
+    const Key key{static_cast<std::uint32_t>(tag.getGroup()) << 16 |
+                      tag.getElement(),
+                  creator != nullptr ? creator : ""};
+    {
+      std::shared_lock lock{m_mutex};
+      const auto it = m_unknown.find(key);
+      if (it != m_unknown.end())
+        return it->second;
+    }
 
-  // remove previous filenames and series uids when iterating over new study
-  // directory
-  if (!m_dicom_files.empty())
-    m_dicom_files.clear();
-  if (!m_series_uids.empty())
-    m_series_uids.clear();
+    // same lookup DcmTag::getTagName uses, unknown tags are named
+    // "Unknown Tag & Data"
+    const DcmDataDictionary &dictionary = dcmDataDict.rdlock();
+    const bool unknown = dictionary.findEntry(tag, creator) == nullptr;
+    dcmDataDict.rdunlock();
+
+    std::unique_lock lock{m_mutex};
+    m_unknown.emplace(key, unknown);
+    return unknown;
+  };
+
+private:
+  struct Key {
+    std::uint32_t tag{0};
+    std::string private_creator{};
+
+    bool operator==(const Key &other) const = default;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const {
+      return std::hash<std::string>{}(key.private_creator) ^
+             (static_cast<std::size_t>(key.tag) * 0x9e3779b97f4a7c15ULL);
+    };
+  };
+
+  std::shared_mutex m_mutex{};
+  std::unordered_map<Key, bool, KeyHash> m_unknown{};
+};
 
-  for (const auto &entry :
-       std::filesystem::recursive_directory_iterator(study_directory)) {
-    if (entry.is_directory() || entry.path().filename() == "DICOMDIR")
-      continue;
+bool isUnknownTag(const DcmTag &tag) {
+  static TagClassCache cache{};
+  return cache.isUnknown(tag);
+};
 
-    m_dicom_files.push_back(entry.path().string());
-  }
+// saveFile() feeding the written bytes to `checksum`
+OFCondition saveFile(DcmFileFormat &fileformat, const std::string &path,
+                     E_TransferSyntax xfer, FileChecksum &checksum) {
+  ChecksumFileStream stream{path, checksum};
+  if (stream.status().bad())
+    return stream.status();
+
+  DcmWriteCache cache{};
+  fileformat.transferInit();
+  OFCondition cond = fileformat.write(stream, xfer, EET_UndefinedLength,
+                                      &cache, EGL_recalcGL);
+  fileformat.transferEnd();
+  stream.flush();
+  if (cond.good())
+    cond = stream.status();
+  return cond;
+};
 
+// archive member `name` belongs to the study of top-level `folder`
+bool isStudyMember(const std::string &name, const std::string &folder) {
+  if (std::filesystem::path(name).filename() == "DICOMDIR")
+    return false;
+  return folder.empty() || (name.size() > folder.size() &&
+                            name.starts_with(folder) &&
+                            name[folder.size()] == '/');
+};
+} // namespace
+
+OFCondition readFromBuffer(DcmFileFormat &fileformat,
+                           const std::vector<char> &data,
+                           const DcmTagKey &stop_tag) {
+  DcmInputBufferStream stream{};
+  stream.setBuffer(data.data(), static_cast<offile_off_t>(data.size()));
+  stream.setEos();
+  fileformat.transferInit();
+  const OFCondition cond = fileformat.readUntilTag(
+      stream, EXS_Unknown, EGL_noChange, DCM_MaxReadLength, stop_tag);
+  fileformat.transferEnd();
+  return cond;
+};
+
+OFCondition writeToBuffer(DcmFileFormat &fileformat, E_TransferSyntax xfer,
+                          std::vector<char> &buffer) {
+  std::vector<char> chunk(1024 * 1024);
+  DcmOutputBufferStream stream{chunk.data(),
+                               static_cast<offile_off_t>(chunk.size())};
+  buffer.clear();
+  const auto drain = [&]() {
+    void *data = nullptr;
+    offile_off_t length = 0;
+    stream.flushBuffer(data, length);
+    const char *bytes = static_cast<const char *>(data);
+    buffer.insert(buffer.end(), bytes, bytes + length);
+  };
+
+  fileformat.transferInit();
   OFCondition cond{};
-  if (m_dicom_files.empty()) {
+  do {
+    cond = fileformat.write(stream, xfer, EET_UndefinedLength, nullptr,
+                            EGL_recalcGL);
+    drain();
+  } while (cond == EC_StreamNotifyClient);
+  fileformat.transferEnd();
+
+  // the end of a deflated dataset is still in the compression filter, as in
+  // the DIMSE writer of dcmnet
+  if (cond.good()) {
+    stream.flush();
+    while (!stream.isFlushed()) {
+      drain();
+      stream.flush();
+    }
+    drain();
+  }
+  return cond;
+};
+
+OFCondition findDicomFiles(const std::filesystem::path &study_directory,
+                           StudyInput &study, ThreadPool &pool,
+                           bool with_sizes) {
+  study.source = study_directory;
+  study.files.clear();
+  study.total_bytes = 0;
+  study.rejected.clear();
+
+  std::mutex files_mutex{};
+  DirectoryWalker walker{pool, with_sizes};
+  const OFCondition cond =
+      walker.walk(study_directory, [&](DicomInputFile &&file) {
+        if (std::filesystem::path(file.path).filename() == "DICOMDIR")
+          return;
+
+        // stray files would fail loading and abort the whole study
+        std::string reason{};
+        const bool is_dicom = sniffDicomFile(file.path, reason);
+        std::scoped_lock lock{files_mutex};
+        if (!is_dicom) {
+          study.rejected.push_back({std::move(file.path), std::move(reason)});
+          return;
+        }
+        study.total_bytes += file.size;
+        study.files.push_back(std::move(file));
+      });
+  if (cond.bad())
+    return cond;
+
+  if (!study.rejected.empty()) {
+    OFLOG_WARN(mainLogger, "skipping " << study.rejected.size()
+                                       << " non-DICOM files in `"
+                                       << study_directory.string() << "`");
+  }
+
+  if (study.files.empty()) {
     const std::string msg =
         fmt::format("no dicom files found in `{}`", study_directory.string());
     OFLOG_WARN(mainLogger, msg.c_str());
     return {0, 0, OF_failure, msg.c_str()};
   }
 
+  // file index decides hex filenames, keep it independent of iteration order
+  std::sort(study.files.begin(), study.files.end(),
+            [](const DicomInputFile &lhs, const DicomInputFile &rhs) {
+              return lhs.path < rhs.path;
+            });
+  for (std::size_t i = 0; i < study.files.size(); ++i) {
+    study.files[i].output_index = static_cast<unsigned int>(i);
+  }
+
   return EC_Normal;
 }
 
-OFCondition StudyAnonymizer::anonymizeStudy(
-    const std::filesystem::path &input_study_directory,
-    const std::string &output_directory,
-    const std::set<E_ADDIT_ANONYM_METHODS> &methods,
-    const std::string &uid_root) {
+StudyAnonymizer::StudyAnonymizer(const AnonymizerConfig &config)
+    : m_config{config}, m_profile{selectProfileTable(config.methods)} {};
 
-  OFCondition cond{};
+void copyHeader(DcmDataset *dataset, DicomHeader &header) {
+  dataset->findAndGetOFString(DCM_PatientID, header.patient_id);
+  dataset->findAndGetOFString(DCM_PatientName, header.patient_name);
+  dataset->findAndGetOFString(DCM_StudyInstanceUID, header.study_uid);
+  dataset->findAndGetOFString(DCM_StudyDate, header.study_date);
+  dataset->findAndGetOFString(DCM_SeriesInstanceUID, header.series_uid);
+  dataset->findAndGetOFString(DCM_SOPInstanceUID, header.sop_uid);
+}
+
+OFCondition readDicomHeader(const std::string &path, DicomHeader &header) {
+  // stop at PixelData, only the attributes in front of it are needed and
+  // large multi-frame objects are not read past their header
+  DcmFileFormat fileformat{};
+  const OFCondition cond = fileformat.loadFileUntilTag(
+      path, EXS_Unknown, EGL_noChange, DCM_MaxReadLength, ERM_autoDetect,
+      DCM_PixelData);
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, "unable to read header of " << path.c_str());
+    OFLOG_ERROR(mainLogger, cond.text());
+    return cond;
+  }
 
-  cond = this->findDicomFiles(input_study_directory);
+  copyHeader(fileformat.getDataset(), header);
+  return cond;
+}
+
+OFCondition readDicomHeader(const std::vector<char> &data,
+                            const std::string &name, DicomHeader &header) {
+  DcmFileFormat fileformat{};
+  const OFCondition cond = readFromBuffer(fileformat, data, DCM_PixelData);
   if (cond.bad()) {
-    OFLOG_ERROR(mainLogger, "error while searching dicom files");
+    OFLOG_ERROR(mainLogger, "unable to read header of " << name.c_str());
     OFLOG_ERROR(mainLogger, cond.text());
     return cond;
   }
 
-  cond = this->setBasicTags();
+  copyHeader(fileformat.getDataset(), header);
+  return cond;
+}
+
+OFCondition findArchiveStudy(const std::filesystem::path &archive,
+                             const std::string &folder, StudyInput &study) {
+  study.files.clear();
+  study.rejected.clear();
+  study.archive = archive;
+  study.archive_folder = folder;
+  // members are not listed upfront, that would inflate the whole archive
+  std::error_code error{};
+  study.total_bytes = std::filesystem::file_size(archive, error);
+
+  ArchiveReader reader{};
+  OFCondition cond = reader.open(archive);
+  ArchiveMember member{};
+  while (cond.good() && reader.next(member)) {
+    if (!isStudyMember(member.name, folder))
+      continue;
+    std::vector<char> data{};
+    cond = reader.read(data);
+    std::string reason{};
+    if (cond.bad() || !sniffDicomBuffer(data.data(), data.size(), reason))
+      continue;
+
+    // archive studies have no file list to fall back to in setBasicTags
+    DicomHeader header{};
+    const std::string name = (archive / member.name).string();
+    cond = readDicomHeader(data, name, header);
+    if (cond.good())
+      study.header = std::move(header);
+    return cond;
+  }
+  if (cond.good())
+    cond = reader.status();
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, "unable to read archive `"
+                                << archive.string() << "`: " << cond.text());
+    return cond;
+  }
+
+  const std::string msg =
+      fmt::format("no dicom files found in `{}`", study.source.string());
+  OFLOG_WARN(mainLogger, msg.c_str());
+  return {0, 0, OF_failure, msg.c_str()};
+}
 
-  fmt::print("\nanonymizing study {}, {} dicom files\n", m_old_id,
-             m_dicom_files.size());
+OFCondition StudyAnonymizer::beginStudy(const StudyInput &study) {
+  OFCondition cond{};
 
-  char newStudyUID[65];
-  dcmGenerateUniqueIdentifier(newStudyUID, uid_root.c_str());
-  m_new_studyuid = OFString(newStudyUID);
+  m_series_uids.clear();
+  if (study.identity.has_value())
+    m_series_uids = study.identity->series_uids;
+  m_written_files.clear();
+  m_old_sop_uids.clear();
+  m_checksums.clear();
+  m_phase_times.clear();
+  m_rejected.clear();
+  m_invalid_tags_removed = 0;
+
+  cond = this->setBasicTags(study);
+  if (cond.bad())
+    return cond;
+
+  if (!study.archive.empty()) {
+    fmt::print("\nanonymizing study {} from `{}`\n", m_old_id,
+               study.source.string());
+  } else if (study.files.empty()) {
+    fmt::print("\nreceiving study {}\n", m_old_id);
+  } else {
+    fmt::print("\nanonymizing study {}, {} dicom files\n", m_old_id,
+               study.files.size());
+  }
+
+  // studies started or anonymized by an earlier run keep their identity
+  m_study_key = study.source.string();
+  if (study.identity.has_value()) {
+    m_new_studyuid = study.identity->new_study_uid;
+  } else {
+    m_new_studyuid = m_config.mapUid(MK_STUDY_UID, m_old_studyuid);
+  }
 
   OFLOG_INFO(mainLogger, "replacing StudyInstanceUID (old) " << m_old_studyuid
                                                              << " with (new) "
                                                              << m_new_studyuid);
 
-  this->setPseudoname();
+  if (study.identity.has_value()) {
+    m_pseudoname = study.identity->pseudoname;
+  } else {
+    this->setPseudoname(study.study_number);
+  }
 
   fmt::print("applying pseudoname {} to ID {}\n", m_pseudoname, m_old_id);
 
-  m_output_study_dir = fmt::format("{}/{}", output_directory, m_pseudoname);
+  m_study_path = m_config.studyPath(m_pseudoname, m_new_studyuid);
+  m_output_study_dir =
+      fmt::format("{}/{}", m_config.output_directory, m_study_path);
 
-  if (std::filesystem::exists(m_output_study_dir)) {
+  if (m_config.tar_writer != nullptr) {
+    // members are named below the study path, no directories are created
+  } else if (std::filesystem::exists(m_output_study_dir)) {
     OFLOG_INFO(mainLogger, "directory `" << m_output_study_dir
                                          << "` exists, overwriting files");
   } else {
@@ -107,171 +383,330 @@ OFCondition StudyAnonymizer::anonymizeStudy(
     OFLOG_INFO(mainLogger, "created directory `" << m_output_study_dir << "`");
   }
 
-  for (const auto &file : m_dicom_files) {
-    OFCondition cond = m_fileformat.loadFile(file);
+  // files kept from an earlier run stay in the manifest
+  if (m_config.checksum_type != CS_NONE && m_config.tar_writer == nullptr) {
+    cond = m_checksums.load(m_output_study_dir);
     if (cond.bad()) {
-      OFLOG_ERROR(mainLogger, "unable to load file " << file.c_str());
-      OFLOG_ERROR(mainLogger, cond.text());
-      return cond;
+      OFLOG_WARN(mainLogger, "ignoring checksums of `"
+                                 << m_output_study_dir << "`: " << cond.text());
+      cond = EC_Normal;
     }
+  }
 
-    m_dataset = m_fileformat.getDataset();
+  if (m_config.journal != nullptr) {
+    cond = m_config.journal->begin(m_study_key, m_pseudoname, m_new_studyuid);
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "error while writing journal: " << cond.text());
+      return cond;
+    }
+  }
 
-    // dicom tags anonymization specification
-    // https://dicom.nema.org/medical/dicom/current/output/chtml/part15/chapter_E.html
-    // deidentification methods explained
-    // https://dicom.nema.org/medical/dicom/current/output/chtml/part16/sect_CID_7050.html
+  return cond;
+}
 
-    // Basic Application Confidentiality Profile
-    this->anonymizeBasicProfile();
+OFCondition StudyAnonymizer::anonymizeStudy(const StudyInput &study,
+                                            ThreadPool &pool,
+                                            FilePipeline *pipeline) {
 
-    // Retain Patient Characteristics Option
-    if (methods.contains(M_113108)) {
-      // clean some patient characteristics tags, others are kept as is
-      m_dataset->putAndInsertString(DCM_Allergies, "");
-      m_dataset->putAndInsertString(DCM_PatientState, "");
-      m_dataset->putAndInsertString(DCM_PreMedication, "");
-      m_dataset->putAndInsertString(DCM_SpecialNeeds, "");
-    } else {
-      // remove patient characteristics tags
-      this->anonymizePatientCharacteristicsProfile();
-    }
+  const std::string source = study.source.string();
+  ScopedPhase phase{PH_STUDY, nullptr, source};
+  OFCondition cond = this->beginStudy(study);
+  if (cond.bad())
+    return cond;
 
-    if (!methods.contains(M_113109)) {
-      this->anonymizeDeviceProfile();
-    }
-    // Retain Institution Identity Option
-    if (!methods.contains(M_113112)) {
-      this->anonymizeInstitutionProfile();
+  if (!study.archive.empty()) {
+    cond = this->anonymizeArchive(study, pool);
+  } else if (pipeline != nullptr) {
+    cond = pipeline->processStudy(*this, study);
+  }
+  if (!study.archive.empty() || pipeline != nullptr) {
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "error while processing study `"
+                                  << source << "`, skipping to next study");
+      return cond;
     }
 
-    std::string oldSeriesUID{};
-    m_dataset->findAndGetOFString(DCM_SeriesInstanceUID, oldSeriesUID);
+    cond = this->writeChecksums();
+    if (cond.good())
+      cond = this->syncOutput();
+    if (cond.bad())
+      return cond;
+    this->logStudySummary();
+    fmt::print("finished anonymization of {}\n", m_old_id);
+    return cond;
+  }
 
-    const std::string newSeriesUID =
-        this->getSeriesUids(oldSeriesUID, uid_root.c_str());
-    m_dataset->putAndInsertString(DCM_SeriesInstanceUID, newSeriesUID.c_str());
+  // files run as pool tasks; the first failing file stops the remaining ones
+  // and fails the study
+  std::atomic<bool> failed{false};
+  std::mutex error_mutex{};
+  OFCondition first_error{};
+
+  TaskGroup files{pool};
+  for (std::size_t i = 0; i < study.files.size(); ++i) {
+    files.run([&, i]() {
+      if (failed)
+        return;
+
+      const OFCondition file_cond =
+          this->anonymizeFile(study.files[i], study.files[i].output_index);
+      if (file_cond.bad() && !failed.exchange(true)) {
+        std::scoped_lock lock{error_mutex};
+        first_error = file_cond;
+      }
+    });
+  }
+  files.wait();
 
-    char newSOPInstanceUID[65];
-    dcmGenerateUniqueIdentifier(newSOPInstanceUID, uid_root.c_str());
-    m_dataset->putAndInsertOFStringArray(DCM_SOPInstanceUID, newSOPInstanceUID);
+  if (failed) {
+    OFLOG_ERROR(mainLogger, "error while processing study `"
+                                << source << "`, skipping to next study");
+    std::scoped_lock lock{error_mutex};
+    return first_error;
+  }
 
-    m_dataset->putAndInsertOFStringArray(DCM_StudyInstanceUID, newStudyUID);
+  // TODO: add in future?
+  //  this->writeTags();
+  cond = this->writeChecksums();
+  if (cond.good())
+    cond = this->syncOutput();
+  if (cond.bad())
+    return cond;
+  this->logStudySummary();
+  fmt::print("finished anonymization of {}\n", m_old_id);
+  return cond;
+}
 
-    cond = this->removeInvalidTags();
+OFCondition StudyAnonymizer::anonymizeArchive(const StudyInput &study,
+                                              ThreadPool &pool) {
+  ArchiveReader reader{};
+  OFCondition cond = reader.open(study.archive);
+  if (cond.bad())
+    return cond;
 
-    cond = this->writeDicomFile();
+  std::atomic<bool> failed{false};
+  std::mutex error_mutex{};
+  OFCondition first_error{};
+  // inflated members waiting for a worker, bounded so the reader does not
+  // inflate the whole archive ahead of the workers
+  const std::size_t max_in_flight = 2 * static_cast<std::size_t>(pool.size());
+  std::atomic<std::size_t> in_flight{0};
+  unsigned int index{0};
+
+  TaskGroup files{pool};
+  ArchiveMember member{};
+  while (!failed && reader.next(member)) {
+    if (!isStudyMember(member.name, study.archive_folder))
+      continue;
 
-    if (cond.bad()) {
-      OFLOG_ERROR(mainLogger, "error while processing study `"
-                                  << input_study_directory.stem().string()
-                                  << "`, skipping to next study");
-      OFLOG_ERROR(mainLogger, cond.text());
-      return cond;
+    DicomInputFile file{(study.archive / member.name).string(), member.size,
+                        index};
+    // queued members hold budget, so wait by running them instead of
+    // blocking in acquire()
+    auto reservation = std::make_shared<MemoryBudget::Reservation>();
+    bool reserved{false};
+    pool.waitUntil([&]() {
+      if (in_flight >= max_in_flight)
+        return false;
+      if (m_config.memory_budget == nullptr || in_flight == 0)
+        return true;
+      reserved = m_config.memory_budget->tryAcquire(file.size, *reservation);
+      return reserved;
+    });
+    // nothing of this study holds budget, only other studies can free it
+    if (!reserved)
+      *reservation = this->reserveMemory(file);
+
+    auto data = std::make_shared<std::vector<char>>();
+    cond = reader.read(*data);
+    if (cond.bad())
+      break;
+    std::string reason{};
+    if (!sniffDicomBuffer(data->data(), data->size(), reason)) {
+      m_rejected.push_back({std::move(file.path), std::move(reason)});
+      continue;
     }
+    file.data = std::move(data);
+    ++index;
+
+    ++in_flight;
+    files.run([&, file = std::move(file), reservation]() {
+      if (!failed) {
+        const OFCondition file_cond =
+            this->anonymizeFile(file, file.output_index);
+        if (file_cond.bad() && !failed.exchange(true)) {
+          std::scoped_lock lock{error_mutex};
+          first_error = file_cond;
+        }
+      }
+      --in_flight;
+      pool.notifyAll();
+    });
   }
+  files.wait();
 
-  // TODO: add in future?
-  //  this->writeTags();
-  fmt::print("finished anonymization of {}\n", m_old_id);
+  if (!m_rejected.empty()) {
+    OFLOG_WARN(mainLogger, "skipping " << m_rejected.size()
+                                       << " non-DICOM files in `"
+                                       << study.source.string() << "`");
+  }
+  if (failed) {
+    std::scoped_lock lock{error_mutex};
+    return first_error;
+  }
+  if (cond.good())
+    cond = reader.status();
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, "unable to read archive `"
+                                << study.archive.string()
+                                << "`: " << cond.text());
+  }
   return cond;
 }
 
-void StudyAnonymizer::anonymizeBasicProfile() {
-  // basic patient tags
-  m_dataset->putAndInsertOFStringArray(DCM_PatientName, m_pseudoname);
-  m_dataset->putAndInsertOFStringArray(DCM_PatientID, m_pseudoname);
-  m_dataset->putAndInsertString(DCM_PatientSex, "O");
-  m_dataset->findAndDeleteElement(DCM_PatientAddress);
-  m_dataset->findAndDeleteElement(DCM_AdditionalPatientHistory);
-  m_dataset->findAndDeleteElement(DCM_PatientInstitutionResidence);
-
-  // other institution staff - operator, physicians
-  m_dataset->putAndInsertString(DCM_ConsultingPhysicianName, "");
-  m_dataset->findAndDeleteElement(
-      DCM_ConsultingPhysicianIdentificationSequence);
-  m_dataset->findAndDeleteElement(DCM_OperatorsName);
-  m_dataset->findAndDeleteElement(DCM_NameOfPhysiciansReadingStudy);
-  m_dataset->findAndDeleteElement(DCM_PerformingPhysicianName);
-  m_dataset->findAndDeleteElement(
-      DCM_PerformingPhysicianIdentificationSequence);
-  m_dataset->findAndDeleteElement(DCM_PhysiciansOfRecord);
-  m_dataset->findAndDeleteElement(DCM_PhysiciansOfRecordIdentificationSequence);
-  m_dataset->findAndDeleteElement(DCM_ReferringPhysicianName);
-  m_dataset->findAndDeleteElement(DCM_ReferringPhysicianAddress);
-  m_dataset->findAndDeleteElement(DCM_ReferringPhysicianIdentificationSequence);
-  m_dataset->findAndDeleteElement(DCM_ReferringPhysicianTelephoneNumbers);
-  m_dataset->findAndDeleteElement(DCM_RequestingPhysician);
-  m_dataset->findAndDeleteElement(DCM_ScheduledPerformingPhysicianName);
-  m_dataset->findAndDeleteElement(
-      DCM_ScheduledPerformingPhysicianIdentificationSequence);
-};
+OFCondition StudyAnonymizer::anonymizeFile(const DicomInputFile &file,
+                                           unsigned int file_index) {
+  // held until the file is written; archive members are reserved by the
+  // reader before they are inflated
+  const MemoryBudget::Reservation reservation =
+      file.data ? MemoryBudget::Reservation{} : this->reserveMemory(file);
+  ScopedPhase phase{PH_FILE, &m_phase_times, file.path};
+
+  DcmFileFormat fileformat{};
+  OFCondition cond = this->loadDicomFile(file, fileformat);
+  if (cond.bad())
+    return cond;
 
-void StudyAnonymizer::anonymizePatientCharacteristicsProfile() {
-  m_dataset->findAndDeleteElement(DCM_Allergies);
-  m_dataset->findAndDeleteElement(DCM_PatientAge);
-  m_dataset->findAndDeleteElement(DCM_PatientSexNeutered);
-  m_dataset->findAndDeleteElement(DCM_PatientSize);
-  m_dataset->findAndDeleteElement(DCM_PatientWeight);
-  m_dataset->findAndDeleteElement(DCM_PatientState);
-  m_dataset->findAndDeleteElement(DCM_PregnancyStatus);
-  m_dataset->findAndDeleteElement(DCM_PreMedication);
-  m_dataset->findAndDeleteElement(DCM_SmokingStatus);
-  m_dataset->findAndDeleteElement(DCM_SpecialNeeds);
-};
+  cond = this->anonymizeDataset(fileformat.getDataset(), file);
+  if (cond.bad())
+    return cond;
 
-void StudyAnonymizer::anonymizeInstitutionProfile() {
-  m_dataset->findAndDeleteElement(DCM_InstitutionAddress);
-  m_dataset->findAndDeleteElement(DCM_InstitutionName);
-  m_dataset->findAndDeleteElement(DCM_InstitutionalDepartmentName);
-  m_dataset->findAndDeleteElement(DCM_InstitutionalDepartmentTypeCodeSequence);
-  m_dataset->findAndDeleteElement(DCM_InstitutionCodeSequence);
-};
+  return this->writeDicomFile(fileformat, file, file_index);
+}
+
+OFCondition StudyAnonymizer::loadDicomFile(const DicomInputFile &file,
+                                           DcmFileFormat &fileformat) const {
+  ScopedPhase phase{PH_LOAD, &m_phase_times, file.path};
+  OFCondition cond = file.data ? readFromBuffer(fileformat, *file.data)
+                               : fileformat.loadFile(file.path);
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, "unable to load file " << file.path.c_str());
+    OFLOG_ERROR(mainLogger, cond.text());
+  }
+  return cond;
+}
+
+MemoryBudget::Reservation
+StudyAnonymizer::reserveMemory(const DicomInputFile &file) const {
+  if (m_config.memory_budget == nullptr)
+    return {};
+  return m_config.memory_budget->acquire(file.size);
+}
+
+OFCondition StudyAnonymizer::anonymizeDataset(DcmDataset *dataset,
+                                              const DicomInputFile &file) {
+  // dicom tags anonymization specification
+  // https://dicom.nema.org/medical/dicom/current/output/chtml/part15/chapter_E.html
+  // deidentification methods explained
+  // https://dicom.nema.org/medical/dicom/current/output/chtml/part16/sect_CID_7050.html
+
+  // Basic Application Confidentiality Profile with the retain options
+  // selected on the command line, applied in one pass over the dataset
+  {
+    ScopedPhase phase{PH_PROFILE, &m_phase_times};
+    applyProfileTable(dataset, m_profile, m_pseudoname);
+  }
+
+  {
+    ScopedPhase phase{PH_UIDS, &m_phase_times};
+    std::string oldSeriesUID{};
+    dataset->findAndGetOFString(DCM_SeriesInstanceUID, oldSeriesUID);
+
+    const std::string newSeriesUID =
+        this->getSeriesUids(oldSeriesUID, m_config.uid_root.c_str());
+    dataset->putAndInsertString(DCM_SeriesInstanceUID, newSeriesUID.c_str());
+
+    std::string oldSOPInstanceUID{};
+    dataset->findAndGetOFString(DCM_SOPInstanceUID, oldSOPInstanceUID);
+    const std::string newSOPInstanceUID =
+        m_config.mapUid(MK_SOP_UID, oldSOPInstanceUID);
+    dataset->putAndInsertString(DCM_SOPInstanceUID,
+                                newSOPInstanceUID.c_str());
+    if (m_config.checksum_type != CS_NONE) {
+      std::scoped_lock lock{m_written_mutex};
+      m_old_sop_uids[newSOPInstanceUID] = oldSOPInstanceUID;
+    }
+
+    dataset->putAndInsertOFStringArray(DCM_StudyInstanceUID, m_new_studyuid);
+
+    if (m_config.remapsReferences())
+      this->remapReferencedUids(dataset);
+  }
+
+  unsigned long removed{0};
+  OFCondition cond{};
+  {
+    ScopedPhase phase{PH_INVALID_TAGS, &m_phase_times};
+    cond = StudyAnonymizer::removeInvalidTags(dataset, removed);
+  }
+  if (removed > 0) {
+    OFLOG_DEBUG(mainLogger, "removed " << removed << " invalid tags from `"
+                                       << file.path << "`");
+    m_invalid_tags_removed += removed;
+  }
+  return cond;
+}
+
+void StudyAnonymizer::setPseudoname(unsigned int study_number) {
+  // a patient seen in an earlier study or run keeps its pseudoname
+  if (m_config.mapping_store != nullptr && !m_old_id.empty()) {
+    m_pseudoname = m_config.mapping_store->getOrInsert(
+        MK_PATIENT_ID, m_old_id,
+        [&]() { return this->makePseudoname(study_number); });
+    return;
+  }
 
-void StudyAnonymizer::anonymizeDeviceProfile() {
-  m_dataset->findAndDeleteElement(DCM_DeviceDescription);
-  m_dataset->findAndDeleteElement(DCM_DeviceLabel);
-  m_dataset->findAndDeleteElement(DCM_DeviceSerialNumber);
-  m_dataset->findAndDeleteElement(DCM_ManufacturerDeviceIdentifier);
-  m_dataset->findAndDeleteElement(DCM_PerformedStationName);
-  m_dataset->findAndDeleteElement(DCM_PerformedStationNameCodeSequence);
-  m_dataset->findAndDeleteElement(DCM_ScheduledStationName);
-  m_dataset->findAndDeleteElement(DCM_ScheduledStationNameCodeSequence);
-  m_dataset->findAndDeleteElement(DCM_SourceManufacturer);
-  m_dataset->findAndDeleteElement(DCM_SourceSerialNumber);
-  m_dataset->findAndDeleteElement(DCM_StationName);
+  m_pseudoname = this->makePseudoname(study_number);
 };
 
-void StudyAnonymizer::setPseudoname() {
-
-  if (m_pseudoname_type == P_RANDOM_STRING) {
-    m_pseudoname =
-        fmt::format("{}{}", m_pseudoname_prefix, generate_random_string());
-  } else if (m_pseudoname_type == P_INTEGER_ORDER) {
-    m_pseudoname = fmt::format("{0}{1:0{2}}", m_pseudoname_prefix,
-                               m_study_count, m_count_width);
-    ++m_study_count;
-  } else if (m_pseudoname_type == P_FROM_FILE) {
-    if (m_id_pseudoname_map.contains(m_old_id)) {
-      m_pseudoname = fmt::format("{}{}", m_pseudoname_prefix,
-                                 m_id_pseudoname_map[m_old_id]);
-      return;
+std::string StudyAnonymizer::makePseudoname(unsigned int study_number) const {
+  const std::string &prefix = m_config.pseudoname_prefix;
+
+  if (m_config.pseudoname_type == P_INTEGER_ORDER) {
+    // derived from study position instead of a shared counter, so concurrent
+    // workers assign the same numbers as a serial run
+    return fmt::format("{0}{1:0{2}}", prefix, study_number,
+                       m_config.count_width);
+  } else if (m_config.pseudoname_type == P_FROM_FILE) {
+    const auto found = m_config.pseudonyms != nullptr
+                           ? m_config.pseudonyms->find(m_old_id)
+                           : std::nullopt;
+    if (found.has_value()) {
+      return fmt::format("{}{}", prefix, *found);
     }
 
-    m_pseudoname = fmt::format("{}{}_{}", m_pseudoname_prefix, "UN",
-                               generate_random_string());
+    std::string pseudoname =
+        fmt::format("{}{}_{}", prefix, "UN", generate_random_string());
     OFLOG_WARN(mainLogger,
                "ID " << m_old_id << " not in PatientID-pseudoname file");
     OFLOG_WARN(mainLogger, "generated random string instead "
-                               << m_old_id << " -> " << m_pseudoname);
+                               << m_old_id << " -> " << pseudoname);
+    return pseudoname;
   }
+
+  return fmt::format("{}{}", prefix, generate_random_string());
 };
 
 std::string StudyAnonymizer::getSeriesUids(const std::string &old_series_uid,
                                            const char *root) {
 
+  // keyed or stored UIDs need no per-study map
+  if (m_config.remapsReferences() && !old_series_uid.empty())
+    return m_config.mapUid(MK_SERIES_UID, old_series_uid);
+
   // add old-new series uid map if there isn't one
   // otherwise return existing new uid
+  std::scoped_lock lock{m_series_mutex};
   if (!m_series_uids.contains(old_series_uid)) {
     char uid[65];
     dcmGenerateUniqueIdentifier(uid, root);
@@ -281,27 +716,32 @@ std::string StudyAnonymizer::getSeriesUids(const std::string &old_series_uid,
   return m_series_uids[old_series_uid];
 };
 
-OFCondition StudyAnonymizer::removeInvalidTags() const {
+OFCondition StudyAnonymizer::removeInvalidTags(DcmDataset *dataset,
+                                               unsigned long &removed) {
 
   OFCondition cond{};
+  removed = 0;
   // sanity check
-  if (m_dataset == nullptr) {
+  if (dataset == nullptr) {
     cond = {0, 0, OF_error, "dataset is nullptr"};
     OFLOG_ERROR(mainLogger, cond.text());
     return cond;
   }
 
-  for (unsigned long i = 0; i < m_dataset->card(); ++i) {
-    const DcmElement *element = m_dataset->getElement(i);
-    DcmTag tag = element->getTag();
-    const DcmTagKey tagKey = DcmTagKey(element->getGTag(), element->getETag());
-    const std::string tagName = tag.getTagName();
-    if (tagName == "Unknown Tag & Data") {
-      m_dataset->findAndDeleteElement(tagKey);
-      --i; // decrement due to deleting total number of tags
+  // collect in one walk, removing while walking would restart the search
+  std::vector<DcmObject *> invalid{};
+  DcmObject *object = nullptr;
+  while ((object = dataset->nextInContainer(object)) != nullptr) {
+    if (isUnknownTag(object->getTag())) {
+      invalid.push_back(object);
     }
   }
 
+  for (DcmObject *element : invalid) {
+    delete dataset->remove(element);
+  }
+  removed = static_cast<unsigned long>(invalid.size());
+
   if (cond.bad()) {
     OFLOG_ERROR(mainLogger, "error while removing invalid tags");
   }
@@ -309,83 +749,256 @@ OFCondition StudyAnonymizer::removeInvalidTags() const {
   return cond;
 };
 
-OFCondition StudyAnonymizer::setBasicTags() {
-  OFCondition cond = m_fileformat.loadFile(m_dicom_files[0].c_str());
-  if (cond.bad()) {
-    OFLOG_ERROR(mainLogger, "unable to load file " << m_dicom_files[0].c_str());
-    OFLOG_ERROR(mainLogger, cond.text());
-    return cond;
+void StudyAnonymizer::remapReferencedUids(DcmItem *item) const {
+  DcmObject *object = nullptr;
+  while ((object = item->nextInContainer(object)) != nullptr) {
+    if (object->ident() != EVR_SQ)
+      continue;
+
+    auto *sequence = static_cast<DcmSequenceOfItems *>(object);
+    for (unsigned long i = 0; i < sequence->card(); ++i) {
+      DcmItem *nested = sequence->getItem(i);
+      DcmObject *element = nullptr;
+      while ((element = nested->nextInContainer(element)) != nullptr) {
+        // inside items these tags name other objects, SOP class UIDs and
+        // frame of reference UIDs are kept
+        const DcmTagKey tag = element->getTag();
+        E_MAPPING_KIND kind{};
+        if (tag == DCM_ReferencedSOPInstanceUID ||
+            tag == DCM_SOPInstanceUID) {
+          kind = MK_SOP_UID;
+        } else if (tag == DCM_SeriesInstanceUID) {
+          kind = MK_SERIES_UID;
+        } else if (tag == DCM_StudyInstanceUID) {
+          kind = MK_STUDY_UID;
+        } else {
+          continue;
+        }
+
+        auto *uid_element = static_cast<DcmElement *>(element);
+        OFString old_uid{};
+        if (uid_element->getOFString(old_uid, 0).bad() || old_uid.empty())
+          continue;
+        const std::string new_uid =
+            m_config.mapUid(kind, std::string(old_uid.c_str()));
+        uid_element->putString(new_uid.c_str());
+      }
+      this->remapReferencedUids(nested);
+    }
   }
+};
 
-  DcmDataset *ds = m_fileformat.getDataset();
-  ds->findAndGetOFString(DCM_PatientID, m_old_id);
-  ds->findAndGetOFString(DCM_PatientName, m_old_name);
-  ds->findAndGetOFString(DCM_StudyInstanceUID, m_old_studyuid);
-  ds->findAndGetOFString(DCM_StudyDate, m_study_date);
-  ds = nullptr;
-  m_fileformat.clear();
-  return cond;
-}
+OFCondition StudyAnonymizer::setBasicTags(const StudyInput &study) {
+  // identity comes from the cached prescan header, the first file is only
+  // fully loaded once in the file loop
+  DicomHeader header{};
+  if (study.header.has_value()) {
+    header = *study.header;
+  } else if (study.files.empty()) {
+    return {0, 0, OF_error, "no dicom header to take the identity from"};
+  } else {
+    const OFCondition cond = readDicomHeader(study.files[0].path, header);
+    if (cond.bad())
+      return cond;
+  }
 
-OFCondition
-StudyAnonymizer::readPseudonamesFromFile(const std::string &filename) {
-  OFCondition cond{};
+  m_old_id = header.patient_id;
+  m_old_name = header.patient_name;
+  m_old_studyuid = header.study_uid;
+  m_study_date = header.study_date;
+  return EC_Normal;
+}
 
-  std::ifstream file{filename, std::ios::in};
-  if (!file.is_open()) {
-    OFCondition cond{0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
-                     "error reading file with pseudonames"};
-    OFLOG_ERROR(mainLogger, cond.text());
-    return cond;
+std::string deriveUid(std::string_view secret, std::string_view root,
+                      std::string_view old_uid) {
+  Sha256::Digest digest = hmacSha256(secret, old_uid);
+
+  // digest as big endian integer, converted to decimal by repeated division
+  std::string digits{};
+  bool zero = false;
+  while (!zero) {
+    unsigned int remainder = 0;
+    zero = true;
+    for (std::uint8_t &byte : digest) {
+      const unsigned int value = remainder * 256 + byte;
+      byte = static_cast<std::uint8_t>(value / 10);
+      remainder = value % 10;
+      zero = zero && byte == 0;
+    }
+    digits.push_back(static_cast<char>('0' + remainder));
   }
+  std::reverse(digits.begin(), digits.end());
 
-  std::string line{};
-  while (std::getline(file, line)) {
+  // keep most significant digits, a component never starts with 0
+  const std::size_t available = 64 - root.size() - 1;
+  if (digits.size() > available)
+    digits.resize(available);
+  return fmt::format("{}.{}", root, digits);
+};
 
-    std::erase_if(line, ::isspace);
-    const std::size_t delimiter_pos = line.find(',');
-    std::string patient_id = line.substr(0, delimiter_pos);
-    const std::string pseudoname = line.substr(delimiter_pos + 1);
+std::string AnonymizerConfig::newUid(const std::string &old_uid) const {
+  // without an old UID to key on every file would get the same UID
+  if (!uid_secret.empty() && !old_uid.empty())
+    return deriveUid(uid_secret, uid_root, old_uid);
 
-    // correct PatientID formatting
-    std::erase(patient_id, '/');
-    std::erase_if(patient_id, ::isalpha);
+  char uid[65];
+  dcmGenerateUniqueIdentifier(uid, uid_root.c_str());
+  return std::string(uid);
+};
 
-    if (!m_id_pseudoname_map.contains(patient_id)) {
-      m_id_pseudoname_map.emplace(patient_id, pseudoname);
-    }
-  }
-  file.close();
-  OFLOG_INFO(mainLogger,
-             "found " << static_cast<unsigned int>(m_id_pseudoname_map.size())
-                      << " PatientID-pseudoname pairs to apply");
+std::string AnonymizerConfig::mapUid(E_MAPPING_KIND kind,
+                                     const std::string &old_uid) const {
+  if (mapping_store == nullptr || old_uid.empty())
+    return this->newUid(old_uid);
 
-  return cond;
+  return mapping_store->getOrInsert(kind, old_uid,
+                                    [&]() { return this->newUid(old_uid); });
+};
+
+std::string
+AnonymizerConfig::studyPath(const std::string &pseudoname,
+                            const std::string &new_study_uid) const {
+  if (mapping_store == nullptr)
+    return pseudoname;
+  return fmt::format("{}/{}", pseudoname, new_study_uid);
 };
 
-OFCondition StudyAnonymizer::writeDicomFile() {
+OFCondition StudyAnonymizer::writeDicomFile(DcmFileFormat &fileformat,
+                                            const DicomInputFile &file,
+                                            unsigned int file_index) {
   OFCondition cond{};
 
-  const E_TransferSyntax xfer = m_dataset->getCurrentXfer();
-  m_dataset->chooseRepresentation(xfer, nullptr);
-  m_fileformat.loadAllDataIntoMemory();
+  DcmDataset *dataset = fileformat.getDataset();
+  E_TransferSyntax xfer = dataset->getCurrentXfer();
 
-  std::string path = fmt::format("{}/DICOM/", m_output_study_dir);
-  switch (m_filename_type) {
+  std::string name{};
+  switch (m_config.filename_type) {
   case F_HEX:
-    path += fmt::format("{:08X}", m_files_processed);
-    ++m_files_processed;
+    // position in the sorted file list, stable regardless of which task
+    // finishes first
+    name = fmt::format("{:08X}", file_index);
     break;
   case F_MODALITY_SOPINSTUID: {
     std::string modality{}, sopInstanceUid{};
-    m_dataset->findAndGetOFString(DCM_Modality, modality);
-    m_dataset->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUid);
-    path += fmt::format("{}{}", modality, sopInstanceUid);
+    dataset->findAndGetOFString(DCM_Modality, modality);
+    dataset->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUid);
+    name = fmt::format("{}{}", modality, sopInstanceUid);
     break;
   }
   }
 
-  cond = m_fileformat.saveFile(path, xfer);
+  // sizes before and after encoding go into the run's transcoding report
+  const bool transcode =
+      m_config.output_xfer != EXS_Unknown && m_config.output_xfer != xfer;
+  const auto encode_start = std::chrono::steady_clock::now();
+  std::uint64_t input_bytes{0};
+  bool transcoded{false};
+  if (transcode) {
+    ScopedPhase phase{PH_ENCODE, &m_phase_times, file.path};
+    fileformat.loadAllDataIntoMemory();
+    input_bytes = fileformat.calcElementLength(xfer, EET_ExplicitLength);
+    transcoded = encodePixelData(dataset, m_config.output_xfer);
+    if (transcoded) {
+      xfer = m_config.output_xfer;
+    } else {
+      OFLOG_WARN(mainLogger, "cannot encode `"
+                                 << file.path << "` as "
+                                 << DcmXfer(m_config.output_xfer).getXferName()
+                                 << ", keeping its transfer syntax");
+      if (m_config.transcode_stats != nullptr)
+        m_config.transcode_stats->addFallback();
+    }
+  }
+  const auto encode_end = std::chrono::steady_clock::now();
+  ScopedPhase savePhase{PH_SAVE, &m_phase_times, file.path};
+  // deflate happens while the file is serialized
+  const auto encodeTime = [&]() {
+    return xfer == EXS_DeflatedLittleEndianExplicit
+               ? std::chrono::steady_clock::now() - encode_start
+               : encode_end - encode_start;
+  };
+
+  // bytes are checksummed as they are written, never read back
+  std::optional<FileChecksum> checksum{};
+  if (m_config.checksum_type != CS_NONE)
+    checksum.emplace(m_config.checksum_type == CS_SHA256);
+
+  // the tar header needs the size upfront, so the whole file is serialized
+  // in memory; pixel data is always re-encoded
+  if (m_config.tar_writer != nullptr) {
+    const std::string member = fmt::format("{}/DICOM/{}", m_study_path, name);
+    dataset->chooseRepresentation(xfer, nullptr);
+    std::vector<char> buffer{};
+    cond = writeToBuffer(fileformat, xfer, buffer);
+    if (cond.good() && transcoded && m_config.transcode_stats != nullptr)
+      m_config.transcode_stats->add(input_bytes, buffer.size(), encodeTime());
+    if (cond.good() && checksum.has_value())
+      checksum->update(buffer.data(), buffer.size());
+    if (cond.good())
+      cond = m_config.tar_writer->addFile(member, buffer.data(), buffer.size());
+    if (cond.good()) {
+      this->addChecksum(checksum, dataset, fmt::format("DICOM/{}", name));
+      std::scoped_lock lock{m_written_mutex};
+      m_written_files.emplace_back(file.path, member);
+    } else {
+      OFLOG_ERROR(mainLogger, "error writing tar member `" << member << "`");
+      OFLOG_ERROR(mainLogger, cond.text());
+    }
+    return cond;
+  }
+
+  const std::string path =
+      fmt::format("{}/DICOM/{}", m_output_study_dir, name);
+
+  // pixel data is never modified: write the anonymized header only and splice
+  // the original PixelData element bytes behind it
+  // written under a temporary name and renamed once complete, so a crash
+  // never leaves a truncated file under the final name
+  const std::string part_path = path + ".part";
+  const auto save = [&]() {
+    if (checksum.has_value())
+      return saveFile(fileformat, part_path, xfer, *checksum);
+    return fileformat.saveFile(part_path, xfer);
+  };
+  FileRange pixelRange{};
+  if (m_config.pixel_passthrough && !file.data && !transcode &&
+      findPixelDataRange(file.path, dataset, pixelRange)) {
+    dataset->findAndDeleteElement(DCM_PixelData);
+    cond = save();
+    if (cond.good())
+      cond = appendFileRange(file.path, pixelRange, part_path,
+                             checksum.has_value() ? &*checksum : nullptr);
+  } else {
+    dataset->chooseRepresentation(xfer, nullptr);
+    fileformat.loadAllDataIntoMemory();
+    cond = save();
+  }
+
+  if (cond.good() && transcoded && m_config.transcode_stats != nullptr) {
+    const auto elapsed = encodeTime();
+    std::error_code error{};
+    const std::uintmax_t output_bytes =
+        std::filesystem::file_size(part_path, error);
+    if (!error)
+      m_config.transcode_stats->add(input_bytes, output_bytes, elapsed);
+  }
+
+  // the journal's DONE record must not outlive the file in a power loss
+  if (cond.good() && m_config.journal != nullptr)
+    cond = syncPath(part_path, false);
+  if (cond.good()) {
+    std::error_code error{};
+    std::filesystem::rename(part_path, path, error);
+    if (error)
+      cond = {0, 0, OF_error, "unable to rename written file"};
+  }
+  if (cond.good() && m_config.journal != nullptr)
+    cond = m_config.journal->file(m_study_key, path);
+  if (cond.good()) {
+    this->addChecksum(checksum, dataset, fmt::format("DICOM/{}", name));
+    std::scoped_lock lock{m_written_mutex};
+    m_written_files.emplace_back(file.path, path);
+  }
 
   if (cond.bad()) {
     OFLOG_ERROR(mainLogger, "error writing file `" << path << "`");
@@ -394,6 +1007,98 @@ OFCondition StudyAnonymizer::writeDicomFile() {
   return cond;
 };
 
+void StudyAnonymizer::addChecksum(std::optional<FileChecksum> &checksum,
+                                  DcmDataset *dataset,
+                                  const std::string &file) {
+  if (!checksum.has_value())
+    return;
+
+  ChecksumEntry entry{file, checksum->size(), checksum->crc32c(),
+                      checksum->sha256()};
+  dataset->findAndGetOFString(DCM_SOPInstanceUID, entry.new_sop_uid);
+  {
+    std::scoped_lock lock{m_written_mutex};
+    const auto it = m_old_sop_uids.find(entry.new_sop_uid);
+    if (it != m_old_sop_uids.end()) {
+      entry.old_sop_uid = it->second;
+      m_old_sop_uids.erase(it);
+    }
+  }
+  m_checksums.add(std::move(entry));
+};
+
+OFCondition StudyAnonymizer::writeChecksums() {
+  if (m_config.checksum_type == CS_NONE)
+    return EC_Normal;
+
+  OFCondition cond{};
+  if (m_config.tar_writer != nullptr) {
+    const std::string text = m_checksums.format();
+    cond = m_config.tar_writer->addFile(
+        fmt::format("{}/{}", m_study_path, ChecksumManifest::FILENAME),
+        text.data(), text.size());
+  } else {
+    cond = m_checksums.save(m_output_study_dir);
+  }
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, "error writing checksums of study "
+                                << m_old_id << ": " << cond.text());
+  }
+  return cond;
+};
+
+OFCondition StudyAnonymizer::syncOutput() const {
+  if (m_config.journal == nullptr || m_config.tar_writer != nullptr)
+    return EC_Normal;
+
+  // renamed files and created directories live in their parents' entries
+  const std::filesystem::path root{m_config.output_directory};
+  std::vector<std::filesystem::path> directories{
+      std::filesystem::path{m_output_study_dir} / "DICOM"};
+  for (std::filesystem::path sub{m_study_path}; !sub.empty();
+       sub = sub.parent_path()) {
+    directories.push_back(root / sub);
+  }
+  directories.push_back(root);
+
+  for (const std::filesystem::path &directory : directories) {
+    const OFCondition cond = syncPath(directory.string(), true);
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "error syncing `" << directory.string()
+                                                << "`: " << cond.text());
+      return cond;
+    }
+  }
+  return EC_Normal;
+};
+
+void StudyAnonymizer::logStudySummary() const {
+  OFLOG_INFO(mainLogger, "removed " << m_invalid_tags_removed
+                                    << " invalid tags from study "
+                                    << m_old_id);
+  if (PhaseProfiler::active() == nullptr)
+    return;
+  for (const std::string &line : m_phase_times.summary()) {
+    OFLOG_INFO(mainLogger, "study " << m_old_id << " " << line);
+  }
+};
+
+std::unordered_map<std::string, std::string> StudyAnonymizer::seriesUids() {
+  std::scoped_lock lock{m_series_mutex};
+  return m_series_uids;
+};
+
+std::vector<std::pair<std::string, std::string>>
+StudyAnonymizer::writtenFiles() {
+  std::scoped_lock lock{m_written_mutex};
+  return m_written_files;
+};
+
+std::string StudyAnonymizer::csvRow() const {
+  return fmt::format("{},{},{},{},{},{}\n", m_old_id, m_old_name, m_pseudoname,
+                     m_study_date, m_old_studyuid, m_new_studyuid);
+};
+
 OFCondition StudyAnonymizer::writeTags() const {
   std::ofstream csvfile{m_output_study_dir + "/tags.csv", std::ios::out};
   if (!csvfile.is_open()) {
@@ -0,0 +1,103 @@
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+
+#include "fmt/format.h"
+
+#include "DicomSniffer.hpp"
+
+namespace {
+constexpr std::size_t PREAMBLE_LENGTH{128};
+constexpr std::size_t SNIFF_LENGTH{PREAMBLE_LENGTH + 4};
+
+std::uint16_t readUint16LE(const unsigned char *bytes) {
+  return static_cast<std::uint16_t>(bytes[0] | bytes[1] << 8);
+};
+
+std::uint32_t readUint32LE(const unsigned char *bytes) {
+  return static_cast<std::uint32_t>(bytes[0]) |
+         static_cast<std::uint32_t>(bytes[1]) << 8 |
+         static_cast<std::uint32_t>(bytes[2]) << 16 |
+         static_cast<std::uint32_t>(bytes[3]) << 24;
+};
+
+// datasets written without preamble (old ACR-NEMA style exports) start with
+// a low element of the meta or identifying group
+bool looksLikeHeaderlessDicom(const unsigned char *bytes, std::size_t length) {
+  if (length < 8)
+    return false;
+
+  const std::uint16_t group = readUint16LE(bytes);
+  const std::uint16_t element = readUint16LE(bytes + 2);
+  if ((group != 0x0002 && group != 0x0008) || element > 0x0020)
+    return false;
+
+  // explicit VR: two upper case letters
+  if (std::isupper(bytes[4]) && std::isupper(bytes[5]))
+    return true;
+
+  // implicit VR: a short first value, group length elements are 4 bytes
+  const std::uint32_t value_length = readUint32LE(bytes + 4);
+  if (element == 0x0000)
+    return value_length == 4;
+  return value_length <= 0x1000;
+};
+} // namespace
+
+bool sniffDicomFile(const std::string &path, std::string &reason) {
+  std::ifstream file{path, std::ios::in | std::ios::binary};
+  if (!file.is_open()) {
+    reason = "unreadable";
+    return false;
+  }
+
+  std::array<char, SNIFF_LENGTH> bytes{};
+  file.read(bytes.data(), bytes.size());
+  return sniffDicomBuffer(bytes.data(), static_cast<std::size_t>(file.gcount()),
+                          reason);
+};
+
+bool sniffDicomBuffer(const char *data, std::size_t length,
+                      std::string &reason) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+  if (length >= SNIFF_LENGTH && bytes[128] == 'D' && bytes[129] == 'I' &&
+      bytes[130] == 'C' && bytes[131] == 'M')
+    return true;
+  if (looksLikeHeaderlessDicom(bytes, length))
+    return true;
+
+  reason = length < 8 ? "too short" : "not a DICOM file";
+  return false;
+};
+
+OFCondition writeRejectedReport(const std::string &filename,
+                                const std::vector<RejectedFile> &rejected) {
+  std::ofstream report{filename, std::ios::out};
+  if (!report.is_open())
+    return {0, 0, OF_error, "error while creating rejected files report"};
+
+  writeRejectedReport(report, rejected);
+  report.close();
+  if (!report)
+    return {0, 0, OF_error, "error while writing rejected files report"};
+  return EC_Normal;
+};
+
+void writeRejectedReport(std::ostream &report,
+                         const std::vector<RejectedFile> &rejected) {
+  report << "Path,Reason\n";
+  writeRejectedRows(report, rejected);
+};
+
+void writeRejectedRows(std::ostream &report,
+                       const std::vector<RejectedFile> &rejected) {
+  for (const RejectedFile &file : rejected) {
+    // quote paths, they may contain commas
+    std::string quoted{};
+    for (const char c : file.path) {
+      quoted += c == '"' ? std::string("\"\"") : std::string(1, c);
+    }
+    report << fmt::format("\"{}\",{}\n", quoted, file.reason);
+  }
+};
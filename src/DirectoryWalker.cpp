@@ -0,0 +1,163 @@
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "dcmtk/oflog/oflog.h"
+
+#include "DirectoryWalker.hpp"
+#include "PhaseTimer.hpp"
+
+namespace {
+#if defined(__linux__)
+// layout returned by getdents64, not exported by glibc headers
+struct LinuxDirent64 {
+  std::uint64_t d_ino;
+  std::int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+// large batches cut round trips on network filesystems
+constexpr std::size_t DIRENT_BUFFER_SIZE{256 * 1024};
+#endif
+} // namespace
+
+OFCondition DirectoryWalker::walk(const std::filesystem::path &root,
+                                  const FileCallback &on_file) {
+  std::error_code error{};
+  if (!std::filesystem::is_directory(root, error)) {
+    return {0, 0, OF_error, "not a directory"};
+  }
+
+  std::string directory = root.string();
+  while (directory.size() > 1 && directory.back() == '/') {
+    directory.pop_back();
+  }
+
+  TaskGroup group{m_pool};
+  this->readDirectory(directory, group, on_file);
+  group.wait();
+  return EC_Normal;
+};
+
+#if defined(__linux__)
+
+void DirectoryWalker::readDirectory(const std::string &directory,
+                                    TaskGroup &group,
+                                    const FileCallback &on_file) {
+  ScopedPhase phase{PH_WALK, nullptr, directory};
+  const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    OFLOG_WARN(mainLogger, "unable to read directory `"
+                               << directory << "`: " << std::strerror(errno));
+    return;
+  }
+
+  std::vector<char> buffer(DIRENT_BUFFER_SIZE);
+  while (true) {
+    const long count =
+        syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+    if (count < 0) {
+      OFLOG_WARN(mainLogger, "error while reading directory `"
+                                 << directory
+                                 << "`: " << std::strerror(errno));
+      break;
+    }
+    if (count == 0)
+      break;
+
+    for (long offset = 0; offset < count;) {
+      const auto *entry =
+          reinterpret_cast<const LinuxDirent64 *>(buffer.data() + offset);
+      offset += entry->d_reclen;
+
+      const char *name = entry->d_name;
+      if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0)
+        continue;
+
+      // like std::filesystem::is_directory/is_regular_file, links are
+      // followed for the type but linked directories are not descended
+      bool is_directory = entry->d_type == DT_DIR;
+      bool is_file = entry->d_type == DT_REG;
+      bool descend = is_directory;
+      struct stat info{};
+      bool have_info = false;
+      if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+        if (fstatat(fd, name, &info, 0) != 0)
+          continue;
+        have_info = true;
+        is_directory = S_ISDIR(info.st_mode);
+        is_file = S_ISREG(info.st_mode);
+        descend = is_directory && entry->d_type == DT_UNKNOWN;
+      }
+
+      std::string path = directory + '/' + name;
+      if (descend) {
+        group.run([this, path = std::move(path), &group, &on_file]() {
+          this->readDirectory(path, group, on_file);
+        });
+        continue;
+      }
+      if (!is_file)
+        continue;
+
+      DicomInputFile file{std::move(path), 0, 0};
+      if (m_with_sizes) {
+        if (!have_info && fstatat(fd, name, &info, 0) == 0)
+          have_info = true;
+        if (have_info)
+          file.size = static_cast<std::uintmax_t>(info.st_size);
+      }
+      on_file(std::move(file));
+    }
+  }
+
+  close(fd);
+};
+
+#else
+
+void DirectoryWalker::readDirectory(const std::string &directory,
+                                    TaskGroup &group,
+                                    const FileCallback &on_file) {
+  ScopedPhase phase{PH_WALK, nullptr, directory};
+  std::error_code error{};
+  std::filesystem::directory_iterator it{directory, error};
+  if (error) {
+    OFLOG_WARN(mainLogger, "unable to read directory `"
+                               << directory << "`: " << error.message());
+    return;
+  }
+
+  for (; it != std::filesystem::directory_iterator{}; it.increment(error)) {
+    if (error)
+      break;
+    const std::filesystem::directory_entry &entry = *it;
+    if (entry.is_directory(error) && !entry.is_symlink(error)) {
+      group.run([this, path = entry.path().string(), &group, &on_file]() {
+        this->readDirectory(path, group, on_file);
+      });
+      continue;
+    }
+    if (!entry.is_regular_file(error))
+      continue;
+
+    DicomInputFile file{entry.path().string(), 0, 0};
+    if (m_with_sizes) {
+      const std::uintmax_t size = entry.file_size(error);
+      file.size = error ? 0 : size;
+    }
+    on_file(std::move(file));
+  }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include <algorithm>
+
+#include "dcmtk/oflog/oflog.h"
+
+#include "FilePipeline.hpp"
+
+FilePipeline::FilePipeline(const PipelineConfig &config)
+    : m_load_all_data{config.load_all_data}, m_input{config.read_queue_depth},
+      m_loaded{config.read_queue_depth},
+      m_transformed{config.write_queue_depth} {
+  for (unsigned int i = 0; i < std::max(1U, config.read_threads); ++i) {
+    m_readers.emplace_back([this]() { this->readStage(); });
+  }
+  for (unsigned int i = 0; i < std::max(1U, config.transform_threads); ++i) {
+    m_transformers.emplace_back([this]() { this->transformStage(); });
+  }
+  for (unsigned int i = 0; i < std::max(1U, config.write_threads); ++i) {
+    m_writers.emplace_back([this]() { this->writeStage(); });
+  }
+};
+
+FilePipeline::~FilePipeline() {
+  // drain stage by stage so no queued file is dropped
+  m_input.close();
+  for (auto &thread : m_readers) {
+    thread.join();
+  }
+  m_loaded.close();
+  for (auto &thread : m_transformers) {
+    thread.join();
+  }
+  m_transformed.close();
+  for (auto &thread : m_writers) {
+    thread.join();
+  }
+};
+
+OFCondition FilePipeline::processStudy(StudyAnonymizer &anonymizer,
+                                       const StudyInput &study) {
+  StudyJob job{anonymizer};
+  job.remaining = study.files.size();
+  if (job.remaining == 0)
+    return EC_Normal;
+
+  for (std::size_t i = 0; i < study.files.size(); ++i) {
+    Item item{&job, &study.files[i], study.files[i].output_index, nullptr,
+              {}};
+    if (!m_input.push(std::move(item))) {
+      // pipeline shutting down, account for files never queued
+      std::scoped_lock lock{job.mutex};
+      job.remaining -= study.files.size() - i;
+      break;
+    }
+  }
+
+  std::unique_lock lock{job.mutex};
+  job.done.wait(lock, [&job]() { return job.remaining == 0; });
+
+  if (job.failed)
+    return job.first_error;
+  return EC_Normal;
+};
+
+void FilePipeline::readStage() {
+  while (auto item = m_input.pop()) {
+    if (item->job->failed) {
+      finish(*item, EC_Normal);
+      continue;
+    }
+
+    // reserved bytes travel with the item and are returned in finish()
+    item->reservation = item->job->anonymizer.reserveMemory(*item->file);
+    item->fileformat = std::make_unique<DcmFileFormat>();
+    OFCondition cond = item->job->anonymizer.loadDicomFile(
+        *item->file, *item->fileformat);
+    // pull element values into memory here so the transform and write stages
+    // never block on the input file; with pixel passthrough PixelData is
+    // copied from the input file by the writer and stays on disk
+    if (cond.good() && m_load_all_data)
+      cond = item->fileformat->loadAllDataIntoMemory();
+
+    if (cond.bad()) {
+      finish(*item, cond);
+      continue;
+    }
+
+    m_loaded.push(std::move(*item));
+  }
+};
+
+void FilePipeline::transformStage() {
+  while (auto item = m_loaded.pop()) {
+    if (item->job->failed) {
+      finish(*item, EC_Normal);
+      continue;
+    }
+
+    const OFCondition cond = item->job->anonymizer.anonymizeDataset(
+        item->fileformat->getDataset(), *item->file);
+    if (cond.bad()) {
+      finish(*item, cond);
+      continue;
+    }
+
+    m_transformed.push(std::move(*item));
+  }
+};
+
+void FilePipeline::writeStage() {
+  while (auto item = m_transformed.pop()) {
+    OFCondition cond{};
+    if (!item->job->failed) {
+      cond = item->job->anonymizer.writeDicomFile(
+          *item->fileformat, *item->file, item->index);
+    }
+    finish(*item, cond);
+  }
+};
+
+void FilePipeline::finish(Item &item, const OFCondition &cond) {
+  item.fileformat.reset();
+  item.reservation = {};
+
+  StudyJob &job = *item.job;
+  std::scoped_lock lock{job.mutex};
+  if (cond.bad() && !job.failed.exchange(true)) {
+    job.first_error = cond;
+  }
+  // notify under the lock, `job` lives on the waiting thread's stack
+  if (--job.remaining == 0) {
+    job.done.notify_all();
+  }
+};
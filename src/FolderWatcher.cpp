@@ -0,0 +1,287 @@
+#include "FolderWatcher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#else
+#include <thread>
+#endif
+
+#include "dcmtk/oflog/oflog.h"
+
+#include "ArchiveReader.hpp"
+#include "DicomAnonymizer.hpp"
+
+namespace {
+// upper bound of a single wait, so stop requests are noticed
+constexpr std::chrono::milliseconds MAX_POLL{500};
+
+std::atomic<bool> stopRequested{false};
+
+extern "C" void requestStop(int) { stopRequested = true; }
+
+bool isStudyEntry(const std::filesystem::path &path) {
+  std::error_code error{};
+  return std::filesystem::is_directory(path, error) ||
+         (std::filesystem::is_regular_file(path, error) &&
+          archiveType(path) != A_NONE);
+};
+
+#ifdef __linux__
+constexpr std::uint32_t ROOT_MASK{IN_CREATE | IN_MOVED_TO | IN_MODIFY |
+                                  IN_CLOSE_WRITE | IN_ONLYDIR};
+constexpr std::uint32_t FOLDER_MASK{IN_CREATE | IN_MOVED_TO | IN_MODIFY |
+                                    IN_CLOSE_WRITE | IN_DELETE |
+                                    IN_MOVED_FROM | IN_ONLYDIR};
+#else
+// full snapshots of pending entries are compared this often
+constexpr std::chrono::seconds SCAN_INTERVAL{2};
+#endif
+} // namespace
+
+FolderWatcher::FolderWatcher(const std::filesystem::path &root,
+                             std::chrono::seconds quiet_period)
+    : m_root{root}, m_quiet_period{quiet_period} {};
+
+FolderWatcher::~FolderWatcher() {
+#ifdef __linux__
+  if (m_fd >= 0)
+    ::close(m_fd);
+#endif
+  std::signal(SIGINT, SIG_DFL);
+  std::signal(SIGTERM, SIG_DFL);
+};
+
+OFCondition FolderWatcher::open() {
+#ifdef __linux__
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd < 0)
+    return {0, 0, OF_error, "unable to initialize inotify"};
+  m_root_wd = inotify_add_watch(m_fd, m_root.c_str(), ROOT_MASK);
+  if (m_root_wd < 0)
+    return {0, 0, OF_error, "unable to watch input directory"};
+#endif
+
+  stopRequested = false;
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+
+  // added after the root watch, so nothing created in between is missed
+  std::error_code error{};
+  for (const auto &entry :
+       std::filesystem::directory_iterator(m_root, error)) {
+    this->addEntry(entry.path().filename().string());
+  }
+  if (error)
+    return {0, 0, OF_error, "unable to list input directory"};
+  return EC_Normal;
+};
+
+bool FolderWatcher::wait(std::vector<std::filesystem::path> &ready) {
+  ready.clear();
+  while (!stopRequested) {
+    const Clock::time_point now = Clock::now();
+    Clock::time_point next = now + MAX_POLL;
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+      const Clock::time_point deadline = it->second + m_quiet_period;
+      if (deadline <= now) {
+        ready.push_back(m_root / it->first);
+        m_reported.emplace(it->first, false);
+        const std::string name = it->first;
+        it = m_pending.erase(it);
+        this->removeEntry(name);
+        continue;
+      }
+      next = std::min(next, deadline);
+      ++it;
+    }
+    if (!ready.empty()) {
+      // same order as a batch run over the same entries
+      std::sort(ready.begin(), ready.end());
+      return true;
+    }
+
+    this->poll(next - now);
+  }
+  return false;
+};
+
+void FolderWatcher::touch(const std::string &name) {
+  const auto reported = m_reported.find(name);
+  if (reported == m_reported.end()) {
+    m_pending[name] = Clock::now();
+  } else if (!reported->second) {
+    reported->second = true;
+    OFLOG_WARN(mainLogger, "`" << (m_root / name).string()
+                               << "` changed after it was anonymized, "
+                                  "ignoring the change");
+  }
+};
+
+void FolderWatcher::addEntry(const std::string &name) {
+  // known entries only restart their quiet period
+  if (m_pending.contains(name) || m_reported.contains(name)) {
+    this->touch(name);
+    return;
+  }
+  const std::filesystem::path path = m_root / name;
+  if (!isStudyEntry(path))
+    return;
+
+  OFLOG_INFO(mainLogger, "watching `" << path.string() << "`");
+  this->touch(name);
+#ifdef __linux__
+  std::error_code error{};
+  if (std::filesystem::is_directory(path, error))
+    this->addWatches(path, name);
+#else
+  m_snapshots[name] = this->snapshot(name);
+#endif
+};
+
+#ifdef __linux__
+void FolderWatcher::removeEntry(const std::string &name) {
+  for (auto it = m_watches.begin(); it != m_watches.end();) {
+    if (it->second.entry == name) {
+      inotify_rm_watch(m_fd, it->first);
+      it = m_watches.erase(it);
+    } else {
+      ++it;
+    }
+  }
+};
+
+void FolderWatcher::addWatches(const std::filesystem::path &directory,
+                               const std::string &entry) {
+  // watched before listing, files created meanwhile are seen either way
+  const int wd = inotify_add_watch(m_fd, directory.c_str(), FOLDER_MASK);
+  if (wd < 0) {
+    OFLOG_WARN(mainLogger, "unable to watch `"
+                               << directory.string()
+                               << "`: " << std::strerror(errno));
+    return;
+  }
+  m_watches[wd] = {entry, directory};
+
+  std::error_code error{};
+  for (const auto &child :
+       std::filesystem::directory_iterator(directory, error)) {
+    if (child.is_directory(error))
+      this->addWatches(child.path(), entry);
+  }
+};
+
+void FolderWatcher::poll(Clock::duration timeout) {
+  pollfd fd{m_fd, POLLIN, 0};
+  const auto ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count();
+  if (::poll(&fd, 1, static_cast<int>(std::max<decltype(ms)>(ms, 0))) > 0 &&
+      (fd.revents & POLLIN) != 0)
+    this->readEvents();
+};
+
+void FolderWatcher::readEvents() {
+  alignas(inotify_event) std::array<char, 64 * 1024> buffer{};
+  while (true) {
+    const ssize_t length = ::read(m_fd, buffer.data(), buffer.size());
+    if (length <= 0)
+      return;
+
+    for (ssize_t offset = 0; offset < length;) {
+      const auto *event =
+          reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+      offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+      const std::string name = event->len > 0 ? event->name : "";
+
+      if ((event->mask & IN_Q_OVERFLOW) != 0) {
+        // events were lost, restart the quiet period of everything pending
+        for (auto &[entry, last_change] : m_pending) {
+          last_change = Clock::now();
+        }
+        continue;
+      }
+      if ((event->mask & IN_IGNORED) != 0) {
+        m_watches.erase(event->wd);
+        continue;
+      }
+
+      if (event->wd == m_root_wd) {
+        if (!name.empty())
+          this->addEntry(name);
+        continue;
+      }
+      const auto it = m_watches.find(event->wd);
+      if (it == m_watches.end())
+        continue;
+      this->touch(it->second.entry);
+      if ((event->mask & IN_ISDIR) != 0 &&
+          (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+        // copy `it` members, addWatches() may rehash m_watches
+        const Watch watch = it->second;
+        this->addWatches(watch.directory / name, watch.entry);
+      }
+    }
+  }
+};
+#else
+void FolderWatcher::removeEntry(const std::string &name) {
+  m_snapshots.erase(name);
+};
+
+void FolderWatcher::poll(Clock::duration timeout) {
+  const Clock::time_point now = Clock::now();
+  if (now < m_next_scan) {
+    std::this_thread::sleep_for(std::min(timeout, m_next_scan - now));
+    return;
+  }
+  m_next_scan = now + SCAN_INTERVAL;
+
+  std::error_code error{};
+  for (const auto &entry :
+       std::filesystem::directory_iterator(m_root, error)) {
+    const std::string name = entry.path().filename().string();
+    if (!m_pending.contains(name) && !m_reported.contains(name))
+      this->addEntry(name);
+  }
+  for (auto &[name, previous] : m_snapshots) {
+    Snapshot current = this->snapshot(name);
+    if (current != previous) {
+      previous = current;
+      this->touch(name);
+    }
+  }
+};
+
+FolderWatcher::Snapshot
+FolderWatcher::snapshot(const std::string &name) const {
+  Snapshot snapshot{};
+  std::error_code error{};
+  const std::filesystem::path path = m_root / name;
+  const auto add = [&](const std::filesystem::directory_entry &entry) {
+    if (!entry.is_regular_file(error))
+      return;
+    ++snapshot.files;
+    snapshot.bytes += entry.file_size(error);
+    snapshot.newest = std::max(snapshot.newest, entry.last_write_time(error));
+  };
+
+  if (!std::filesystem::is_directory(path, error)) {
+    add(std::filesystem::directory_entry{path, error});
+    return snapshot;
+  }
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(path, error)) {
+    add(entry);
+  }
+  return snapshot;
+};
+#endif
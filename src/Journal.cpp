@@ -0,0 +1,203 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Journal.hpp"
+
+namespace {
+std::string escape(const std::string &field) {
+  std::string escaped{};
+  escaped.reserve(field.size());
+  for (const char c : field) {
+    switch (c) {
+    case '\\':
+      escaped += "\\\\";
+      break;
+    case '\t':
+      escaped += "\\t";
+      break;
+    case '\n':
+      escaped += "\\n";
+      break;
+    case '\r':
+      escaped += "\\r";
+      break;
+    default:
+      escaped += c;
+    }
+  }
+  return escaped;
+};
+
+int syncFile(std::FILE *file) {
+#if defined(_WIN32)
+  return _commit(_fileno(file));
+#else
+  return fsync(fileno(file));
+#endif
+};
+} // namespace
+
+OFCondition syncPath(const std::string &path, bool directory) {
+#if defined(_WIN32)
+  if (directory)
+    return EC_Normal;
+  const int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+  if (fd < 0)
+    return {0, 0, OF_error, "unable to open file for syncing"};
+  const bool ok = _commit(fd) == 0;
+  _close(fd);
+#else
+  const int flags = O_RDONLY | O_CLOEXEC | (directory ? O_DIRECTORY : 0);
+  const int fd = ::open(path.c_str(), flags);
+  if (fd < 0)
+    return {0, 0, OF_error, "unable to open file for syncing"};
+  const bool ok = fsync(fd) == 0;
+  ::close(fd);
+#endif
+  if (!ok)
+    return {0, 0, OF_error, "unable to sync file"};
+  return EC_Normal;
+};
+
+std::string joinRecord(const std::vector<std::string> &fields) {
+  std::string record{};
+  for (std::size_t i = 0; i < fields.size(); ++i) {
+    if (i > 0)
+      record += '\t';
+    record += escape(fields[i]);
+  }
+  return record;
+};
+
+std::vector<std::string> splitRecord(const std::string &line) {
+  std::vector<std::string> fields(1);
+  for (std::size_t i = 0; i < line.size(); ++i) {
+    if (line[i] == '\t') {
+      fields.emplace_back();
+    } else if (line[i] == '\\' && i + 1 < line.size()) {
+      const char next = line[++i];
+      fields.back() += next == 't' ? '\t'
+                       : next == 'n' ? '\n'
+                       : next == 'r' ? '\r'
+                                     : next;
+    } else {
+      fields.back() += line[i];
+    }
+  }
+  return fields;
+};
+
+Journal::~Journal() { (void)this->close(); };
+
+OFCondition Journal::open(const std::string &path, bool resume) {
+  if (resume && std::filesystem::exists(path)) {
+    const OFCondition cond = this->load(path);
+    if (cond.bad())
+      return cond;
+  }
+
+  m_file = std::fopen(path.c_str(), resume ? "ab" : "wb");
+  if (m_file == nullptr)
+    return {0, 0, OF_error, "unable to open journal"};
+  return EC_Normal;
+};
+
+OFCondition Journal::close() {
+  std::scoped_lock lock{m_mutex};
+  if (m_file == nullptr)
+    return EC_Normal;
+
+  const bool ok = std::fflush(m_file) == 0 && syncFile(m_file) == 0;
+  std::fclose(m_file);
+  m_file = nullptr;
+  if (!ok)
+    return {0, 0, OF_error, "unable to sync journal"};
+  return EC_Normal;
+};
+
+const JournalStudy *Journal::previous(const std::string &study) const {
+  const auto it = m_previous.find(study);
+  return it == m_previous.end() ? nullptr : &it->second;
+};
+
+OFCondition Journal::begin(const std::string &study,
+                           const std::string &pseudoname,
+                           const std::string &new_study_uid) {
+  return this->append({"BEGIN", study, pseudoname, new_study_uid}, true);
+};
+
+OFCondition Journal::file(const std::string &study, const std::string &path) {
+  return this->append({"FILE", study, path}, false);
+};
+
+OFCondition Journal::done(const std::string &study,
+                          const std::string &csv_row) {
+  return this->append({"DONE", study, csv_row}, true);
+};
+
+OFCondition Journal::load(const std::string &path) {
+  std::string content{};
+  {
+    std::ifstream in{path, std::ios::in | std::ios::binary};
+    if (!in.is_open())
+      return {0, 0, OF_error, "unable to read journal"};
+    std::ostringstream buffer{};
+    buffer << in.rdbuf();
+    content = buffer.str();
+  }
+
+  // a crash may leave a torn last record, drop it before appending
+  const std::size_t end = content.rfind('\n');
+  const std::size_t complete = end == std::string::npos ? 0 : end + 1;
+  if (complete != content.size()) {
+    std::error_code error{};
+    std::filesystem::resize_file(path, complete, error);
+    if (error)
+      return {0, 0, OF_error, "unable to truncate torn journal record"};
+    content.resize(complete);
+  }
+
+  std::istringstream lines{content};
+  std::string line{};
+  while (std::getline(lines, line)) {
+    const std::vector<std::string> fields = splitRecord(line);
+    if (fields.size() < 3)
+      continue;
+
+    JournalStudy &study = m_previous[fields[1]];
+    if (fields[0] == "BEGIN" && fields.size() == 4) {
+      study.pseudoname = fields[2];
+      study.new_study_uid = fields[3];
+    } else if (fields[0] == "FILE") {
+      study.files.push_back(fields[2]);
+    } else if (fields[0] == "DONE") {
+      study.csv_row = fields[2];
+    }
+  }
+  return EC_Normal;
+};
+
+OFCondition Journal::append(const std::vector<std::string> &fields,
+                            bool sync) {
+  const std::string record = joinRecord(fields) + '\n';
+
+  std::scoped_lock lock{m_mutex};
+  if (m_file == nullptr)
+    return {0, 0, OF_error, "journal is not open"};
+
+  // one fwrite per record and flush, a crash tears at most the last record
+  if (std::fwrite(record.data(), 1, record.size(), m_file) != record.size() ||
+      std::fflush(m_file) != 0)
+    return {0, 0, OF_error, "unable to write journal record"};
+  if (sync && syncFile(m_file) != 0)
+    return {0, 0, OF_error, "unable to sync journal"};
+  return EC_Normal;
+};
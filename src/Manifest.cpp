@@ -0,0 +1,158 @@
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "Journal.hpp"
+#include "Manifest.hpp"
+
+namespace {
+constexpr std::uint64_t HASH_PRIME{0x9e3779b97f4a7c15ULL};
+
+// 64-bit multiply-xorshift over 8 byte words, fast enough to stay disk bound;
+// detects changed content, not meant to resist tampering
+std::uint64_t mixWord(std::uint64_t hash, std::uint64_t word) {
+  hash ^= word;
+  hash *= HASH_PRIME;
+  return hash ^ (hash >> 29);
+};
+
+OFCondition hashFileContent(const std::string &path, std::string &hash) {
+  std::ifstream in{path, std::ios::in | std::ios::binary};
+  if (!in.is_open())
+    return {0, 0, OF_error, "unable to open file for hashing"};
+
+  std::uint64_t state{HASH_PRIME};
+  std::uint64_t length{0};
+  std::vector<char> buffer(1 << 20);
+  while (in) {
+    in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    const auto count = static_cast<std::size_t>(in.gcount());
+    length += count;
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+      std::uint64_t word{0};
+      std::memcpy(&word, buffer.data() + i, 8);
+      state = mixWord(state, word);
+    }
+    if (i < count) {
+      // zero padded tail, only at the end of the file
+      std::uint64_t word{0};
+      std::memcpy(&word, buffer.data() + i, count - i);
+      state = mixWord(state, word);
+    }
+  }
+  if (in.bad())
+    return {0, 0, OF_error, "error while hashing file"};
+
+  hash = fmt::format("{:016x}", mixWord(state, length));
+  return EC_Normal;
+};
+} // namespace
+
+OFCondition fingerprintFile(const std::string &path, bool content_hash,
+                            FileFingerprint &fingerprint) {
+  std::error_code error{};
+  fingerprint.size = std::filesystem::file_size(path, error);
+  if (error)
+    return {0, 0, OF_error, "unable to read file size"};
+  fingerprint.mtime = static_cast<std::int64_t>(
+      std::filesystem::last_write_time(path, error)
+          .time_since_epoch()
+          .count());
+  if (error)
+    return {0, 0, OF_error, "unable to read file modification time"};
+
+  fingerprint.hash.clear();
+  if (content_hash)
+    return hashFileContent(path, fingerprint.hash);
+  return EC_Normal;
+};
+
+OFCondition Manifest::load(const std::string &path) {
+  std::scoped_lock lock{m_mutex};
+  m_studies.clear();
+
+  std::ifstream in{path, std::ios::in | std::ios::binary};
+  if (!in.is_open())
+    return EC_Normal;
+
+  std::string line{};
+  while (std::getline(in, line)) {
+    const std::vector<std::string> fields = splitRecord(line);
+    try {
+      if (fields[0] == "STUDY" && fields.size() == 6) {
+        ManifestStudy &study = m_studies[fields[1]];
+        study.pseudoname = fields[2];
+        study.new_study_uid = fields[3];
+        study.next_index = static_cast<unsigned int>(std::stoul(fields[4]));
+        study.csv_row = fields[5];
+      } else if (fields[0] == "SERIES" && fields.size() == 4) {
+        m_studies[fields[1]].series_uids[fields[2]] = fields[3];
+      } else if (fields[0] == "FILE" && fields.size() == 8) {
+        ManifestFile &file = m_studies[fields[1]].files[fields[2]];
+        file.fingerprint.size = std::stoull(fields[3]);
+        file.fingerprint.mtime = std::stoll(fields[4]);
+        file.fingerprint.hash = fields[5];
+        file.output_path = fields[6];
+        file.output_index = static_cast<unsigned int>(std::stoul(fields[7]));
+      }
+    } catch (const std::exception &) {
+      return {0, 0, OF_error, "invalid record in manifest"};
+    }
+  }
+  return EC_Normal;
+};
+
+OFCondition Manifest::save(const std::string &path) const {
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out{tmp_path, std::ios::out | std::ios::binary};
+    if (!out.is_open())
+      return {0, 0, OF_error, "unable to write manifest"};
+
+    std::scoped_lock lock{m_mutex};
+    for (const auto &[key, study] : m_studies) {
+      out << joinRecord({"STUDY", key, study.pseudoname, study.new_study_uid,
+                         std::to_string(study.next_index), study.csv_row})
+          << '\n';
+      for (const auto &[old_uid, new_uid] : study.series_uids) {
+        out << joinRecord({"SERIES", key, old_uid, new_uid}) << '\n';
+      }
+      for (const auto &[input, file] : study.files) {
+        out << joinRecord({"FILE", key, input,
+                           std::to_string(file.fingerprint.size),
+                           std::to_string(file.fingerprint.mtime),
+                           file.fingerprint.hash, file.output_path,
+                           std::to_string(file.output_index)})
+            << '\n';
+      }
+    }
+    if (!out.flush())
+      return {0, 0, OF_error, "unable to write manifest"};
+  }
+
+  std::error_code error{};
+  std::filesystem::rename(tmp_path, path, error);
+  if (error)
+    return {0, 0, OF_error, "unable to replace manifest"};
+  return EC_Normal;
+};
+
+bool Manifest::find(const std::string &study, ManifestStudy &entry) const {
+  std::scoped_lock lock{m_mutex};
+  const auto it = m_studies.find(study);
+  if (it == m_studies.end())
+    return false;
+  entry = it->second;
+  return true;
+};
+
+void Manifest::update(const std::string &study, ManifestStudy entry) {
+  std::scoped_lock lock{m_mutex};
+  m_studies[study] = std::move(entry);
+};
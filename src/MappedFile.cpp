@@ -0,0 +1,196 @@
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.hpp"
+
+MappedFile::~MappedFile() { this->close(); };
+
+#if defined(_WIN32)
+
+OFCondition MappedFile::open(const std::string &path,
+                             std::uint64_t min_size) {
+  this->close();
+
+  // no sharing, a second process fails instead of corrupting the file
+  m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                       OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_file == INVALID_HANDLE_VALUE) {
+    m_file = nullptr;
+    return {0, 0, OF_error, "unable to open mapped file, in use or missing"};
+  }
+
+  LARGE_INTEGER size{};
+  GetFileSizeEx(m_file, &size);
+  m_size = static_cast<std::uint64_t>(size.QuadPart);
+  if (m_size < min_size) {
+    size.QuadPart = static_cast<LONGLONG>(min_size);
+    if (!SetFilePointerEx(m_file, size, nullptr, FILE_BEGIN) ||
+        !SetEndOfFile(m_file)) {
+      this->close();
+      return {0, 0, OF_error, "unable to resize mapped file"};
+    }
+    m_size = min_size;
+  }
+
+  m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, 0, 0,
+                                 nullptr);
+  if (m_mapping == nullptr) {
+    this->close();
+    return {0, 0, OF_error, "unable to map file"};
+  }
+  m_data = static_cast<std::uint8_t *>(
+      MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+  if (m_data == nullptr) {
+    this->close();
+    return {0, 0, OF_error, "unable to map file"};
+  }
+  return EC_Normal;
+};
+
+OFCondition MappedFile::openReadOnly(const std::string &path) {
+  this->close();
+
+  m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_file == INVALID_HANDLE_VALUE) {
+    m_file = nullptr;
+    return {0, 0, OF_error, "unable to open mapped file"};
+  }
+
+  LARGE_INTEGER size{};
+  GetFileSizeEx(m_file, &size);
+  m_size = static_cast<std::uint64_t>(size.QuadPart);
+  if (m_size == 0) {
+    this->close();
+    return {0, 0, OF_error, "unable to map empty file"};
+  }
+
+  m_mapping =
+      CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_mapping == nullptr) {
+    this->close();
+    return {0, 0, OF_error, "unable to map file"};
+  }
+  m_data = static_cast<std::uint8_t *>(
+      MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+  if (m_data == nullptr) {
+    this->close();
+    return {0, 0, OF_error, "unable to map file"};
+  }
+  return EC_Normal;
+};
+
+OFCondition MappedFile::flush() {
+  if (m_data == nullptr)
+    return EC_Normal;
+  if (!FlushViewOfFile(m_data, 0) || !FlushFileBuffers(m_file))
+    return {0, 0, OF_error, "unable to flush mapped file"};
+  return EC_Normal;
+};
+
+void MappedFile::close() {
+  if (m_data != nullptr)
+    UnmapViewOfFile(m_data);
+  if (m_mapping != nullptr)
+    CloseHandle(m_mapping);
+  if (m_file != nullptr)
+    CloseHandle(m_file);
+  m_data = nullptr;
+  m_mapping = nullptr;
+  m_file = nullptr;
+  m_size = 0;
+};
+
+#else
+
+OFCondition MappedFile::open(const std::string &path,
+                             std::uint64_t min_size) {
+  this->close();
+
+  m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (m_fd < 0)
+    return {0, 0, OF_error, "unable to open mapped file"};
+
+  // advisory lock, a second process fails instead of corrupting the file
+  if (flock(m_fd, LOCK_EX | LOCK_NB) != 0) {
+    this->close();
+    return {0, 0, OF_error, "mapped file is in use by another process"};
+  }
+
+  struct stat info{};
+  if (fstat(m_fd, &info) != 0) {
+    this->close();
+    return {0, 0, OF_error, "unable to stat mapped file"};
+  }
+  m_size = static_cast<std::uint64_t>(info.st_size);
+  if (m_size < min_size) {
+    if (ftruncate(m_fd, static_cast<off_t>(min_size)) != 0) {
+      this->close();
+      return {0, 0, OF_error, "unable to resize mapped file"};
+    }
+    m_size = min_size;
+  }
+
+  void *data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    m_fd, 0);
+  if (data == MAP_FAILED) {
+    this->close();
+    return {0, 0, OF_error, "unable to map file"};
+  }
+  m_data = static_cast<std::uint8_t *>(data);
+  return EC_Normal;
+};
+
+OFCondition MappedFile::openReadOnly(const std::string &path) {
+  this->close();
+
+  m_fd = ::open(path.c_str(), O_RDONLY);
+  if (m_fd < 0)
+    return {0, 0, OF_error, "unable to open mapped file"};
+
+  struct stat info{};
+  if (fstat(m_fd, &info) != 0) {
+    this->close();
+    return {0, 0, OF_error, "unable to stat mapped file"};
+  }
+  m_size = static_cast<std::uint64_t>(info.st_size);
+  if (m_size == 0) {
+    this->close();
+    return {0, 0, OF_error, "unable to map empty file"};
+  }
+
+  void *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+  if (data == MAP_FAILED) {
+    this->close();
+    return {0, 0, OF_error, "unable to map file"};
+  }
+  m_data = static_cast<std::uint8_t *>(data);
+  return EC_Normal;
+};
+
+OFCondition MappedFile::flush() {
+  if (m_data == nullptr)
+    return EC_Normal;
+  if (msync(m_data, m_size, MS_SYNC) != 0)
+    return {0, 0, OF_error, "unable to flush mapped file"};
+  return EC_Normal;
+};
+
+void MappedFile::close() {
+  if (m_data != nullptr)
+    munmap(m_data, m_size);
+  if (m_fd >= 0)
+    ::close(m_fd);
+  m_data = nullptr;
+  m_fd = -1;
+  m_size = 0;
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+
+#include "dcmtk/oflog/oflog.h"
+
+#include "DicomAnonymizer.hpp"
+#include "MappingStore.hpp"
+
+namespace {
+constexpr char MAGIC[8] = {'F', 'N', 'O', 'M', 'A', 'P', '0', '1'};
+constexpr std::uint32_t VERSION{1};
+constexpr std::uint64_t INITIAL_CAPACITY{1 << 14};
+
+// FNV-1a over kind and key, 0 marks an empty slot
+std::uint64_t hashKey(E_MAPPING_KIND kind, std::string_view key) {
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = (hash ^ kind) * 0x100000001b3ULL;
+  for (const char c : key) {
+    hash = (hash ^ static_cast<std::uint8_t>(c)) * 0x100000001b3ULL;
+  }
+  return hash == 0 ? 1 : hash;
+};
+} // namespace
+
+struct MappingStore::Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t slot_size;
+  std::uint64_t capacity; // power of two
+  std::uint64_t count;
+  std::uint8_t reserved[32];
+};
+
+struct MappingStore::Slot {
+  std::uint64_t hash; // 0 = empty
+  std::uint8_t kind;
+  std::uint8_t key_length;
+  std::uint8_t value_length;
+  std::uint8_t reserved[5];
+  char key[MAX_LENGTH];
+  char value[MAX_LENGTH];
+};
+
+MappingStore::~MappingStore() { this->close(); };
+
+OFCondition MappingStore::open(const std::string &path) {
+  static_assert(sizeof(Header) == 64 && sizeof(Slot) % 8 == 0);
+  std::unique_lock lock{m_mutex};
+  m_path = path;
+
+  const bool created = !std::filesystem::exists(path);
+  OFCondition cond = m_file.open(
+      path, created ? sizeof(Header) + INITIAL_CAPACITY * sizeof(Slot) : 0);
+  if (cond.bad())
+    return cond;
+
+  Header *head = this->header();
+  if (created) {
+    std::memcpy(head->magic, MAGIC, sizeof(MAGIC));
+    head->version = VERSION;
+    head->slot_size = sizeof(Slot);
+    head->capacity = INITIAL_CAPACITY;
+    head->count = 0;
+    return m_file.flush();
+  }
+
+  if (m_file.size() < sizeof(Header) ||
+      std::memcmp(head->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      head->version != VERSION || head->slot_size != sizeof(Slot) ||
+      m_file.size() != sizeof(Header) + head->capacity * sizeof(Slot)) {
+    m_file.close();
+    return {0, 0, OF_error, "invalid or incompatible mapping store file"};
+  }
+  return EC_Normal;
+};
+
+OFCondition MappingStore::close() {
+  std::unique_lock lock{m_mutex};
+  if (!m_file.isOpen())
+    return EC_Normal;
+
+  const OFCondition cond = m_file.flush();
+  m_file.close();
+  return cond;
+};
+
+std::optional<std::string> MappingStore::find(E_MAPPING_KIND kind,
+                                              std::string_view key) const {
+  if (key.size() > MAX_LENGTH)
+    return std::nullopt;
+
+  std::shared_lock lock{m_mutex};
+  if (!m_file.isOpen())
+    return std::nullopt;
+
+  const Slot *slot = this->probe(hashKey(kind, key), kind, key);
+  if (slot->hash == 0)
+    return std::nullopt;
+  return std::string(slot->value, slot->value_length);
+};
+
+std::string
+MappingStore::getOrInsert(E_MAPPING_KIND kind, std::string_view key,
+                          const std::function<std::string()> &make) {
+  if (key.size() > MAX_LENGTH)
+    return make();
+
+  if (auto value = this->find(kind, key))
+    return *value;
+
+  std::unique_lock lock{m_mutex};
+  if (!m_file.isOpen())
+    return make();
+
+  // another worker may have inserted it between the two locks
+  const std::uint64_t hash = hashKey(kind, key);
+  Slot *slot = this->probe(hash, kind, key);
+  if (slot->hash != 0)
+    return std::string(slot->value, slot->value_length);
+
+  std::string value = make();
+  if (value.size() > MAX_LENGTH)
+    return value;
+
+  // keep load factor under 3/4 so probe sequences stay short
+  if ((this->header()->count + 1) * 4 > this->header()->capacity * 3) {
+    const OFCondition cond = this->grow();
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "mapping store: " << cond.text());
+      return value;
+    }
+    slot = this->probe(hash, kind, key);
+  }
+
+  std::memcpy(slot->key, key.data(), key.size());
+  std::memcpy(slot->value, value.data(), value.size());
+  slot->kind = kind;
+  slot->key_length = static_cast<std::uint8_t>(key.size());
+  slot->value_length = static_cast<std::uint8_t>(value.size());
+  slot->hash = hash;
+  ++this->header()->count;
+  return value;
+};
+
+std::uint64_t MappingStore::size() const {
+  std::shared_lock lock{m_mutex};
+  return m_file.isOpen() ? this->header()->count : 0;
+};
+
+MappingStore::Header *MappingStore::header() const {
+  return reinterpret_cast<Header *>(m_file.data());
+};
+
+MappingStore::Slot *MappingStore::slots() const {
+  return reinterpret_cast<Slot *>(m_file.data() + sizeof(Header));
+};
+
+MappingStore::Slot *MappingStore::probe(std::uint64_t hash,
+                                        E_MAPPING_KIND kind,
+                                        std::string_view key) const {
+  const std::uint64_t mask = this->header()->capacity - 1;
+  Slot *table = this->slots();
+
+  // linear probing, the load factor limit guarantees an empty slot
+  for (std::uint64_t i = hash & mask;; i = (i + 1) & mask) {
+    Slot &slot = table[i];
+    if (slot.hash == 0)
+      return &slot;
+    if (slot.hash == hash && slot.kind == kind &&
+        std::string_view(slot.key, slot.key_length) == key)
+      return &slot;
+  }
+};
+
+OFCondition MappingStore::grow() {
+  const Header *old_head = this->header();
+  const Slot *old_slots = this->slots();
+  const std::uint64_t capacity = old_head->capacity * 2;
+
+  // the old file stays valid until the new one replaces it, so a crash while
+  // growing loses nothing
+  const std::string tmp_path = m_path + ".tmp";
+  std::filesystem::remove(tmp_path);
+  MappedFile grown{};
+  OFCondition cond =
+      grown.open(tmp_path, sizeof(Header) + capacity * sizeof(Slot));
+  if (cond.bad())
+    return cond;
+
+  auto *head = reinterpret_cast<Header *>(grown.data());
+  auto *table = reinterpret_cast<Slot *>(grown.data() + sizeof(Header));
+  std::memcpy(head, old_head, sizeof(Header));
+  head->capacity = capacity;
+
+  const std::uint64_t mask = capacity - 1;
+  for (std::uint64_t i = 0; i < old_head->capacity; ++i) {
+    const Slot &slot = old_slots[i];
+    if (slot.hash == 0)
+      continue;
+    std::uint64_t j = slot.hash & mask;
+    while (table[j].hash != 0) {
+      j = (j + 1) & mask;
+    }
+    table[j] = slot;
+  }
+
+  cond = grown.flush();
+  if (cond.bad())
+    return cond;
+  grown.close();
+  m_file.close();
+
+  std::error_code error{};
+  std::filesystem::rename(tmp_path, m_path, error);
+  cond = m_file.open(m_path, 0);
+  if (error) {
+    // old table is back in place, but it is full
+    return {0, 0, OF_error, "unable to replace mapping store file"};
+  }
+  return cond;
+};
@@ -0,0 +1,71 @@
+#include "MemoryBudget.hpp"
+
+MemoryBudget::Reservation::Reservation(Reservation &&other) noexcept
+    : m_budget{other.m_budget}, m_bytes{other.m_bytes},
+      m_dedicated{other.m_dedicated} {
+  other.m_budget = nullptr;
+};
+
+MemoryBudget::Reservation &
+MemoryBudget::Reservation::operator=(Reservation &&other) noexcept {
+  if (this != &other) {
+    if (m_budget != nullptr)
+      m_budget->release(m_bytes, m_dedicated);
+
+    m_budget = other.m_budget;
+    m_bytes = other.m_bytes;
+    m_dedicated = other.m_dedicated;
+    other.m_budget = nullptr;
+  }
+  return *this;
+};
+
+MemoryBudget::Reservation::~Reservation() {
+  if (m_budget != nullptr)
+    m_budget->release(m_bytes, m_dedicated);
+};
+
+MemoryBudget::Reservation MemoryBudget::acquire(std::uint64_t bytes) {
+  std::unique_lock lock{m_mutex};
+
+  if (bytes > m_budget) {
+    m_cv.wait(lock, [this]() { return !m_dedicated_in_use; });
+    m_dedicated_in_use = true;
+    return {this, bytes, true};
+  }
+
+  m_cv.wait(lock, [&]() { return m_in_use + bytes <= m_budget; });
+  m_in_use += bytes;
+  return {this, bytes, false};
+};
+
+bool MemoryBudget::tryAcquire(std::uint64_t bytes, Reservation &reservation) {
+  const bool dedicated = bytes > m_budget;
+  {
+    std::scoped_lock lock{m_mutex};
+    if (dedicated) {
+      if (m_dedicated_in_use)
+        return false;
+      m_dedicated_in_use = true;
+    } else {
+      if (m_in_use + bytes > m_budget)
+        return false;
+      m_in_use += bytes;
+    }
+  }
+  // assigned unlocked, replacing a held reservation releases it
+  reservation = {this, bytes, dedicated};
+  return true;
+};
+
+void MemoryBudget::release(std::uint64_t bytes, bool dedicated) {
+  {
+    std::scoped_lock lock{m_mutex};
+    if (dedicated) {
+      m_dedicated_in_use = false;
+    } else {
+      m_in_use -= bytes;
+    }
+  }
+  m_cv.notify_all();
+};
@@ -0,0 +1,485 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
+
+#include <zlib.h>
+
+#include "dcmtk/dcmdata/dctag.h"
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+#include "dcmtk/oflog/oflog.h"
+
+#include "fmt/format.h"
+
+#include "DicomAnonymizer.hpp"
+#include "DicomSniffer.hpp"
+#include "DirectoryWalker.hpp"
+#include "MappedFile.hpp"
+#include "OutputVerifier.hpp"
+
+namespace {
+constexpr std::uint32_t UNDEFINED_LENGTH{0xFFFFFFFF};
+// deeper nesting is treated as a broken file
+constexpr int MAX_DEPTH{64};
+
+std::vector<std::string> splitFields(const std::string &line,
+                                     std::string_view delimiters) {
+  std::vector<std::string> fields{};
+  std::size_t start{0};
+  while (true) {
+    const std::size_t end = line.find_first_of(delimiters, start);
+    fields.push_back(line.substr(start, end - start));
+    if (end == std::string::npos)
+      return fields;
+    start = end + 1;
+  }
+};
+
+std::string trim(const std::string &value) {
+  const std::size_t first = value.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos)
+    return {};
+  const std::size_t last = value.find_last_not_of(" \t\r\n");
+  return value.substr(first, last - first + 1);
+};
+
+std::string csvField(const std::string &value) {
+  if (value.find_first_of(",\"\n") == std::string::npos)
+    return value;
+  std::string quoted{"\""};
+  for (const char c : value) {
+    quoted += c == '"' ? "\"\"" : std::string(1, c);
+  }
+  return quoted + "\"";
+};
+
+bool isLongVR(const std::uint8_t *vr) {
+  static constexpr std::array<const char *, 12> LONG_VRS{
+      "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT"};
+  return std::any_of(LONG_VRS.begin(), LONG_VRS.end(), [&](const char *v) {
+    return vr[0] == v[0] && vr[1] == v[1];
+  });
+};
+
+// where the dataset of a file starts and how it is encoded
+struct DatasetLayout {
+  std::size_t meta_start{0};
+  std::size_t start{0};
+  bool explicit_vr{false};
+  bool big_endian{false};
+  bool deflated{false};
+};
+
+DatasetLayout parseLayout(const std::uint8_t *data, std::size_t size) {
+  DatasetLayout layout{};
+  if (size < 132 || std::memcmp(data + 128, "DICM", 4) != 0) {
+    // no meta header, VR characters after the first tag mean explicit VR
+    layout.explicit_vr = size >= 6 && std::isupper(data[4]) != 0 &&
+                         std::isupper(data[5]) != 0;
+    return layout;
+  }
+
+  // meta header elements are always explicit VR little endian
+  std::string xfer{};
+  std::size_t pos{132};
+  layout.meta_start = pos;
+  while (pos + 8 <= size && (data[pos] | data[pos + 1] << 8) == 0x0002) {
+    const unsigned element = data[pos + 2] | data[pos + 3] << 8;
+    std::size_t length{0};
+    if (isLongVR(data + pos + 4)) {
+      if (pos + 12 > size)
+        break;
+      length = static_cast<std::size_t>(data[pos + 8]) |
+               static_cast<std::size_t>(data[pos + 9]) << 8 |
+               static_cast<std::size_t>(data[pos + 10]) << 16 |
+               static_cast<std::size_t>(data[pos + 11]) << 24;
+      pos += 12;
+    } else {
+      length = data[pos + 6] | data[pos + 7] << 8;
+      pos += 8;
+    }
+    length = std::min(length, size - pos);
+    if (element == 0x0010) {
+      xfer.assign(reinterpret_cast<const char *>(data + pos), length);
+      xfer.erase(xfer.find_last_not_of(std::string("\0 ", 2)) + 1);
+    }
+    pos += length;
+  }
+  layout.start = pos;
+
+  const DcmXfer info{xfer.empty() ? UID_LittleEndianImplicitTransferSyntax
+                                  : xfer.c_str()};
+  layout.explicit_vr = info.isExplicitVR();
+  layout.big_endian = info.isBigEndian();
+  layout.deflated = info.getStreamCompression() == ESC_zlib;
+  return layout;
+};
+
+// raw deflate stream of a deflated transfer syntax dataset
+bool inflateDataset(const std::uint8_t *data, std::size_t size,
+                    std::vector<std::uint8_t> &inflated) {
+  z_stream stream{};
+  if (inflateInit2(&stream, -15) != Z_OK)
+    return false;
+  stream.next_in = const_cast<Bytef *>(data);
+  stream.avail_in =
+      static_cast<uInt>(std::min<std::size_t>(size, UINT32_MAX));
+
+  int result{Z_OK};
+  while (result == Z_OK) {
+    const std::size_t used = inflated.size();
+    inflated.resize(std::max<std::size_t>(used * 2, 64 * 1024));
+    stream.next_out = inflated.data() + used;
+    stream.avail_out = static_cast<uInt>(inflated.size() - used);
+    result = inflate(&stream, Z_NO_FLUSH);
+    inflated.resize(inflated.size() - stream.avail_out);
+  }
+  inflateEnd(&stream);
+  return result == Z_STREAM_END;
+};
+
+// path of the innermost element or item whose encoding covers `target`,
+// walking the elements without interpreting their values
+class TagLocator {
+public:
+  TagLocator(const std::uint8_t *data, bool big_endian, std::size_t target)
+      : m_data{data}, m_big_endian{big_endian}, m_target{target} {};
+
+  std::string locate(std::size_t start, std::size_t end, bool explicit_vr) {
+    this->dataset(start, end, explicit_vr, 0);
+    return m_found ? m_path : std::string{};
+  };
+
+private:
+  std::uint32_t read(std::size_t pos, int bytes) const {
+    std::uint32_t value{0};
+    for (int i = 0; i < bytes; ++i) {
+      const int shift = 8 * (m_big_endian ? bytes - 1 - i : i);
+      value |= static_cast<std::uint32_t>(m_data[pos + i]) << shift;
+    }
+    return value;
+  };
+
+  // elements up to `end` or an item delimitation, returns the position
+  // after them
+  std::size_t dataset(std::size_t pos, std::size_t end, bool explicit_vr,
+                      int depth) {
+    if (depth > MAX_DEPTH)
+      return end;
+    while (pos + 8 <= end) {
+      const std::size_t start = pos;
+      const std::uint32_t group = this->read(pos, 2);
+      const std::uint32_t element = this->read(pos + 2, 2);
+      if (group == 0xFFFE)
+        return pos + 8;
+
+      std::uint32_t length{0};
+      bool sequence{false};
+      bool child_explicit{explicit_vr};
+      if (explicit_vr) {
+        const std::uint8_t *vr = m_data + pos + 4;
+        if (isLongVR(vr)) {
+          if (pos + 12 > end)
+            return end;
+          length = this->read(pos + 8, 4);
+          pos += 12;
+        } else {
+          length = this->read(pos + 6, 2);
+          pos += 8;
+        }
+        sequence = vr[0] == 'S' && vr[1] == 'Q';
+        // UN of undefined length holds an implicit VR sequence
+        if (vr[0] == 'U' && vr[1] == 'N' && length == UNDEFINED_LENGTH) {
+          sequence = true;
+          child_explicit = false;
+        }
+      } else {
+        length = this->read(pos + 4, 4);
+        pos += 8;
+        sequence = DcmTag(DcmTagKey(static_cast<Uint16>(group),
+                                    static_cast<Uint16>(element)))
+                       .getEVR() == EVR_SQ;
+      }
+
+      const std::size_t mark = m_path.size();
+      m_path += fmt::format("({:04X},{:04X})", group, element);
+      std::size_t value_end{end};
+      if (length == UNDEFINED_LENGTH) {
+        const bool fragments = group == 0x7FE0 && element == 0x0010;
+        value_end = this->items(pos, end, child_explicit, fragments, depth);
+      } else {
+        value_end = std::min<std::size_t>(pos + length, end);
+        if (sequence && m_target >= pos && m_target < value_end)
+          this->items(pos, value_end, child_explicit, false, depth);
+      }
+
+      if (m_found)
+        return value_end;
+      if (m_target >= start && m_target < value_end) {
+        m_found = true;
+        return value_end;
+      }
+      m_path.resize(mark);
+      pos = value_end;
+    }
+    return end;
+  };
+
+  // items of a sequence or fragments of encapsulated pixel data up to `end`
+  // or a sequence delimitation, returns the position after them
+  std::size_t items(std::size_t pos, std::size_t end, bool explicit_vr,
+                    bool fragments, int depth) {
+    for (std::size_t index = 0; pos + 8 <= end; ++index) {
+      const std::size_t start = pos;
+      const std::uint32_t group = this->read(pos, 2);
+      const std::uint32_t element = this->read(pos + 2, 2);
+      const std::uint32_t length = this->read(pos + 4, 4);
+      pos += 8;
+      if (group != 0xFFFE)
+        return end;
+      if (element == 0xE0DD)
+        return pos;
+
+      const std::size_t mark = m_path.size();
+      m_path += fmt::format("[{}]", index);
+      std::size_t item_end{end};
+      if (length != UNDEFINED_LENGTH) {
+        item_end = std::min<std::size_t>(pos + length, end);
+        if (!fragments && m_target >= pos && m_target < item_end) {
+          m_path += '/';
+          this->dataset(pos, item_end, explicit_vr, depth + 1);
+        }
+      } else if (!fragments) {
+        m_path += '/';
+        item_end = this->dataset(pos, end, explicit_vr, depth + 1);
+      }
+
+      if (m_found)
+        return item_end;
+      if (m_target >= start && m_target < item_end) {
+        // item header or delimiter
+        m_path.resize(mark);
+        m_path += fmt::format("[{}]", index);
+        m_found = true;
+        return item_end;
+      }
+      m_path.resize(mark);
+      pos = item_end;
+    }
+    return end;
+  };
+
+  const std::uint8_t *m_data;
+  const bool m_big_endian;
+  const std::size_t m_target;
+  bool m_found{false};
+  std::string m_path{};
+};
+} // namespace
+
+OFCondition readIdentifiers(const std::string &filename,
+                            std::vector<Identifier> &identifiers) {
+  std::ifstream file{filename, std::ios::in};
+  std::string line{};
+  if (!file.is_open() || !std::getline(file, line))
+    return {0, 0, OF_error, "unable to read anonym_output.csv"};
+
+  const std::vector<std::string> header = splitFields(trim(line), ",");
+  const auto column = [&](std::string_view name) {
+    return static_cast<std::size_t>(
+        std::find(header.begin(), header.end(), name) - header.begin());
+  };
+  const std::size_t idColumn = column("PatientID");
+  const std::size_t nameColumn = column("PatientName");
+  const std::size_t pseudonameColumn = column("Pseudoname");
+  const std::size_t uidColumn = column("OldStudyInstanceUID");
+  const std::size_t columns =
+      std::max({idColumn, nameColumn, pseudonameColumn, uidColumn}) + 1;
+  if (columns > header.size())
+    return {0, 0, OF_error, "missing columns of anonym_output.csv"};
+
+  while (std::getline(file, line)) {
+    const std::vector<std::string> fields = splitFields(trim(line), ",");
+    if (fields.size() < columns)
+      continue;
+
+    const std::string &pseudoname = fields[pseudonameColumn];
+    const auto add = [&](const std::string &value, const char *kind) {
+      identifiers.push_back({trim(value), kind, pseudoname});
+    };
+    add(fields[idColumn], "PatientID");
+    add(fields[nameColumn], "PatientName");
+    // family, given, middle names, ... and the ideographic and phonetic
+    // groups on their own, other tags or free text may order them differently
+    for (const std::string &part : splitFields(fields[nameColumn], "^=")) {
+      if (part != fields[nameColumn])
+        add(part, "PatientName");
+    }
+    add(fields[uidColumn], "StudyInstanceUID");
+  }
+  return EC_Normal;
+};
+
+OFCondition readIdentifierFile(const std::string &filename,
+                               std::vector<Identifier> &identifiers) {
+  std::ifstream file{filename, std::ios::in};
+  if (!file.is_open())
+    return {0, 0, OF_error, "unable to read identifier file"};
+
+  std::string line{};
+  while (std::getline(file, line)) {
+    identifiers.push_back({trim(line), "custom", {}});
+  }
+  return EC_Normal;
+};
+
+OutputVerifier::OutputVerifier(std::vector<Identifier> identifiers,
+                               std::size_t min_length) {
+  // case folded values, every value is searched once
+  std::unordered_set<std::string> seen{};
+  std::size_t skipped{0};
+  for (Identifier &identifier : identifiers) {
+    if (identifier.value.empty())
+      continue;
+    if (identifier.value.size() < min_length) {
+      ++skipped;
+      continue;
+    }
+    std::string folded = identifier.value;
+    std::transform(folded.begin(), folded.end(), folded.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (seen.insert(std::move(folded)).second)
+      m_identifiers.push_back(std::move(identifier));
+  }
+  if (skipped > 0) {
+    OFLOG_WARN(mainLogger, skipped << " identifiers shorter than "
+                                   << min_length
+                                   << " characters are not searched");
+  }
+
+  std::vector<std::string> patterns{};
+  patterns.reserve(m_identifiers.size());
+  for (const Identifier &identifier : m_identifiers) {
+    patterns.push_back(identifier.value);
+  }
+  m_matcher = std::make_unique<PatternMatcher>(patterns);
+};
+
+OFCondition OutputVerifier::verify(const std::filesystem::path &directory,
+                                   ThreadPool &pool) {
+  std::mutex mutex{};
+  std::vector<std::string> files{};
+  DirectoryWalker walker{pool, false};
+  const OFCondition cond =
+      walker.walk(directory, [&](DicomInputFile &&file) {
+        std::scoped_lock lock{mutex};
+        files.push_back(std::move(file.path));
+      });
+  if (cond.bad())
+    return cond;
+
+  TaskGroup tasks{pool};
+  for (const std::string &path : files) {
+    tasks.run([this, &path]() { this->verifyFile(path); });
+  }
+  tasks.wait();
+
+  std::sort(m_hits.begin(), m_hits.end(),
+            [](const IdentifierHit &a, const IdentifierHit &b) {
+              return a.path != b.path ? a.path < b.path : a.offset < b.offset;
+            });
+  return EC_Normal;
+};
+
+void OutputVerifier::verifyFile(const std::string &path) {
+  // empty files have nothing to map
+  std::error_code error{};
+  if (std::filesystem::file_size(path, error) == 0 && !error)
+    return;
+
+  MappedFile file{};
+  if (file.openReadOnly(path).bad()) {
+    OFLOG_WARN(mainLogger, "unable to read `" << path << "`, not verified");
+    return;
+  }
+  const std::uint8_t *data = file.data();
+  const std::size_t size = static_cast<std::size_t>(file.size());
+
+  // anonym_output.csv, tags.csv, journal and the like hold the identifiers
+  // on purpose
+  std::string reason{};
+  if (!sniffDicomBuffer(reinterpret_cast<const char *>(data),
+                        std::min<std::size_t>(size, 132), reason))
+    return;
+  ++m_files;
+  m_bytes += size;
+
+  std::vector<std::pair<std::size_t, std::size_t>> matches{};
+  const auto collect = [&](std::size_t identifier, std::size_t end) {
+    matches.emplace_back(identifier,
+                         end - m_identifiers[identifier].value.size());
+  };
+  m_matcher->scan(data, size, collect);
+
+  const DatasetLayout layout = parseLayout(data, size);
+  std::vector<IdentifierHit> hits{};
+  for (const auto &[identifier, offset] : matches) {
+    IdentifierHit hit{path, {}, offset, identifier};
+    if (offset < layout.meta_start) {
+      hit.tag_path = "preamble";
+    } else if (offset < layout.start) {
+      hit.tag_path = TagLocator(data, false, offset)
+                         .locate(layout.meta_start, layout.start, true);
+    } else if (!layout.deflated) {
+      hit.tag_path = TagLocator(data, layout.big_endian, offset)
+                         .locate(layout.start, size, layout.explicit_vr);
+    }
+    hits.push_back(std::move(hit));
+  }
+
+  // compressed bytes hide the identifiers, so deflated datasets are searched
+  // once more after inflating them
+  if (layout.deflated) {
+    std::vector<std::uint8_t> inflated{};
+    if (!inflateDataset(data + layout.start, size - layout.start, inflated)) {
+      OFLOG_WARN(mainLogger, "unable to inflate dataset of `"
+                                 << path << "`, only raw bytes verified");
+    }
+    matches.clear();
+    m_matcher->scan(inflated.data(), inflated.size(), collect);
+    for (const auto &[identifier, offset] : matches) {
+      const std::string tagPath =
+          TagLocator(inflated.data(), false, offset)
+              .locate(0, inflated.size(), true);
+      hits.push_back({path, tagPath, offset, identifier});
+    }
+  }
+
+  if (!hits.empty()) {
+    std::scoped_lock lock{m_mutex};
+    m_hits.insert(m_hits.end(), std::make_move_iterator(hits.begin()),
+                  std::make_move_iterator(hits.end()));
+  }
+};
+
+OFCondition OutputVerifier::writeReport(const std::string &filename) const {
+  std::ofstream report{filename, std::ios::out};
+  if (!report.is_open())
+    return {0, 0, OF_error, "unable to create verify report"};
+
+  report << "File,TagPath,Offset,Kind,Pseudoname,Identifier\n";
+  for (const IdentifierHit &hit : m_hits) {
+    const Identifier &identifier = m_identifiers[hit.identifier];
+    report << fmt::format("{},{},{},{},{},{}\n", csvField(hit.path),
+                          csvField(hit.tag_path), hit.offset, identifier.kind,
+                          csvField(identifier.pseudoname),
+                          csvField(identifier.value));
+  }
+  report.close();
+  if (!report)
+    return {0, 0, OF_error, "unable to write verify report"};
+  return EC_Normal;
+};
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <bit>
+#include <deque>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FNODCMANON_SSE2 1
+#endif
+
+#include "PatternMatcher.hpp"
+
+namespace {
+constexpr std::size_t MAX_START_RANGES{4};
+
+std::uint8_t foldCase(std::uint8_t c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<std::uint8_t>(c + 32) : c;
+};
+} // namespace
+
+PatternMatcher::PatternMatcher(const std::vector<std::string> &patterns) {
+  // bytes that occur in no pattern share class 0, upper case letters share
+  // the class of their lower case
+  for (const std::string &pattern : patterns) {
+    for (const char c : pattern) {
+      const std::uint8_t folded = foldCase(static_cast<std::uint8_t>(c));
+      if (m_class[folded] == 0)
+        m_class[folded] = static_cast<std::uint8_t>(m_class_count++);
+    }
+  }
+  for (std::uint8_t c = 'A'; c <= 'Z'; ++c) {
+    m_class[c] = m_class[foldCase(c)];
+  }
+  const std::size_t classes = m_class_count;
+
+  // trie, a zero transition means no edge as no edge leads back to the root
+  m_next.assign(classes, 0);
+  m_outputs.emplace_back();
+  for (std::size_t i = 0; i < patterns.size(); ++i) {
+    if (patterns[i].empty())
+      continue;
+    std::uint32_t state{0};
+    for (const char c : patterns[i]) {
+      const std::size_t edge =
+          state * classes + m_class[static_cast<std::uint8_t>(c)];
+      if (m_next[edge] == 0) {
+        m_next[edge] = static_cast<std::uint32_t>(m_outputs.size());
+        m_next.resize(m_next.size() + classes, 0);
+        m_outputs.emplace_back();
+      }
+      state = m_next[edge];
+    }
+    m_outputs[state].push_back(static_cast<std::uint32_t>(i));
+  }
+
+  // breadth first, so the row of a failure state is complete before states
+  // below it copy missing transitions from it
+  std::vector<std::uint32_t> fail(m_outputs.size(), 0);
+  std::deque<std::uint32_t> queue{};
+  for (std::size_t c = 0; c < classes; ++c) {
+    if (m_next[c] != 0)
+      queue.push_back(m_next[c]);
+  }
+  while (!queue.empty()) {
+    const std::uint32_t state = queue.front();
+    queue.pop_front();
+    for (std::size_t c = 0; c < classes; ++c) {
+      const std::size_t edge = state * classes + c;
+      const std::uint32_t fallback = m_next[fail[state] * classes + c];
+      if (m_next[edge] == 0) {
+        m_next[edge] = fallback;
+        continue;
+      }
+      const std::uint32_t child = m_next[edge];
+      fail[child] = fallback;
+      m_outputs[child].insert(m_outputs[child].end(),
+                              m_outputs[fallback].begin(),
+                              m_outputs[fallback].end());
+      queue.push_back(child);
+    }
+  }
+
+  // consecutive start bytes as ranges, closest ranges merged until few
+  // enough remain; the superset is narrowed down by m_start afterwards
+  std::vector<std::pair<int, int>> ranges{};
+  for (int c = 0; c < 256; ++c) {
+    m_start[c] = m_next[m_class[c]] != 0;
+    if (!m_start[c])
+      continue;
+    if (!ranges.empty() && ranges.back().second == c - 1) {
+      ranges.back().second = c;
+    } else {
+      ranges.emplace_back(c, c);
+    }
+  }
+  while (ranges.size() > MAX_START_RANGES) {
+    std::size_t closest{0};
+    for (std::size_t i = 1; i + 1 < ranges.size(); ++i) {
+      if (ranges[i + 1].first - ranges[i].second <
+          ranges[closest + 1].first - ranges[closest].second)
+        closest = i;
+    }
+    ranges[closest].second = ranges[closest + 1].second;
+    ranges.erase(ranges.begin() + static_cast<std::ptrdiff_t>(closest) + 1);
+  }
+  for (const auto &[low, high] : ranges) {
+    m_start_ranges.emplace_back(static_cast<std::uint8_t>(low),
+                                static_cast<std::uint8_t>(high - low));
+  }
+};
+
+void PatternMatcher::scan(const std::uint8_t *data, std::size_t size,
+                          const MatchCallback &on_match) const {
+  std::uint32_t state{0};
+  for (std::size_t pos = 0; pos < size;) {
+    if (state == 0) {
+      pos = this->skip(data, pos, size);
+      if (pos == size)
+        break;
+    }
+    state = m_next[state * m_class_count + m_class[data[pos]]];
+    ++pos;
+    for (const std::uint32_t pattern : m_outputs[state]) {
+      on_match(pattern, pos);
+    }
+  }
+};
+
+std::size_t PatternMatcher::skip(const std::uint8_t *data, std::size_t pos,
+                                 std::size_t size) const {
+#ifdef FNODCMANON_SSE2
+  // byte b is in [low, low + span] iff (b - low) wrapped saturates to 0 when
+  // span is subtracted
+  const std::size_t count = m_start_ranges.size();
+  __m128i lows[MAX_START_RANGES];
+  __m128i spans[MAX_START_RANGES];
+  for (std::size_t r = 0; r < count; ++r) {
+    lows[r] = _mm_set1_epi8(static_cast<char>(m_start_ranges[r].first));
+    spans[r] = _mm_set1_epi8(static_cast<char>(m_start_ranges[r].second));
+  }
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; pos + 16 <= size; pos += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    __m128i candidates = zero;
+    for (std::size_t r = 0; r < count; ++r) {
+      const __m128i offset = _mm_sub_epi8(bytes, lows[r]);
+      candidates = _mm_or_si128(
+          candidates,
+          _mm_cmpeq_epi8(_mm_subs_epu8(offset, spans[r]), zero));
+    }
+    auto mask = static_cast<unsigned int>(_mm_movemask_epi8(candidates));
+    while (mask != 0) {
+      const std::size_t candidate = pos + std::countr_zero(mask);
+      if (m_start[data[candidate]])
+        return candidate;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  while (pos < size && !m_start[data[pos]]) {
+    ++pos;
+  }
+  return pos;
+};
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+#include "fmt/format.h"
+
+#include "PhaseTimer.hpp"
+
+namespace {
+constexpr std::array<const char *, PH_COUNT> PHASE_NAMES{
+    "study", "file", "walk", "load", "profile", "uids", "invalid tags",
+    "encode", "save"};
+
+// profilers get distinct ids, so a thread never reuses the trace buffer of
+// an earlier one
+std::atomic<std::uint64_t> nextProfilerId{1};
+
+struct ThreadTraceCache {
+  std::uint64_t profiler{0};
+  void *trace{nullptr};
+};
+thread_local ThreadTraceCache threadTraceCache{};
+
+// JSON string contents of `text`
+std::string escapeJson(std::string_view text) {
+  std::string escaped{};
+  escaped.reserve(text.size());
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += fmt::format("\\u{:04x}", static_cast<unsigned int>(c));
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+};
+
+void updateMax(std::atomic<std::uint64_t> &max, std::uint64_t value) {
+  std::uint64_t current = max.load(std::memory_order_relaxed);
+  while (current < value &&
+         !max.compare_exchange_weak(current, value,
+                                    std::memory_order_relaxed)) {
+  }
+};
+} // namespace
+
+const char *phaseName(E_PHASE phase) { return PHASE_NAMES[phase]; };
+
+void PhaseHistogram::add(std::uint64_t ns) {
+  // exact below 8 ns, then 8 buckets between consecutive powers of two
+  std::size_t bucket = static_cast<std::size_t>(ns);
+  if (ns >= SUB_BUCKETS) {
+    const int exponent = std::bit_width(ns) - 1;
+    const std::uint64_t sub = (ns >> (exponent - 3)) & (SUB_BUCKETS - 1);
+    bucket = SUB_BUCKETS +
+             static_cast<std::size_t>(exponent - 3) * SUB_BUCKETS +
+             static_cast<std::size_t>(sub);
+  }
+  m_buckets[std::min(bucket, BUCKETS - 1)].fetch_add(
+      1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_total.fetch_add(ns, std::memory_order_relaxed);
+  updateMax(m_max, ns);
+};
+
+void PhaseHistogram::clear() {
+  for (std::atomic<std::uint64_t> &bucket : m_buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  m_count = 0;
+  m_total = 0;
+  m_max = 0;
+};
+
+std::uint64_t PhaseHistogram::percentile(double fraction) const {
+  const std::uint64_t count = m_count;
+  if (count == 0)
+    return 0;
+  const auto rank = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(
+             std::ceil(fraction * static_cast<double>(count))));
+
+  std::uint64_t seen{0};
+  for (std::size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+    seen += m_buckets[bucket].load(std::memory_order_relaxed);
+    if (seen < rank)
+      continue;
+    if (bucket < SUB_BUCKETS)
+      return bucket;
+    // middle of the bucket, never above the largest sample
+    const std::size_t exponent = (bucket - SUB_BUCKETS) / SUB_BUCKETS + 3;
+    const std::uint64_t width = std::uint64_t{1} << (exponent - 3);
+    const std::uint64_t low = (SUB_BUCKETS + bucket % SUB_BUCKETS) * width;
+    return std::min<std::uint64_t>(low + width / 2, m_max);
+  }
+  return m_max;
+};
+
+void PhaseTimes::clear() {
+  for (PhaseHistogram &phase : m_phases) {
+    phase.clear();
+  }
+};
+
+std::vector<std::string> PhaseTimes::summary() const {
+  std::vector<std::string> lines{};
+  for (std::size_t i = 0; i < PH_COUNT; ++i) {
+    const PhaseHistogram &phase = m_phases[i];
+    if (phase.count() == 0)
+      continue;
+    lines.push_back(fmt::format(
+        "{}: {}x, p50 {}, p95 {}, p99 {}, max {}",
+        phaseName(static_cast<E_PHASE>(i)), phase.count(),
+        formatDuration(phase.percentile(0.5)),
+        formatDuration(phase.percentile(0.95)),
+        formatDuration(phase.percentile(0.99)), formatDuration(phase.max())));
+  }
+  return lines;
+};
+
+std::string formatDuration(std::uint64_t ns) {
+  const auto value = static_cast<double>(ns);
+  if (ns < 1000)
+    return fmt::format("{} ns", ns);
+  if (ns < 1000000)
+    return fmt::format("{:.1f} us", value / 1e3);
+  if (ns < 1000000000)
+    return fmt::format("{:.1f} ms", value / 1e6);
+  return fmt::format("{:.2f} s", value / 1e9);
+};
+
+std::atomic<PhaseProfiler *> PhaseProfiler::s_active{nullptr};
+
+PhaseProfiler::PhaseProfiler(bool trace)
+    : m_trace{trace}, m_epoch{std::chrono::steady_clock::now()},
+      m_id{nextProfilerId++} {};
+
+PhaseProfiler::~PhaseProfiler() { this->uninstall(); };
+
+void PhaseProfiler::install() { s_active = this; };
+
+void PhaseProfiler::uninstall() {
+  PhaseProfiler *expected = this;
+  s_active.compare_exchange_strong(expected, nullptr);
+};
+
+void PhaseProfiler::record(E_PHASE phase,
+                           std::chrono::steady_clock::time_point start,
+                           std::chrono::steady_clock::time_point end,
+                           PhaseTimes *study, std::string_view detail) {
+  const auto ns = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count());
+  m_run.add(phase, ns);
+  if (study != nullptr)
+    study->add(phase, ns);
+
+  if (!m_trace)
+    return;
+  const auto start_ns = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_epoch)
+          .count());
+  this->threadTrace().events.push_back(
+      {phase, start_ns, ns, std::string{detail}});
+};
+
+void PhaseProfiler::print() const {
+  fmt::print("{:<14}{:>10}{:>12}{:>12}{:>12}{:>12}{:>12}\n", "phase", "count",
+             "total", "p50", "p95", "p99", "max");
+  for (std::size_t i = 0; i < PH_COUNT; ++i) {
+    const PhaseHistogram &phase = m_run[static_cast<E_PHASE>(i)];
+    if (phase.count() == 0)
+      continue;
+    fmt::print("{:<14}{:>10}{:>12}{:>12}{:>12}{:>12}{:>12}\n",
+               phaseName(static_cast<E_PHASE>(i)), phase.count(),
+               formatDuration(phase.total()),
+               formatDuration(phase.percentile(0.5)),
+               formatDuration(phase.percentile(0.95)),
+               formatDuration(phase.percentile(0.99)),
+               formatDuration(phase.max()));
+  }
+};
+
+OFCondition PhaseProfiler::writeTrace(const std::string &path) {
+  std::ofstream out{path, std::ios::out | std::ios::binary};
+  if (!out.is_open())
+    return {0, 0, OF_error, "unable to write trace file"};
+
+  std::scoped_lock lock{m_mutex};
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first{true};
+  const auto separator = [&]() {
+    if (!first)
+      out << ",\n";
+    first = false;
+  };
+  for (const std::unique_ptr<ThreadTrace> &thread : m_threads) {
+    separator();
+    out << fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":{0},\"args\":{{\"name\":\"thread {0}\"}}}}",
+                       thread->tid);
+    for (const TraceEvent &event : thread->events) {
+      separator();
+      // complete events, timestamps in microseconds
+      out << fmt::format("{{\"name\":\"{}\",\"cat\":\"fnodcmanon\","
+                         "\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},"
+                         "\"dur\":{:.3f}",
+                         phaseName(event.phase), thread->tid,
+                         static_cast<double>(event.start_ns) / 1e3,
+                         static_cast<double>(event.duration_ns) / 1e3);
+      if (!event.detail.empty())
+        out << ",\"args\":{\"detail\":\"" << escapeJson(event.detail)
+            << "\"}";
+      out << '}';
+    }
+  }
+  out << "\n]}\n";
+  out.close();
+  if (!out)
+    return {0, 0, OF_error, "unable to write trace file"};
+  return EC_Normal;
+};
+
+PhaseProfiler::ThreadTrace &PhaseProfiler::threadTrace() {
+  if (threadTraceCache.profiler == m_id)
+    return *static_cast<ThreadTrace *>(threadTraceCache.trace);
+
+  std::scoped_lock lock{m_mutex};
+  auto trace = std::make_unique<ThreadTrace>();
+  trace->tid = static_cast<unsigned int>(m_threads.size());
+  m_threads.push_back(std::move(trace));
+  threadTraceCache = {m_id, m_threads.back().get()};
+  return *m_threads.back();
+};
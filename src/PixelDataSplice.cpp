@@ -0,0 +1,193 @@
+#include <array>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+#include "dcmtk/oflog/oflog.h"
+
+#include "DicomAnonymizer.hpp"
+#include "PixelDataSplice.hpp"
+
+namespace {
+constexpr std::uint64_t EXPLICIT_HEADER_LENGTH{12}; // tag, VR, 2x0, length
+constexpr std::uint64_t IMPLICIT_HEADER_LENGTH{8};  // tag, length
+
+std::uint32_t readUint32LE(const unsigned char *bytes) {
+  return static_cast<std::uint32_t>(bytes[0]) |
+         static_cast<std::uint32_t>(bytes[1]) << 8 |
+         static_cast<std::uint32_t>(bytes[2]) << 16 |
+         static_cast<std::uint32_t>(bytes[3]) << 24;
+};
+
+OFCondition appendFileRangeBuffered(const std::string &source,
+                                    const FileRange &range,
+                                    const std::string &destination,
+                                    FileChecksum *checksum) {
+  std::ifstream in{source, std::ios::in | std::ios::binary};
+  std::ofstream out{destination,
+                    std::ios::out | std::ios::binary | std::ios::app};
+  if (!in.is_open() || !out.is_open()) {
+    return {0, 0, OF_error, "unable to open files for pixel data copy"};
+  }
+
+  in.seekg(static_cast<std::streamoff>(range.offset));
+  std::vector<char> buffer(1 << 20);
+  std::uint64_t remaining = range.length;
+  while (remaining > 0) {
+    const std::size_t chunk = static_cast<std::size_t>(
+        std::min<std::uint64_t>(remaining, buffer.size()));
+    if (!in.read(buffer.data(), static_cast<std::streamsize>(chunk)) ||
+        !out.write(buffer.data(), static_cast<std::streamsize>(chunk))) {
+      return {0, 0, OF_error, "error while copying pixel data"};
+    }
+    if (checksum != nullptr)
+      checksum->update(buffer.data(), chunk);
+    remaining -= chunk;
+  }
+  return EC_Normal;
+};
+
+#if defined(__linux__)
+// returns false if nothing was copied and the kernel cannot copy between
+// these files, caller falls back to the buffered copy
+bool appendFileRangeKernel(const std::string &source, const FileRange &range,
+                           const std::string &destination, OFCondition &cond) {
+  const int in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    cond = {0, 0, OF_error, "unable to open input file for pixel data copy"};
+    return true;
+  }
+  // copy_file_range rejects O_APPEND, write at explicit end offset instead
+  const int out = ::open(destination.c_str(), O_WRONLY | O_CLOEXEC);
+  if (out < 0) {
+    ::close(in);
+    cond = {0, 0, OF_error, "unable to open output file for pixel data copy"};
+    return true;
+  }
+
+  off_t in_offset = static_cast<off_t>(range.offset);
+  off_t out_offset = ::lseek(out, 0, SEEK_END);
+  std::uint64_t remaining = range.length;
+  bool use_sendfile = false;
+  bool handled = true;
+  cond = EC_Normal;
+
+  while (remaining > 0) {
+    ssize_t copied{0};
+    if (!use_sendfile) {
+      copied = ::copy_file_range(in, &in_offset, out, &out_offset,
+                                 static_cast<std::size_t>(remaining), 0);
+      if (copied < 0 && (errno == EXDEV || errno == ENOSYS ||
+                         errno == EINVAL || errno == EOPNOTSUPP)) {
+        use_sendfile = true;
+        continue;
+      }
+    } else {
+      if (::lseek(out, out_offset, SEEK_SET) < 0) {
+        copied = -1;
+      } else {
+        copied = ::sendfile(out, in, &in_offset,
+                            static_cast<std::size_t>(remaining));
+        if (copied > 0)
+          out_offset += copied;
+      }
+      if (copied < 0 && remaining == range.length &&
+          (errno == EINVAL || errno == ENOSYS)) {
+        handled = false;
+        break;
+      }
+    }
+
+    if (copied < 0 && errno == EINTR)
+      continue;
+    if (copied <= 0) {
+      cond = {0, 0, OF_error, "error while copying pixel data"};
+      break;
+    }
+    remaining -= static_cast<std::uint64_t>(copied);
+  }
+
+  ::close(out);
+  ::close(in);
+  return handled;
+};
+#endif
+} // namespace
+
+bool findPixelDataRange(const std::string &path, DcmDataset *dataset,
+                        FileRange &range) {
+  if (dataset == nullptr || dataset->card() == 0)
+    return false;
+
+  const E_TransferSyntax xfer = dataset->getOriginalXfer();
+  const DcmXfer xferInfo{xfer};
+  if (xfer != dataset->getCurrentXfer() || !xferInfo.isLittleEndian() ||
+      xferInfo.isEncapsulated() || xferInfo.getStreamCompression() != ESC_none)
+    return false;
+
+  // recalculated group length would no longer match the copied element
+  if (dataset->tagExists(DcmTagKey(0x7fe0, 0x0000)))
+    return false;
+
+  DcmElement *pixelData = dataset->getElement(dataset->card() - 1);
+  if (pixelData == nullptr || pixelData->getTag() != DCM_PixelData)
+    return false;
+
+  const std::uint32_t valueLength = pixelData->getLength();
+  if (valueLength == 0 || valueLength == 0xffffffff || valueLength % 2 != 0)
+    return false;
+
+  std::error_code ec{};
+  const std::uint64_t fileSize = std::filesystem::file_size(path, ec);
+  const std::uint64_t headerLength = xferInfo.isExplicitVR()
+                                         ? EXPLICIT_HEADER_LENGTH
+                                         : IMPLICIT_HEADER_LENGTH;
+  if (ec || fileSize < valueLength + headerLength)
+    return false;
+
+  // element must end the file, verify its header bytes before trusting it
+  range.offset = fileSize - valueLength - headerLength;
+  range.length = valueLength + headerLength;
+
+  std::array<unsigned char, EXPLICIT_HEADER_LENGTH> header{};
+  std::ifstream file{path, std::ios::in | std::ios::binary};
+  file.seekg(static_cast<std::streamoff>(range.offset));
+  if (!file.read(reinterpret_cast<char *>(header.data()),
+                 static_cast<std::streamsize>(headerLength)))
+    return false;
+
+  if (header[0] != 0xe0 || header[1] != 0x7f || header[2] != 0x10 ||
+      header[3] != 0x00)
+    return false;
+
+  if (xferInfo.isExplicitVR()) {
+    const bool otherVR = (header[4] == 'O' && (header[5] == 'B' ||
+                                               header[5] == 'W')) ||
+                         (header[4] == 'U' && header[5] == 'N');
+    return otherVR && header[6] == 0 && header[7] == 0 &&
+           readUint32LE(&header[8]) == valueLength;
+  }
+  return readUint32LE(&header[4]) == valueLength;
+};
+
+OFCondition appendFileRange(const std::string &source, const FileRange &range,
+                            const std::string &destination,
+                            FileChecksum *checksum) {
+  OFCondition cond{};
+#if defined(__linux__)
+  if (checksum == nullptr &&
+      appendFileRangeKernel(source, range, destination, cond))
+    return cond;
+#endif
+  cond = appendFileRangeBuffered(source, range, destination, checksum);
+  return cond;
+};
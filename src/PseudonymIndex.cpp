@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/ofstd/ofexit.h"
+
+#include "DicomAnonymizer.hpp"
+#include "PseudonymIndex.hpp"
+
+namespace {
+constexpr char MAGIC[8] = {'F', 'N', 'O', 'P', 'S', 'X', '0', '1'};
+constexpr std::uint32_t VERSION{1};
+
+// PatientID normalization of the pseudoname file: whitespace, slashes and
+// letters are dropped
+bool isKeyChar(char c) {
+  const auto u = static_cast<unsigned char>(c);
+  return std::isspace(u) == 0 && c != '/' && std::isalpha(u) == 0;
+};
+
+// PatientID before the first comma, the whole line without one
+std::string_view keyField(std::string_view line) {
+  return line.substr(0, line.find(','));
+};
+
+// pseudoname after the first comma, the whole line without one
+std::string_view valueField(std::string_view line) {
+  const std::size_t comma = line.find(',');
+  return comma == std::string_view::npos ? line : line.substr(comma + 1);
+};
+
+// FNV-1a over the normalized PatientID
+std::uint64_t hashKey(std::string_view field) {
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char c : field) {
+    if (isKeyChar(c))
+      hash = (hash ^ static_cast<std::uint8_t>(c)) * 0x100000001b3ULL;
+  }
+  return hash;
+};
+
+// normalized `field` equals `other`, which is normalized too if requested
+bool equalKey(std::string_view field, std::string_view other,
+              bool normalize_other) {
+  auto it = other.begin();
+  for (const char c : field) {
+    if (!isKeyChar(c))
+      continue;
+    while (normalize_other && it != other.end() && !isKeyChar(*it)) {
+      ++it;
+    }
+    if (it == other.end() || *it != c)
+      return false;
+    ++it;
+  }
+  while (normalize_other && it != other.end() && !isKeyChar(*it)) {
+    ++it;
+  }
+  return it == other.end();
+};
+
+OFCondition readError() {
+  return {0, EXITCODE_CANNOT_READ_INPUT_FILE, OF_error,
+          "error reading file with pseudonames"};
+};
+} // namespace
+
+struct PseudonymIndex::SidecarHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t entry_size;
+  std::uint64_t csv_size;
+  std::int64_t csv_time; // modification time of the pairs
+  std::uint64_t count;
+  std::uint64_t unique;
+  std::uint8_t reserved[16];
+};
+
+OFCondition PseudonymIndex::open(const std::string &path, bool sidecar) {
+  static_assert(sizeof(SidecarHeader) == 64 && sizeof(Entry) == 16);
+
+  std::error_code error{};
+  const std::uint64_t size = std::filesystem::file_size(path, error);
+  if (error)
+    return readError();
+  const std::int64_t time =
+      std::filesystem::last_write_time(path, error).time_since_epoch().count();
+
+  // an empty file has no pairs and nothing to map
+  if (size > 0) {
+    if (m_file.openReadOnly(path).bad())
+      return readError();
+
+    const std::string sidecarPath = path + SIDECAR_SUFFIX;
+    if (sidecar && this->loadSidecar(sidecarPath, size, time)) {
+      OFLOG_INFO(mainLogger, "using index `" << sidecarPath << "`");
+    } else {
+      this->build();
+      if (sidecar) {
+        const OFCondition cond = this->writeSidecar(sidecarPath, size, time);
+        if (cond.bad()) {
+          OFLOG_WARN(mainLogger, "unable to write index `"
+                                     << sidecarPath << "`: " << cond.text());
+        } else {
+          OFLOG_INFO(mainLogger, "wrote index `" << sidecarPath << "`");
+        }
+      }
+    }
+  }
+
+  OFLOG_INFO(mainLogger, "found " << m_unique
+                                  << " PatientID-pseudoname pairs to apply");
+  return EC_Normal;
+};
+
+std::optional<std::string>
+PseudonymIndex::find(std::string_view patient_id) const {
+  const std::uint64_t hash = hashKey(patient_id);
+  const Entry *end = m_entries + m_count;
+  const Entry *it = std::lower_bound(
+      m_entries, end, hash,
+      [](const Entry &entry, std::uint64_t value) {
+        return entry.hash < value;
+      });
+
+  // equal hashes are sorted by line, so the first match is the first line
+  for (; it != end && it->hash == hash; ++it) {
+    const std::string_view line = this->line(it->offset);
+    if (!equalKey(keyField(line), patient_id, false))
+      continue;
+
+    std::string pseudoname{valueField(line)};
+    std::erase_if(pseudoname, [](char c) {
+      return std::isspace(static_cast<unsigned char>(c)) != 0;
+    });
+    return pseudoname;
+  }
+  return std::nullopt;
+};
+
+void PseudonymIndex::build() {
+  const std::uint64_t size = m_file.size();
+  // rough guess of 32 bytes per line
+  m_built.reserve(static_cast<std::size_t>(size / 32));
+  for (std::uint64_t offset = 0; offset < size;) {
+    const std::string_view line = this->line(offset);
+    m_built.push_back({hashKey(keyField(line)), offset});
+    offset += line.size() + 1;
+  }
+  std::sort(m_built.begin(), m_built.end(),
+            [](const Entry &a, const Entry &b) {
+              return a.hash != b.hash ? a.hash < b.hash : a.offset < b.offset;
+            });
+  m_entries = m_built.data();
+  m_count = m_built.size();
+
+  // a PatientID counts once however often it is listed
+  m_unique = 0;
+  for (std::uint64_t i = 0; i < m_count; ++i) {
+    const std::string_view key = keyField(this->line(m_entries[i].offset));
+    bool seen{false};
+    for (std::uint64_t j = i; !seen && j > 0 &&
+                              m_entries[j - 1].hash == m_entries[i].hash;
+         --j) {
+      seen = equalKey(keyField(this->line(m_entries[j - 1].offset)), key,
+                      true);
+    }
+    m_unique += seen ? 0 : 1;
+  }
+};
+
+bool PseudonymIndex::loadSidecar(const std::string &path,
+                                 std::uint64_t csv_size,
+                                 std::int64_t csv_time) {
+  std::error_code error{};
+  if (!std::filesystem::exists(path, error) ||
+      m_sidecar.openReadOnly(path).bad())
+    return false;
+
+  const auto *header =
+      reinterpret_cast<const SidecarHeader *>(m_sidecar.data());
+  if (m_sidecar.size() < sizeof(SidecarHeader) ||
+      std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header->version != VERSION || header->entry_size != sizeof(Entry) ||
+      header->csv_size != csv_size || header->csv_time != csv_time ||
+      m_sidecar.size() !=
+          sizeof(SidecarHeader) + header->count * sizeof(Entry)) {
+    OFLOG_INFO(mainLogger, "index `" << path << "` is outdated, rebuilding");
+    m_sidecar.close();
+    return false;
+  }
+
+  m_entries = reinterpret_cast<const Entry *>(m_sidecar.data() +
+                                              sizeof(SidecarHeader));
+  m_count = header->count;
+  m_unique = header->unique;
+  return true;
+};
+
+OFCondition PseudonymIndex::writeSidecar(const std::string &path,
+                                         std::uint64_t csv_size,
+                                         std::int64_t csv_time) const {
+  SidecarHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.entry_size = sizeof(Entry);
+  header.csv_size = csv_size;
+  header.csv_time = csv_time;
+  header.count = m_count;
+  header.unique = m_unique;
+
+  // renamed when complete, so a crash leaves no truncated index behind
+  const std::string partPath = path + ".part";
+  std::ofstream file{partPath, std::ios::out | std::ios::binary};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(m_entries),
+             static_cast<std::streamsize>(m_count * sizeof(Entry)));
+  file.close();
+  std::error_code error{};
+  if (!file) {
+    std::filesystem::remove(partPath, error);
+    return {0, 0, OF_error, "unable to write index file"};
+  }
+
+  std::filesystem::rename(partPath, path, error);
+  if (error)
+    return {0, 0, OF_error, "unable to rename index file"};
+  return EC_Normal;
+};
+
+std::string_view PseudonymIndex::line(std::uint64_t offset) const {
+  const char *data = reinterpret_cast<const char *>(m_file.data());
+  const std::uint64_t size = m_file.size();
+  const void *newline = std::memchr(data + offset, '\n', size - offset);
+  const std::uint64_t end =
+      newline != nullptr
+          ? static_cast<std::uint64_t>(static_cast<const char *>(newline) -
+                                       data)
+          : size;
+  return {data + offset, static_cast<std::size_t>(end - offset)};
+};
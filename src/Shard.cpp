@@ -0,0 +1,115 @@
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <map>
+
+#include "dcmtk/oflog/oflog.h"
+
+#include "fmt/format.h"
+
+#include "AnonymOutputWriter.hpp"
+#include "DicomAnonymizer.hpp"
+#include "Shard.hpp"
+
+namespace {
+// FNV-1a, fixed so every node and build assigns the same shards; low FNV bits
+// only depend on low bits of the input bytes, so mix them before the modulo
+std::uint64_t stableHash(std::string_view key) {
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char c : key) {
+    hash = (hash ^ static_cast<std::uint8_t>(c)) * 0x100000001b3ULL;
+  }
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  return hash ^ (hash >> 31);
+};
+
+bool parseUnsigned(std::string_view text, unsigned long &value) {
+  const auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  return error == std::errc{} && end == text.data() + text.size();
+};
+} // namespace
+
+bool ShardSpec::contains(std::string_view study_key) const {
+  return stableHash(study_key) % count + 1 == index;
+};
+
+std::string ShardSpec::name() const {
+  return fmt::format("shard-{}-of-{}", index, count);
+};
+
+OFCondition parseShard(const std::string &value, ShardSpec &shard) {
+  const std::size_t slash = value.find('/');
+  unsigned long index{0}, count{0};
+  if (slash == std::string::npos ||
+      !parseUnsigned(std::string_view(value).substr(0, slash), index) ||
+      !parseUnsigned(std::string_view(value).substr(slash + 1), count) ||
+      count == 0 || index == 0 || index > count) {
+    return {0, 0, OF_error, "invalid shard, expected k/N with 1 <= k <= N"};
+  }
+
+  shard.index = static_cast<unsigned int>(index);
+  shard.count = static_cast<unsigned int>(count);
+  return EC_Normal;
+};
+
+OFCondition mergeShardFragments(const std::vector<std::string> &fragments,
+                                const std::string &output) {
+  const std::string header =
+      std::string(AnonymOutputWriter::STUDY_NUMBER_COLUMN) +
+      AnonymOutputWriter::HEADER;
+
+  std::map<unsigned long, std::string> rows{};
+  for (const std::string &fragment : fragments) {
+    std::ifstream in{fragment, std::ios::in};
+    if (!in.is_open()) {
+      const std::string msg =
+          fmt::format("unable to read fragment `{}`", fragment);
+      return {0, 0, OF_error, msg.c_str()};
+    }
+
+    std::string line{};
+    if (!std::getline(in, line) || line + '\n' != header) {
+      const std::string msg =
+          fmt::format("`{}` is not an anonym_output.csv fragment", fragment);
+      return {0, 0, OF_error, msg.c_str()};
+    }
+
+    while (std::getline(in, line)) {
+      if (line.empty())
+        continue;
+      const std::size_t comma = line.find(',');
+      unsigned long number{0};
+      if (comma == std::string::npos ||
+          !parseUnsigned(std::string_view(line).substr(0, comma), number)) {
+        const std::string msg =
+            fmt::format("invalid row in fragment `{}`", fragment);
+        return {0, 0, OF_error, msg.c_str()};
+      }
+      // shards overlap only if they were run with different study lists
+      if (!rows.emplace(number, line.substr(comma + 1)).second) {
+        const std::string msg = fmt::format(
+            "study {} appears in more than one fragment", number);
+        return {0, 0, OF_error, msg.c_str()};
+      }
+    }
+  }
+
+  std::ofstream out{output, std::ios::out};
+  if (!out.is_open()) {
+    const std::string msg = fmt::format("unable to write `{}`", output);
+    return {0, 0, OF_error, msg.c_str()};
+  }
+  out << AnonymOutputWriter::HEADER;
+  for (const auto &[number, row] : rows) {
+    out << row << '\n';
+  }
+  out.close();
+  if (!out)
+    return {0, 0, OF_error, "error while writing merged csv"};
+
+  OFLOG_INFO(mainLogger, "merged " << rows.size() << " rows from "
+                                   << fragments.size() << " fragments");
+  return EC_Normal;
+};
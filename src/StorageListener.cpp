@@ -0,0 +1,291 @@
+#include "StorageListener.hpp"
+
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <thread>
+
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmnet/scppool.h"
+#include "dcmtk/dcmnet/scpthrd.h"
+#include "dcmtk/oflog/oflog.h"
+
+#include "fmt/format.h"
+
+namespace {
+// pool workers construct their SCP themselves, so received instances are
+// handed to the one listener of the process
+std::atomic<StorageListener *> activeListener{nullptr};
+std::atomic<bool> stopRequested{false};
+
+extern "C" void requestStop(int) { stopRequested = true; }
+
+// anonymization does not touch pixel data, so compressed syntaxes are
+// accepted as well and the instance is written in the syntax it came in
+constexpr std::array<const char *, 12> TRANSFER_SYNTAXES{
+    UID_LittleEndianExplicitTransferSyntax,
+    UID_LittleEndianImplicitTransferSyntax,
+    UID_DeflatedExplicitVRLittleEndianTransferSyntax,
+    UID_BigEndianExplicitTransferSyntax,
+    UID_JPEGProcess14SV1TransferSyntax,
+    UID_JPEGProcess1TransferSyntax,
+    UID_JPEGProcess2_4TransferSyntax,
+    UID_JPEGLSLosslessTransferSyntax,
+    UID_JPEGLSLossyTransferSyntax,
+    UID_RLELosslessTransferSyntax,
+    UID_JPEG2000LosslessOnlyTransferSyntax,
+    UID_JPEG2000TransferSyntax};
+
+class AnonymizingSCP : public DcmThreadSCP {
+protected:
+  OFCondition
+  handleIncomingCommand(T_DIMSE_Message *message,
+                        const DcmPresentationContextInfo &info) override {
+    // C-ECHO is answered by the base class
+    if (message == nullptr || message->CommandField != DIMSE_C_STORE_RQ)
+      return DcmThreadSCP::handleIncomingCommand(message, info);
+
+    T_DIMSE_C_StoreRQ &request = message->msg.CStoreRQ;
+    DcmFileFormat fileformat{};
+    DcmDataset *dataset = fileformat.getDataset();
+    OFCondition cond = this->receiveSTORERequest(
+        request, info.presentationContextID, dataset);
+    if (cond.bad()) {
+      if (cond == DIMSE_OUTOFRESOURCES) {
+        (void)this->sendSTOREResponse(info.presentationContextID, request,
+                                      STATUS_STORE_Refused_OutOfResources);
+      }
+      return cond;
+    }
+
+    // the sender keeps instances that were not written; local write errors
+    // are reported as out of resources, so it retries them
+    Uint16 status = STATUS_Success;
+    StorageListener *listener = activeListener;
+    bool write_failed{false};
+    if (listener == nullptr) {
+      status = STATUS_STORE_Refused_OutOfResources;
+    } else if (listener
+                   ->store(fileformat, this->getPeerAETitle().c_str(),
+                           write_failed)
+                   .bad()) {
+      status = write_failed ? STATUS_STORE_Refused_OutOfResources
+                            : STATUS_STORE_Error_CannotUnderstand;
+    }
+    return this->sendSTOREResponse(info.presentationContextID, request,
+                                   status);
+  };
+};
+} // namespace
+
+struct StorageListener::Pool : DcmSCPPool<AnonymizingSCP> {};
+
+StorageListener::StorageListener(const AnonymizerConfig &config,
+                                 AnonymOutputWriter &output)
+    : m_config{config}, m_output{output}, m_pool{std::make_unique<Pool>()} {};
+
+StorageListener::~StorageListener() = default;
+
+OFCondition StorageListener::listen(unsigned short port,
+                                    const std::string &ae_title,
+                                    unsigned int max_associations,
+                                    std::chrono::seconds quiet_period) {
+  DcmSCPConfig &scp = m_pool->getConfig();
+  scp.setPort(port);
+  scp.setAETitle(ae_title.c_str());
+  scp.setHostLookupEnabled(OFFalse);
+  // poll for new associations so a stop request is noticed
+  scp.setConnectionBlockingMode(DUL_NOBLOCK);
+  scp.setConnectionTimeout(1);
+
+  OFList<OFString> syntaxes{};
+  for (const char *syntax : TRANSFER_SYNTAXES) {
+    syntaxes.push_back(syntax);
+  }
+  OFList<OFString> echoSyntaxes{};
+  echoSyntaxes.push_back(UID_LittleEndianImplicitTransferSyntax);
+  OFCondition cond =
+      scp.addPresentationContext(UID_VerificationSOPClass, echoSyntaxes);
+  // the long list stays below the limit of 128 presentation contexts
+  for (int i = 0; cond.good() && i < numberOfDcmLongSCUStorageSOPClassUIDs;
+       ++i) {
+    cond = scp.addPresentationContext(dcmLongSCUStorageSOPClassUIDs[i],
+                                      syntaxes);
+  }
+  if (cond.bad())
+    return cond;
+  m_pool->setMaxThreads(static_cast<Uint16>(max_associations));
+
+  StorageListener *expected = nullptr;
+  if (!activeListener.compare_exchange_strong(expected, this))
+    return {0, 0, OF_error, "another storage listener is running"};
+
+  stopRequested = false;
+  std::signal(SIGINT, requestStop);
+  std::signal(SIGTERM, requestStop);
+  std::atomic<bool> listening{true};
+  std::thread watcher{[&]() {
+    while (listening && !stopRequested) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      // errors are logged, the instances stay in the output
+      (void)this->closeStudies(quiet_period, false);
+    }
+    if (stopRequested) {
+      OFLOG_INFO(mainLogger, "stopping after running associations");
+      this->stop();
+    }
+  }};
+
+  OFLOG_INFO(mainLogger, "listening on port " << port << " as `" << ae_title
+                                              << "` with up to "
+                                              << max_associations
+                                              << " association(s)");
+  cond = m_pool->listen();
+
+  listening = false;
+  watcher.join();
+  std::signal(SIGINT, SIG_DFL);
+  std::signal(SIGTERM, SIG_DFL);
+  activeListener = nullptr;
+
+  // studies still receiving instances when the listener stopped
+  const OFCondition close_cond = this->closeStudies({}, true);
+  if (cond.good())
+    cond = close_cond;
+
+  OFLOG_INFO(mainLogger, "received " << m_instances << " instances of "
+                                     << this->studyCount() << " studies");
+  return cond;
+};
+
+void StorageListener::stop() { m_pool->stopAfterCurrentAssociations(); };
+
+OFCondition StorageListener::store(DcmFileFormat &fileformat,
+                                   const std::string &peer,
+                                   bool &write_failed) {
+  DcmDataset *dataset = fileformat.getDataset();
+  DicomHeader header{};
+  copyHeader(dataset, header);
+
+  write_failed = false;
+  DicomInputFile file{fmt::format("{}/{}", peer, header.sop_uid)};
+  if (header.study_uid.empty()) {
+    OFLOG_WARN(mainLogger, "rejecting `" << file.path
+                                         << "` without StudyInstanceUID");
+    return {0, 0, OF_error, "instance without StudyInstanceUID"};
+  }
+
+  // a closed study is continued under its identity and row
+  ReceivedStudy *study = nullptr;
+  {
+    std::scoped_lock lock{m_mutex};
+    auto &entry = m_studies[header.study_uid];
+    if (!entry) {
+      const auto closed = m_closed.find(header.study_uid);
+      if (closed != m_closed.end()) {
+        entry = std::make_unique<ReceivedStudy>(m_config, closed->second.index);
+        entry->identity = std::move(closed->second.identity);
+        entry->next_index = closed->second.next_index;
+        m_closed.erase(closed);
+      } else {
+        entry = std::make_unique<ReceivedStudy>(m_config, m_rows++);
+      }
+    }
+    study = entry.get();
+    ++study->storing;
+  }
+
+  const OFCondition cond =
+      this->storeInStudy(*study, fileformat, file, header, peer, write_failed);
+
+  std::scoped_lock lock{m_mutex};
+  --study->storing;
+  study->last_instance = std::chrono::steady_clock::now();
+  return cond;
+};
+
+OFCondition StorageListener::storeInStudy(ReceivedStudy &study,
+                                          DcmFileFormat &fileformat,
+                                          DicomInputFile &file,
+                                          const DicomHeader &header,
+                                          const std::string &peer,
+                                          bool &write_failed) {
+  // instances of a new study wait until its identity is assigned
+  {
+    std::scoped_lock lock{study.mutex};
+    if (!study.started) {
+      study.started = true;
+      StudyInput input{};
+      input.source = fmt::format("{}/{}", peer, header.study_uid);
+      input.study_number = static_cast<unsigned int>(study.index + 1);
+      input.header = header;
+      input.identity = study.identity;
+      study.start_cond = study.anonymizer.beginStudy(input);
+      if (study.identity.has_value()) {
+        // the row was written when the study was first started
+      } else if (study.start_cond.good()) {
+        m_output.write(study.index, study.anonymizer.csvRow());
+      } else {
+        m_output.skip(study.index);
+      }
+    }
+    if (study.start_cond.bad())
+      return study.start_cond;
+  }
+
+  file.output_index = study.next_index++;
+  DcmDataset *dataset = fileformat.getDataset();
+  OFCondition cond = study.anonymizer.anonymizeDataset(dataset, file);
+  if (cond.bad())
+    return cond;
+  cond = study.anonymizer.writeDicomFile(fileformat, file, file.output_index);
+  if (cond.bad()) {
+    write_failed = true;
+    return cond;
+  }
+  ++m_instances;
+  return cond;
+};
+
+OFCondition
+StorageListener::closeStudies(std::chrono::steady_clock::duration quiet_period,
+                              bool all) {
+  const auto now = std::chrono::steady_clock::now();
+  OFCondition cond{};
+  // closed under the lock, so an instance arriving meanwhile continues the
+  // study only once its checksums are on disk
+  std::scoped_lock lock{m_mutex};
+  for (auto it = m_studies.begin(); it != m_studies.end();) {
+    ReceivedStudy &study = *it->second;
+    if (!all &&
+        (study.storing > 0 || now - study.last_instance < quiet_period)) {
+      ++it;
+      continue;
+    }
+
+    if (study.started && study.start_cond.good()) {
+      const OFCondition study_cond = study.anonymizer.writeChecksums();
+      if (cond.good())
+        cond = study_cond;
+      study.anonymizer.logStudySummary();
+      OFLOG_INFO(mainLogger, "closed study " << study.anonymizer.m_old_id);
+      m_closed[it->first] = {study.index,
+                             {study.anonymizer.m_pseudoname,
+                              study.anonymizer.m_new_studyuid,
+                              study.anonymizer.seriesUids()},
+                             study.next_index.load()};
+    } else if (study.identity.has_value()) {
+      m_closed[it->first] = {study.index, std::move(*study.identity),
+                             study.next_index.load()};
+    }
+    // new studies that failed to start are dropped, a later instance
+    // retries them under a new row
+    it = m_studies.erase(it);
+  }
+  return cond;
+};
+
+std::size_t StorageListener::studyCount() {
+  std::scoped_lock lock{m_mutex};
+  return m_rows;
+};
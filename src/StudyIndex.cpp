@@ -0,0 +1,96 @@
+#include <algorithm>
+
+#include "dcmtk/oflog/oflog.h"
+
+#include "fmt/format.h"
+
+#include "DirectoryWalker.hpp"
+#include "StudyIndex.hpp"
+
+OFCondition StudyIndex::build(const std::filesystem::path &root,
+                              ThreadPool &pool) {
+  // headers are read by the walking tasks as files are found, so parsing
+  // overlaps with listing the rest of the tree
+  DirectoryWalker walker{pool, true};
+  const OFCondition cond = walker.walk(root, [&](DicomInputFile &&file) {
+    if (std::filesystem::path(file.path).filename() == "DICOMDIR")
+      return;
+
+    std::string reason{};
+    if (!sniffDicomFile(file.path, reason)) {
+      std::scoped_lock lock{m_mutex};
+      ++m_skipped_count;
+      m_rejected.push_back({std::move(file.path), std::move(reason)});
+      return;
+    }
+
+    DicomHeader header{};
+    if (readDicomHeader(file.path, header).bad() || header.study_uid.empty()) {
+      OFLOG_WARN(mainLogger,
+                 "skipping file without StudyInstanceUID `" << file.path
+                                                            << "`");
+      std::scoped_lock lock{m_mutex};
+      ++m_skipped_count;
+      m_rejected.push_back({std::move(file.path), "no StudyInstanceUID"});
+      return;
+    }
+    this->add(file, header);
+  });
+  if (cond.bad())
+    return cond;
+
+  if (m_file_count + m_skipped_count == 0) {
+    const std::string msg =
+        fmt::format("no dicom files found in `{}`", root.string());
+    OFLOG_WARN(mainLogger, msg.c_str());
+    return {0, 0, OF_failure, msg.c_str()};
+  }
+
+  OFLOG_INFO(mainLogger, "indexed " << m_file_count << " files in "
+                                    << m_studies.size() << " studies, skipped "
+                                    << m_skipped_count << " files");
+  return EC_Normal;
+};
+
+void StudyIndex::add(const DicomInputFile &file, const DicomHeader &header) {
+  std::scoped_lock lock{m_mutex};
+
+  StudyEntry &study = m_studies[header.study_uid];
+  if (study.header_path.empty() || file.path < study.header_path) {
+    study.header_path = file.path;
+    study.header = header;
+  }
+  study.series[header.series_uid].push_back(file);
+  ++m_file_count;
+};
+
+std::vector<StudyInput> StudyIndex::studies() const {
+  std::vector<StudyInput> studies{};
+  studies.reserve(m_studies.size());
+
+  for (const auto &[study_uid, entry] : m_studies) {
+    StudyInput &study = studies.emplace_back();
+    study.source = study_uid;
+    study.study_number = static_cast<unsigned int>(studies.size());
+
+    for (const auto &[series_uid, instances] : entry.series) {
+      const std::size_t first = study.files.size();
+      study.files.insert(study.files.end(), instances.begin(),
+                         instances.end());
+      std::sort(study.files.begin() + static_cast<std::ptrdiff_t>(first),
+                study.files.end(),
+                [](const DicomInputFile &lhs, const DicomInputFile &rhs) {
+                  return lhs.path < rhs.path;
+                });
+    }
+    for (std::size_t i = 0; i < study.files.size(); ++i) {
+      study.files[i].output_index = static_cast<unsigned int>(i);
+      study.total_bytes += study.files[i].size;
+    }
+
+    // identity of the study, setBasicTags does not re-read files[0]
+    study.header = entry.header;
+  }
+
+  return studies;
+};
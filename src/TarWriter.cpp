@@ -0,0 +1,319 @@
+#include "TarWriter.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <string_view>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <zlib.h>
+#ifdef FNO_WITH_ZSTD
+#include <thread>
+
+#include <zstd.h>
+#endif
+
+namespace {
+constexpr std::size_t TAR_BLOCK{512};
+constexpr std::size_t OUTPUT_CHUNK{256 * 1024};
+// favour throughput, the stream has to keep up with all workers
+constexpr int GZIP_LEVEL{1};
+constexpr int ZSTD_LEVEL{3};
+
+bool hasSuffix(const std::string &s, std::string_view suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// octal number field, base-256 if the value does not fit
+void putNumber(char *field, std::size_t length, std::uint64_t value) {
+  const unsigned digits = static_cast<unsigned>(length - 1);
+  if (digits * 3 >= 64 || value < (std::uint64_t{1} << (digits * 3))) {
+    for (std::size_t i = digits; i-- > 0;) {
+      field[i] = static_cast<char>('0' + (value & 7));
+      value >>= 3;
+    }
+    field[digits] = '\0';
+    return;
+  }
+  std::memset(field, 0, length);
+  field[0] = static_cast<char>(0x80);
+  for (std::size_t i = length; i-- > 1 && value > 0;) {
+    field[i] = static_cast<char>(value & 0xff);
+    value >>= 8;
+  }
+}
+
+// pax record `<length> path=<name>\n`, the length counts its own digits
+std::string paxPathRecord(const std::string &name) {
+  const std::string body = " path=" + name + "\n";
+  std::size_t length = body.size() + 1;
+  while (std::to_string(length).size() + body.size() != length)
+    ++length;
+  return std::to_string(length) + body;
+}
+} // namespace
+
+// deflate (gzip framing) or zstd stream state
+struct TarWriter::Compressor {
+  E_TAR_COMPRESSION type{TC_NONE};
+  z_stream gzip{};
+  bool gzip_initialized{false};
+#ifdef FNO_WITH_ZSTD
+  ZSTD_CCtx *zstd{nullptr};
+#endif
+  std::vector<char> output = std::vector<char>(OUTPUT_CHUNK);
+
+  ~Compressor() {
+    if (gzip_initialized)
+      deflateEnd(&gzip);
+#ifdef FNO_WITH_ZSTD
+    ZSTD_freeCCtx(zstd);
+#endif
+  }
+
+  OFCondition init(E_TAR_COMPRESSION compression) {
+    type = compression;
+    if (type == TC_GZIP) {
+      if (deflateInit2(&gzip, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK)
+        return {0, 0, OF_error, "zlib initialization failed"};
+      gzip_initialized = true;
+      return EC_Normal;
+    }
+#ifdef FNO_WITH_ZSTD
+    zstd = ZSTD_createCCtx();
+    if (zstd == nullptr)
+      return {0, 0, OF_error, "zstd initialization failed"};
+    ZSTD_CCtx_setParameter(zstd, ZSTD_c_compressionLevel, ZSTD_LEVEL);
+    // compress on background threads if libzstd supports it, ignored
+    // otherwise
+    const unsigned workers = std::max(1U, std::thread::hardware_concurrency());
+    ZSTD_CCtx_setParameter(zstd, ZSTD_c_nbWorkers, static_cast<int>(workers));
+    return EC_Normal;
+#else
+    return {0, 0, OF_error, "built without zstd support"};
+#endif
+  }
+
+  // compress `data` into `file`, `finish` ends the stream
+  OFCondition write(std::FILE *file, const char *data, std::size_t size,
+                    bool finish) {
+    if (type == TC_GZIP)
+      return this->writeGzip(file, data, size, finish);
+#ifdef FNO_WITH_ZSTD
+    ZSTD_inBuffer in{data, size, 0};
+    while (true) {
+      ZSTD_outBuffer out{output.data(), output.size(), 0};
+      const std::size_t remaining = ZSTD_compressStream2(
+          zstd, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+      if (ZSTD_isError(remaining))
+        return {0, 0, OF_error, ZSTD_getErrorName(remaining)};
+      if (out.pos > 0 &&
+          std::fwrite(output.data(), 1, out.pos, file) != out.pos)
+        return {0, 0, OF_error, "unable to write tar stream"};
+      if (finish ? remaining == 0 : in.pos == in.size)
+        return EC_Normal;
+    }
+#else
+    return {0, 0, OF_error, "built without zstd support"};
+#endif
+  }
+
+  OFCondition writeGzip(std::FILE *file, const char *data, std::size_t size,
+                        bool finish) {
+    gzip.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    do {
+      const auto chunk = static_cast<uInt>(
+          std::min<std::size_t>(size, std::numeric_limits<uInt>::max()));
+      gzip.avail_in = chunk;
+      size -= chunk;
+      const bool last = finish && size == 0;
+      int result{Z_OK};
+      do {
+        gzip.next_out = reinterpret_cast<Bytef *>(output.data());
+        gzip.avail_out = static_cast<uInt>(output.size());
+        result = deflate(&gzip, last ? Z_FINISH : Z_NO_FLUSH);
+        if (result == Z_STREAM_ERROR)
+          return {0, 0, OF_error, "gzip compression failed"};
+        const std::size_t produced = output.size() - gzip.avail_out;
+        if (produced > 0 &&
+            std::fwrite(output.data(), 1, produced, file) != produced)
+          return {0, 0, OF_error, "unable to write tar stream"};
+      } while (last ? result != Z_STREAM_END : gzip.avail_out == 0);
+    } while (size > 0);
+    return EC_Normal;
+  }
+};
+
+E_TAR_COMPRESSION tarCompression(const std::string &path) {
+  if (hasSuffix(path, ".gz") || hasSuffix(path, ".tgz"))
+    return TC_GZIP;
+  if (hasSuffix(path, ".zst") || hasSuffix(path, ".tzst"))
+    return TC_ZSTD;
+  return TC_NONE;
+}
+
+bool parseTarCompression(const std::string &value,
+                         E_TAR_COMPRESSION &compression) {
+  if (value == "none")
+    compression = TC_NONE;
+  else if (value == "gzip")
+    compression = TC_GZIP;
+  else if (value == "zstd")
+    compression = TC_ZSTD;
+  else
+    return false;
+  return true;
+}
+
+bool TarWriter::hasZstd() {
+#ifdef FNO_WITH_ZSTD
+  return true;
+#else
+  return false;
+#endif
+}
+
+TarWriter::TarWriter() = default;
+
+TarWriter::~TarWriter() { (void)this->close(); }
+
+OFCondition TarWriter::open(const std::string &path,
+                            E_TAR_COMPRESSION compression) {
+  std::scoped_lock lock{m_mutex};
+
+  if (compression != TC_NONE) {
+    m_compressor = std::make_unique<Compressor>();
+    const OFCondition cond = m_compressor->init(compression);
+    if (cond.bad())
+      return cond;
+  }
+
+  if (path == STDOUT) {
+    // keep the real stdout for the stream, everything else printed to stdout
+    // goes to stderr from now on
+    std::fflush(stdout);
+#ifdef _WIN32
+    const int fd = _dup(_fileno(stdout));
+    if (fd >= 0) {
+      _setmode(fd, _O_BINARY);
+      _dup2(_fileno(stderr), _fileno(stdout));
+      m_file = _fdopen(fd, "wb");
+    }
+#else
+    const int fd = dup(fileno(stdout));
+    if (fd >= 0) {
+      dup2(fileno(stderr), fileno(stdout));
+      m_file = fdopen(fd, "wb");
+    }
+#endif
+  } else {
+    m_file = std::fopen(path.c_str(), "wb");
+  }
+  if (m_file == nullptr)
+    return {0, 0, OF_error, "unable to open tar stream"};
+
+  // large buffer, members are written in many small pieces
+  std::setvbuf(m_file, nullptr, _IOFBF, OUTPUT_CHUNK);
+  m_mtime = static_cast<std::int64_t>(std::time(nullptr));
+  m_status = EC_Normal;
+  return EC_Normal;
+}
+
+OFCondition TarWriter::addFile(const std::string &name, const char *data,
+                               std::uint64_t size) {
+  std::scoped_lock lock{m_mutex};
+  if (m_file == nullptr)
+    return {0, 0, OF_error, "tar stream is not open"};
+  if (m_status.bad())
+    return m_status;
+
+  // names over the ustar limit are carried in a pax extended header
+  OFCondition cond{};
+  if (name.size() > 100) {
+    const std::string record = paxPathRecord(name);
+    cond = this->writeHeader("././@PaxHeader", record.size(), 'x');
+    if (cond.good())
+      cond = this->write(record.data(), record.size());
+    if (cond.good()) {
+      const std::array<char, TAR_BLOCK> zeros{};
+      cond = this->write(zeros.data(),
+                         (TAR_BLOCK - record.size() % TAR_BLOCK) % TAR_BLOCK);
+    }
+  }
+  if (cond.good())
+    cond = this->writeHeader(name.substr(0, 100), size, '0');
+  if (cond.good())
+    cond = this->write(data, static_cast<std::size_t>(size));
+  if (cond.good()) {
+    const std::array<char, TAR_BLOCK> zeros{};
+    cond =
+        this->write(zeros.data(), (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+  }
+  // a partly written member leaves the stream unusable
+  if (cond.bad())
+    m_status = cond;
+  return cond;
+}
+
+OFCondition TarWriter::close() {
+  std::scoped_lock lock{m_mutex};
+  if (m_file == nullptr)
+    return EC_Normal;
+
+  OFCondition cond = m_status;
+  if (cond.good()) {
+    const std::array<char, 2 * TAR_BLOCK> zeros{};
+    cond = this->write(zeros.data(), zeros.size());
+  }
+  if (cond.good() && m_compressor)
+    cond = m_compressor->write(m_file, nullptr, 0, true);
+  if (std::fflush(m_file) != 0 && cond.good())
+    cond = {0, 0, OF_error, "unable to write tar stream"};
+  std::fclose(m_file);
+  m_file = nullptr;
+  m_compressor.reset();
+  return cond;
+}
+
+OFCondition TarWriter::writeHeader(const std::string &name, std::uint64_t size,
+                                   char type) {
+  std::array<char, TAR_BLOCK> header{};
+  std::memcpy(&header[0], name.data(), std::min<std::size_t>(name.size(), 100));
+  putNumber(&header[100], 8, 0644);
+  putNumber(&header[108], 8, 0);
+  putNumber(&header[116], 8, 0);
+  putNumber(&header[124], 12, size);
+  putNumber(&header[136], 12, static_cast<std::uint64_t>(m_mtime));
+  header[156] = type;
+  std::memcpy(&header[257], "ustar", 6);
+  std::memcpy(&header[263], "00", 2);
+
+  // checksum over the header with the checksum field as spaces
+  std::memset(&header[148], ' ', 8);
+  unsigned int checksum{0};
+  for (const char c : header) {
+    checksum += static_cast<unsigned char>(c);
+  }
+  putNumber(&header[148], 7, checksum);
+  return this->write(header.data(), header.size());
+}
+
+OFCondition TarWriter::write(const char *data, std::size_t size) {
+  if (size == 0)
+    return EC_Normal;
+  if (m_compressor)
+    return m_compressor->write(m_file, data, size, false);
+  if (std::fwrite(data, 1, size, m_file) != size)
+    return {0, 0, OF_error, "unable to write tar stream"};
+  return EC_Normal;
+}
@@ -0,0 +1,162 @@
+#include "ThreadPool.hpp"
+
+namespace {
+// pool and deque index of the calling worker thread
+thread_local const ThreadPool *t_pool{nullptr};
+thread_local std::size_t t_index{0};
+} // namespace
+
+ThreadPool::ThreadPool(unsigned int threads) {
+  if (threads == 0)
+    threads = 1;
+
+  for (unsigned int i = 0; i < threads; ++i) {
+    m_workers.push_back(std::make_unique<Worker>());
+  }
+  for (std::size_t i = 0; i < threads; ++i) {
+    m_threads.emplace_back([this, i]() { this->workerLoop(i); });
+  }
+};
+
+ThreadPool::~ThreadPool() {
+  {
+    std::scoped_lock lock{m_mutex};
+    m_stop = true;
+  }
+  m_work_cv.notify_all();
+  m_wait_cv.notify_all();
+
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+};
+
+void ThreadPool::submit(std::function<void()> task) {
+  if (t_pool == this) {
+    Worker &worker = *m_workers[t_index];
+    {
+      std::scoped_lock lock{worker.mutex};
+      worker.tasks.push_back(std::move(task));
+    }
+    std::scoped_lock lock{m_mutex};
+    ++m_queued;
+  } else {
+    std::scoped_lock lock{m_mutex};
+    m_shared.push_back(std::move(task));
+    ++m_queued;
+  }
+
+  // idle workers take any task, threads blocked in waitUntil only help with
+  // worker deques
+  m_work_cv.notify_one();
+  if (t_pool == this)
+    m_wait_cv.notify_all();
+};
+
+void ThreadPool::notifyAll() {
+  {
+    std::scoped_lock lock{m_mutex};
+  }
+  m_wait_cv.notify_all();
+};
+
+void ThreadPool::waitUntil(const std::function<bool()> &done) {
+  const bool is_worker = t_pool == this;
+
+  while (!done()) {
+    if (is_worker && this->runOne(false))
+      continue;
+
+    std::unique_lock lock{m_mutex};
+    m_wait_cv.wait(lock, [&]() {
+      return done() || m_stop || (is_worker && m_queued > m_shared.size());
+    });
+  }
+};
+
+void ThreadPool::workerLoop(std::size_t index) {
+  t_pool = this;
+  t_index = index;
+
+  while (true) {
+    if (this->runOne(true))
+      continue;
+
+    std::unique_lock lock{m_mutex};
+    m_work_cv.wait(lock, [&]() { return m_stop || m_queued > 0; });
+    if (m_stop && m_queued == 0)
+      return;
+  }
+};
+
+bool ThreadPool::runOne(bool use_shared) {
+  std::function<void()> task{};
+  if (this->popLocal(t_index, task) || this->steal(t_index, task) ||
+      (use_shared && this->popShared(task))) {
+    task();
+    return true;
+  }
+  return false;
+};
+
+void ThreadPool::taken() {
+  std::scoped_lock lock{m_mutex};
+  --m_queued;
+};
+
+bool ThreadPool::popLocal(std::size_t index, std::function<void()> &task) {
+  Worker &worker = *m_workers[index];
+  {
+    std::scoped_lock lock{worker.mutex};
+    if (worker.tasks.empty())
+      return false;
+
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+  }
+  this->taken();
+  return true;
+};
+
+bool ThreadPool::steal(std::size_t thief, std::function<void()> &task) {
+  for (std::size_t i = 1; i < m_workers.size(); ++i) {
+    Worker &victim = *m_workers[(thief + i) % m_workers.size()];
+    {
+      std::scoped_lock lock{victim.mutex};
+      if (victim.tasks.empty())
+        continue;
+
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+    }
+    this->taken();
+    return true;
+  }
+  return false;
+};
+
+bool ThreadPool::popShared(std::function<void()> &task) {
+  std::scoped_lock lock{m_mutex};
+  if (m_shared.empty())
+    return false;
+
+  task = std::move(m_shared.front());
+  m_shared.pop_front();
+  --m_queued;
+  return true;
+};
+
+void TaskGroup::run(std::function<void()> task) {
+  ++m_pending;
+  m_pool.submit([this, &pool = m_pool, task = std::move(task)]() {
+    task();
+    // the group may be destroyed as soon as m_pending drops to zero
+    if (--m_pending == 0) {
+      pool.notifyAll();
+    }
+  });
+};
+
+void TaskGroup::wait() {
+  m_pool.waitUntil([this]() { return m_pending == 0; });
+};
@@ -0,0 +1,83 @@
+#include "Transcoder.hpp"
+
+#include "dcmtk/dcmdata/dcrledrg.h"
+#include "dcmtk/dcmdata/dcrleerg.h"
+#include "dcmtk/dcmjpeg/djdecode.h"
+#include "dcmtk/dcmjpeg/djencode.h"
+#include "dcmtk/dcmjpls/djdecode.h"
+#include "dcmtk/dcmjpls/djencode.h"
+
+#include "fmt/format.h"
+
+bool parseOutputXfer(const std::string &value, E_TransferSyntax &xfer) {
+  if (value == "deflated")
+    xfer = EXS_DeflatedLittleEndianExplicit;
+  else if (value == "jpeg-ls")
+    xfer = EXS_JPEGLSLossless;
+  else if (value == "rle")
+    xfer = EXS_RLELossless;
+  else if (value == "jpeg-lossless")
+    xfer = EXS_JPEGProcess14SV1;
+  else
+    return false;
+  return true;
+};
+
+CodecRegistration::CodecRegistration() {
+  DJLSEncoderRegistration::registerCodecs();
+  DJLSDecoderRegistration::registerCodecs();
+  DJEncoderRegistration::registerCodecs();
+  DJDecoderRegistration::registerCodecs();
+  DcmRLEEncoderRegistration::registerCodecs();
+  DcmRLEDecoderRegistration::registerCodecs();
+};
+
+CodecRegistration::~CodecRegistration() {
+  DJLSEncoderRegistration::cleanup();
+  DJLSDecoderRegistration::cleanup();
+  DJEncoderRegistration::cleanup();
+  DJDecoderRegistration::cleanup();
+  DcmRLEEncoderRegistration::cleanup();
+  DcmRLEDecoderRegistration::cleanup();
+};
+
+bool encodePixelData(DcmDataset *dataset, E_TransferSyntax xfer) {
+  const E_TransferSyntax current = dataset->getCurrentXfer();
+  if (dataset->chooseRepresentation(xfer, nullptr).good() &&
+      dataset->canWriteXfer(xfer, current))
+    return true;
+
+  // e.g. bit depth or photometric interpretation not supported by the codec
+  dataset->chooseRepresentation(current, nullptr);
+  return false;
+};
+
+void TranscodeStats::add(std::uint64_t input_bytes, std::uint64_t output_bytes,
+                         std::chrono::steady_clock::duration encode_time) {
+  ++m_files;
+  m_input_bytes += input_bytes;
+  m_output_bytes += output_bytes;
+  m_encode_ns +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(encode_time)
+          .count();
+};
+
+void TranscodeStats::print(E_TransferSyntax xfer) const {
+  const std::uint64_t files = m_files;
+  const double input_mb = static_cast<double>(m_input_bytes) / 1e6;
+  const double output_mb = static_cast<double>(m_output_bytes) / 1e6;
+  const double seconds = static_cast<double>(m_encode_ns) / 1e9;
+
+  fmt::print("transcoded {} files to {}: {:.1f} MB -> {:.1f} MB", files,
+             DcmXfer(xfer).getXferName(), input_mb, output_mb);
+  if (output_mb > 0)
+    fmt::print(" (ratio {:.2f})", input_mb / output_mb);
+  fmt::print(", encode time {:.1f} s", seconds);
+  if (files > 0)
+    fmt::print(" ({:.1f} ms per file)",
+               seconds * 1e3 / static_cast<double>(files));
+  fmt::print("\n");
+  if (m_fallbacks > 0)
+    fmt::print("{} files kept their input transfer syntax\n",
+               m_fallbacks.load());
+};
@@ -0,0 +1,53 @@
+#ifndef ANONYMOUTPUTWRITER_HPP
+#define ANONYMOUTPUTWRITER_HPP
+
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// writes `anonym_output.csv` rows from concurrently anonymized studies in the
+// same order as a serial run; rows finished out of order are held back until
+// every study before them has reported
+class AnonymOutputWriter {
+public:
+  static constexpr const char *HEADER{
+      "PatientID,PatientName,Pseudoname,StudyDate,"
+      "OldStudyInstanceUID,NewStudyInstanceUID\n"};
+  // first column of shard fragments, global study number for merging
+  static constexpr const char *STUDY_NUMBER_COLUMN{"StudyNumber,"};
+
+  AnonymOutputWriter() = default;
+  ~AnonymOutputWriter() = default;
+
+  // `fragment` adds the StudyNumber column, rows then start with it
+  OFCondition open(const std::string &filename, bool fragment = false);
+  // rows are collected in memory instead, see contents()
+  void openInMemory(bool fragment = false);
+  void close();
+  // csv written with openInMemory()
+  std::string contents();
+
+  // row for study at `index` (0-based position in study list)
+  void write(std::size_t index, const std::string &row);
+  // study at `index` failed, no row is written
+  void skip(std::size_t index);
+
+private:
+  void submit(std::size_t index, std::optional<std::string> row);
+  void writeHeader(bool fragment);
+
+  std::mutex m_mutex{};
+  std::ofstream m_file{};
+  std::ostringstream m_buffer{};
+  std::ostream *m_out{&m_file};
+  std::size_t m_next_index{0};
+  std::map<std::size_t, std::optional<std::string>> m_pending{};
+};
+
+#endif // ANONYMOUTPUTWRITER_HPP
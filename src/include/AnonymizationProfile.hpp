@@ -0,0 +1,187 @@
+#ifndef ANONYMIZATIONPROFILE_HPP
+#define ANONYMIZATIONPROFILE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+
+#include "dcmtk/dcmdata/dcdatset.h"
+
+#include "DicomAnonymizer.hpp"
+
+// PS3.15 profile rules as (tag, action) tables; every combination of
+// E_ADDIT_ANONYM_METHODS is merged and sorted by tag at compile time, so a
+// dataset is anonymized in one ordered walk over its elements
+// https://dicom.nema.org/medical/dicom/current/output/chtml/part15/chapter_E.html
+
+enum E_TAG_ACTION : std::uint8_t {
+  T_REMOVE,      // delete element
+  T_EMPTY,       // replace with (or insert) empty value
+  T_PSEUDONAME,  // replace with (or insert) pseudoname
+  T_PATIENT_SEX, // replace with (or insert) "O"
+};
+
+struct TagAction {
+  std::uint16_t group{0};
+  std::uint16_t element{0};
+  E_TAG_ACTION action{T_REMOVE};
+
+  // group << 16 | element, same order as elements in a dataset
+  constexpr std::uint32_t key() const {
+    return static_cast<std::uint32_t>(group) << 16 | element;
+  };
+};
+
+namespace profile {
+// Basic Application Confidentiality Profile
+inline constexpr auto BASIC = std::to_array<TagAction>({
+    {0x0010, 0x0010, T_PSEUDONAME}, // PatientName
+    {0x0010, 0x0020, T_PSEUDONAME}, // PatientID
+    {0x0010, 0x0040, T_PATIENT_SEX}, // PatientSex
+    {0x0010, 0x1040, T_REMOVE}, // PatientAddress
+    {0x0010, 0x21b0, T_REMOVE}, // AdditionalPatientHistory
+    {0x0038, 0x0400, T_REMOVE}, // PatientInstitutionResidence
+    // other institution staff - operator, physicians
+    {0x0008, 0x009c, T_EMPTY}, // ConsultingPhysicianName
+    {0x0008, 0x009d, T_REMOVE}, // ConsultingPhysicianIdentificationSequence
+    {0x0008, 0x1070, T_REMOVE}, // OperatorsName
+    {0x0008, 0x1060, T_REMOVE}, // NameOfPhysiciansReadingStudy
+    {0x0008, 0x1050, T_REMOVE}, // PerformingPhysicianName
+    {0x0008, 0x1052, T_REMOVE}, // PerformingPhysicianIdentificationSequence
+    {0x0008, 0x1048, T_REMOVE}, // PhysiciansOfRecord
+    {0x0008, 0x1049, T_REMOVE}, // PhysiciansOfRecordIdentificationSequence
+    {0x0008, 0x0090, T_REMOVE}, // ReferringPhysicianName
+    {0x0008, 0x0092, T_REMOVE}, // ReferringPhysicianAddress
+    {0x0008, 0x0096, T_REMOVE}, // ReferringPhysicianIdentificationSequence
+    {0x0008, 0x0094, T_REMOVE}, // ReferringPhysicianTelephoneNumbers
+    {0x0032, 0x1032, T_REMOVE}, // RequestingPhysician
+    {0x0040, 0x0006, T_REMOVE}, // ScheduledPerformingPhysicianName
+    // ScheduledPerformingPhysicianIdentificationSequence
+    {0x0040, 0x000b, T_REMOVE},
+});
+
+// removed unless Retain Patient Characteristics Option
+inline constexpr auto PATIENT_CHARAC = std::to_array<TagAction>({
+    {0x0010, 0x2110, T_REMOVE}, // Allergies
+    {0x0010, 0x1010, T_REMOVE}, // PatientAge
+    {0x0010, 0x2203, T_REMOVE}, // PatientSexNeutered
+    {0x0010, 0x1020, T_REMOVE}, // PatientSize
+    {0x0010, 0x1030, T_REMOVE}, // PatientWeight
+    {0x0038, 0x0500, T_REMOVE}, // PatientState
+    {0x0010, 0x21c0, T_REMOVE}, // PregnancyStatus
+    {0x0040, 0x0012, T_REMOVE}, // PreMedication
+    {0x0010, 0x21a0, T_REMOVE}, // SmokingStatus
+    {0x0038, 0x0050, T_REMOVE}, // SpecialNeeds
+});
+
+// cleaned with Retain Patient Characteristics Option, others are kept as is
+inline constexpr auto PATIENT_CHARAC_RETAINED = std::to_array<TagAction>({
+    {0x0010, 0x2110, T_EMPTY}, // Allergies
+    {0x0038, 0x0500, T_EMPTY}, // PatientState
+    {0x0040, 0x0012, T_EMPTY}, // PreMedication
+    {0x0038, 0x0050, T_EMPTY}, // SpecialNeeds
+});
+
+// removed unless Retain Device Identity Option
+inline constexpr auto DEVICE = std::to_array<TagAction>({
+    {0x0050, 0x0020, T_REMOVE}, // DeviceDescription
+    {0x3010, 0x002d, T_REMOVE}, // DeviceLabel
+    {0x0018, 0x1000, T_REMOVE}, // DeviceSerialNumber
+    {0x3010, 0x0043, T_REMOVE}, // ManufacturerDeviceIdentifier
+    {0x0040, 0x0242, T_REMOVE}, // PerformedStationName
+    {0x0040, 0x4028, T_REMOVE}, // PerformedStationNameCodeSequence
+    {0x0040, 0x0010, T_REMOVE}, // ScheduledStationName
+    {0x0040, 0x4025, T_REMOVE}, // ScheduledStationNameCodeSequence
+    {0x3008, 0x0105, T_REMOVE}, // SourceManufacturer
+    {0x3008, 0x0106, T_REMOVE}, // SourceSerialNumber
+    {0x0008, 0x1010, T_REMOVE}, // StationName
+});
+
+// removed unless Retain Institution Identity Option
+inline constexpr auto INSTITUTION = std::to_array<TagAction>({
+    {0x0008, 0x0081, T_REMOVE}, // InstitutionAddress
+    {0x0008, 0x0080, T_REMOVE}, // InstitutionName
+    {0x0008, 0x1040, T_REMOVE}, // InstitutionalDepartmentName
+    {0x0008, 0x1041, T_REMOVE}, // InstitutionalDepartmentTypeCodeSequence
+    {0x0008, 0x0082, T_REMOVE}, // InstitutionCodeSequence
+});
+
+// bits of a profile combination
+inline constexpr unsigned int RETAIN_PATIENT_CHARACTERISTICS{1U << 0};
+inline constexpr unsigned int RETAIN_DEVICE{1U << 1};
+inline constexpr unsigned int RETAIN_INSTITUTION{1U << 2};
+inline constexpr unsigned int COMBINATIONS{8};
+
+inline constexpr std::size_t MAX_ACTIONS =
+    BASIC.size() + PATIENT_CHARAC.size() + DEVICE.size() + INSTITUTION.size();
+} // namespace profile
+
+// merged, tag-sorted rules of one profile combination
+struct ProfileTable {
+  std::array<TagAction, profile::MAX_ACTIONS> actions{};
+  std::size_t size{0};
+
+  constexpr const TagAction *begin() const { return actions.data(); };
+  constexpr const TagAction *end() const { return actions.data() + size; };
+};
+
+constexpr ProfileTable buildProfileTable(unsigned int combination) {
+  ProfileTable table{};
+  const auto append = [&table](const auto &rules) {
+    for (const TagAction &rule : rules) {
+      table.actions[table.size++] = rule;
+    }
+  };
+
+  append(profile::BASIC);
+  if (combination & profile::RETAIN_PATIENT_CHARACTERISTICS) {
+    append(profile::PATIENT_CHARAC_RETAINED);
+  } else {
+    append(profile::PATIENT_CHARAC);
+  }
+  if (!(combination & profile::RETAIN_DEVICE)) {
+    append(profile::DEVICE);
+  }
+  if (!(combination & profile::RETAIN_INSTITUTION)) {
+    append(profile::INSTITUTION);
+  }
+
+  std::sort(table.actions.begin(),
+            table.actions.begin() + static_cast<std::ptrdiff_t>(table.size),
+            [](const TagAction &lhs, const TagAction &rhs) {
+              return lhs.key() < rhs.key();
+            });
+  return table;
+};
+
+inline constexpr std::array<ProfileTable, profile::COMBINATIONS>
+    PROFILE_TABLES{buildProfileTable(0), buildProfileTable(1),
+                   buildProfileTable(2), buildProfileTable(3),
+                   buildProfileTable(4), buildProfileTable(5),
+                   buildProfileTable(6), buildProfileTable(7)};
+
+constexpr bool hasUniqueSortedTags(const ProfileTable &table) {
+  for (std::size_t i = 1; i < table.size; ++i) {
+    if (table.actions[i - 1].key() >= table.actions[i].key())
+      return false;
+  }
+  return true;
+};
+
+static_assert(std::all_of(PROFILE_TABLES.begin(), PROFILE_TABLES.end(),
+                          hasUniqueSortedTags),
+              "profile rules must not contain duplicate tags");
+
+// table for the selected retain options
+const ProfileTable &
+selectProfileTable(const std::set<E_ADDIT_ANONYM_METHODS> &methods);
+
+// apply `table` in one walk over the dataset's top-level elements; returns the
+// number of removed elements
+unsigned long applyProfileTable(DcmDataset *dataset, const ProfileTable &table,
+                                const std::string &pseudoname);
+
+#endif // ANONYMIZATIONPROFILE_HPP
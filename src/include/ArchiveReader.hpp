@@ -0,0 +1,87 @@
+#ifndef ARCHIVEREADER_HPP
+#define ARCHIVEREADER_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+enum E_ARCHIVE_TYPE { A_NONE, A_TAR, A_TAR_GZ, A_ZIP };
+
+// archive type from the file extension: .tar, .tar.gz/.tgz, .zip
+E_ARCHIVE_TYPE archiveType(const std::filesystem::path &path);
+
+// `path` names an archive study: the archive file itself (`folder` empty) or
+// `<archive>/<folder>` for one of its top-level folders
+bool splitArchivePath(const std::filesystem::path &path,
+                      std::filesystem::path &archive, std::string &folder);
+
+struct ArchiveMember {
+  // path inside the archive, '/' separated
+  std::string name{};
+  std::uint64_t size{0};
+};
+
+// sequential reader of regular file members of tar, gzip compressed tar and
+// zip (stored or deflate) archives; member data is inflated into memory, the
+// archive is never extracted to disk
+class ArchiveReader {
+public:
+  ArchiveReader();
+  ~ArchiveReader();
+
+  ArchiveReader(const ArchiveReader &) = delete;
+  ArchiveReader &operator=(const ArchiveReader &) = delete;
+
+  OFCondition open(const std::filesystem::path &path);
+
+  // advance to the next regular file, data of the current member is skipped
+  // if it was not read. false at the end or on error, see status()
+  bool next(ArchiveMember &member);
+  // data of the current member, at most once per member
+  OFCondition read(std::vector<char> &data);
+  OFCondition status() const { return m_status; };
+
+  // top-level folders of the archive, sorted; members outside any folder are
+  // reported as ""
+  static OFCondition listTopLevelFolders(const std::filesystem::path &path,
+                                         std::vector<std::string> &folders);
+
+private:
+  struct Inflater;
+
+  bool nextTar(ArchiveMember &member);
+  bool nextZip(ArchiveMember &member);
+  OFCondition readZip(std::vector<char> &data);
+
+  // tar byte stream, plain file or gzip
+  OFCondition readTarStream(char *buffer, std::uint64_t length);
+  OFCondition skipTarStream(std::uint64_t length);
+
+  E_ARCHIVE_TYPE m_type{A_NONE};
+  std::ifstream m_file{};
+  std::unique_ptr<Inflater> m_gzip{};
+  OFCondition m_status{};
+
+  // tar: bytes of the current member not yet consumed, plus block padding
+  std::uint64_t m_remaining{0};
+  std::uint64_t m_padding{0};
+
+  // zip: central directory entries and position in it
+  struct ZipEntry {
+    std::string name{};
+    std::uint64_t compressed_size{0};
+    std::uint64_t size{0};
+    std::uint64_t local_offset{0};
+    std::uint16_t method{0};
+    std::uint16_t flags{0};
+  };
+  std::vector<ZipEntry> m_zip_entries{};
+  std::size_t m_zip_next{0};
+};
+
+#endif // ARCHIVEREADER_HPP
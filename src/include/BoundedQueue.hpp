@@ -0,0 +1,68 @@
+#ifndef BOUNDEDQUEUE_HPP
+#define BOUNDEDQUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// blocking multi-producer/multi-consumer queue holding at most `capacity`
+// items; producers block while full, consumers block while empty
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(std::size_t capacity)
+      : m_capacity{capacity == 0 ? 1 : capacity} {};
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  // returns false if the queue was closed, `item` is dropped
+  bool push(T item) {
+    std::unique_lock lock{m_mutex};
+    m_not_full.wait(lock, [this]() {
+      return m_closed || m_items.size() < m_capacity;
+    });
+    if (m_closed)
+      return false;
+
+    m_items.push_back(std::move(item));
+    lock.unlock();
+    m_not_empty.notify_one();
+    return true;
+  };
+
+  // empty optional once the queue is closed and drained
+  std::optional<T> pop() {
+    std::unique_lock lock{m_mutex};
+    m_not_empty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+    if (m_items.empty())
+      return std::nullopt;
+
+    std::optional<T> item{std::move(m_items.front())};
+    m_items.pop_front();
+    lock.unlock();
+    m_not_full.notify_one();
+    return item;
+  };
+
+  // wake all waiting threads, queued items can still be popped
+  void close() {
+    {
+      std::scoped_lock lock{m_mutex};
+      m_closed = true;
+    }
+    m_not_full.notify_all();
+    m_not_empty.notify_all();
+  };
+
+private:
+  const std::size_t m_capacity;
+  std::mutex m_mutex{};
+  std::condition_variable m_not_full{};
+  std::condition_variable m_not_empty{};
+  std::deque<T> m_items{};
+  bool m_closed{false};
+};
+
+#endif // BOUNDEDQUEUE_HPP
@@ -0,0 +1,65 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "dcmtk/dcmdata/dcostrmf.h"
+
+#include "Sha256.hpp"
+
+enum E_CHECKSUM_TYPE { CS_NONE, CS_CRC32C, CS_SHA256 };
+
+// `crc32c` or `sha256` (CRC-32C and SHA-256), false for anything else
+bool parseChecksumType(const std::string &value, E_CHECKSUM_TYPE &type);
+
+// CRC-32C (Castagnoli) of `data` continuing `crc`, 0 to start; SSE4.2 or
+// ARMv8 CRC instructions where the CPU has them, slicing-by-8 otherwise
+std::uint32_t crc32c(std::uint32_t crc, const void *data, std::size_t length);
+
+// checksums of a file, fed its bytes in order while it is written or read
+class FileChecksum {
+public:
+  // CRC-32C always, SHA-256 on top if requested
+  explicit FileChecksum(bool sha256);
+
+  void update(const void *data, std::size_t length);
+
+  std::uint64_t size() const { return m_size; };
+  std::uint32_t crc32c() const { return m_crc; };
+  // hex digest of everything so far, empty without SHA-256; ends the hash
+  std::string sha256();
+
+private:
+  std::uint64_t m_size{0};
+  std::uint32_t m_crc{0};
+  std::optional<Sha256> m_sha256{};
+};
+
+// file output stream for DcmFileFormat::write() checksumming the bytes on
+// their way to the file, so the written file is never read back
+class ChecksumFileStream : public DcmOutputStream {
+public:
+  ChecksumFileStream(const std::string &path, FileChecksum &checksum)
+      : DcmOutputStream{&m_consumer}, m_consumer{path, checksum} {};
+
+private:
+  class Consumer : public DcmFileConsumer {
+  public:
+    Consumer(const std::string &path, FileChecksum &checksum)
+        : DcmFileConsumer{OFFilename{path.c_str()}}, m_checksum{checksum} {};
+
+    offile_off_t write(const void *buf, offile_off_t buflen) override;
+
+  private:
+    FileChecksum &m_checksum;
+  };
+
+  // constructed after the base class stores its address, as in
+  // DcmOutputFileStream
+  Consumer m_consumer;
+};
+
+#endif // CHECKSUM_HPP
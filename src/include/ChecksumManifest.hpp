@@ -0,0 +1,90 @@
+#ifndef CHECKSUMMANIFEST_HPP
+#define CHECKSUMMANIFEST_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "ThreadPool.hpp"
+
+// exit code of `check` when output files do not match their manifests
+constexpr int EXITCODE_CHECKSUM_MISMATCH{81};
+
+// checksums of a written file, computed while it was written
+struct ChecksumEntry {
+  // relative to the study directory, e.g. `DICOM/0000002A`
+  std::string file{};
+  std::uint64_t size{0};
+  std::uint32_t crc32c{0};
+  std::string sha256{}; // hex, empty unless requested
+  std::string old_sop_uid{};
+  std::string new_sop_uid{};
+};
+
+// `checksums.csv` of a study directory, one row per written file
+class ChecksumManifest {
+public:
+  static constexpr const char *FILENAME{"checksums.csv"};
+
+  // keep the rows of an existing manifest whose files still exist below
+  // `study_directory`, for studies extended by a later run; missing manifest
+  // = no rows
+  OFCondition load(const std::filesystem::path &study_directory);
+  // rows of `path`, fails on a missing or malformed manifest
+  static OFCondition read(const std::filesystem::path &path,
+                          std::vector<ChecksumEntry> &entries);
+
+  // replaces an earlier row of the same file
+  void add(ChecksumEntry entry);
+  void clear();
+  bool empty() const;
+
+  // csv text with header, rows sorted by file
+  std::string format() const;
+  // write to a temporary file and replace `<study_directory>/checksums.csv`
+  OFCondition save(const std::filesystem::path &study_directory) const;
+
+private:
+  mutable std::mutex m_mutex{};
+  std::map<std::string, ChecksumEntry> m_entries{}; // map[file, entry]
+};
+
+// file of an output tree not matching its manifest
+struct ChecksumProblem {
+  std::string path{};
+  std::string problem{};
+};
+
+// re-checksums the files of all study directories below an output directory
+// against their `checksums.csv`, files are read as pool tasks from a
+// read-only memory mapping; files in a DICOM folder without a row are
+// reported too
+class OutputChecker {
+public:
+  OFCondition check(const std::filesystem::path &directory, ThreadPool &pool);
+
+  // sorted by path
+  const std::vector<ChecksumProblem> &problems() const { return m_problems; };
+  std::uint64_t studyCount() const { return m_studies; };
+  std::uint64_t fileCount() const { return m_files; };
+  std::uint64_t byteCount() const { return m_bytes; };
+
+private:
+  void checkFile(const std::filesystem::path &study,
+                 const ChecksumEntry &entry);
+  void addProblem(std::string path, std::string problem);
+
+  std::mutex m_mutex{};
+  std::vector<ChecksumProblem> m_problems{};
+  std::uint64_t m_studies{0};
+  std::atomic<std::uint64_t> m_files{0};
+  std::atomic<std::uint64_t> m_bytes{0};
+};
+
+#endif // CHECKSUMMANIFEST_HPP
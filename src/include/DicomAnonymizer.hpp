@@ -5,7 +5,12 @@
 #ifndef DICOMANONYMIZER_HPP
 #define DICOMANONYMIZER_HPP
 
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
 #include <string>
 #include <string_view>
@@ -16,6 +21,18 @@
 #include "dcmtk/dcmdata/dcfilefo.h"
 #include "dcmtk/ofstd/ofcond.h"
 
+#include "Checksum.hpp"
+#include "ChecksumManifest.hpp"
+#include "Journal.hpp"
+#include "DicomSniffer.hpp"
+#include "MappingStore.hpp"
+#include "MemoryBudget.hpp"
+#include "PhaseTimer.hpp"
+#include "PseudonymIndex.hpp"
+#include "TarWriter.hpp"
+#include "ThreadPool.hpp"
+#include "Transcoder.hpp"
+
 extern OFLogger mainLogger;
 
 void setupLogger(std::string_view logger_name);
@@ -31,43 +48,198 @@ enum E_ADDIT_ANONYM_METHODS {
 
 enum E_PSEUDONAME_TYPE { P_RANDOM_STRING, P_INTEGER_ORDER, P_FROM_FILE };
 
+// configuration shared by all study anonymizers, read-only once anonymization
+// starts
+struct AnonymizerConfig {
+  std::string pseudoname_prefix{};
+  E_PSEUDONAME_TYPE pseudoname_type{P_RANDOM_STRING};
+  E_FILENAMES filename_type{F_HEX};
+  unsigned short count_width{2};
+  std::set<E_ADDIT_ANONYM_METHODS> methods{};
+  std::string uid_root{};
+  // key of deterministic UIDs, empty = random UIDs
+  std::string uid_secret{};
+  std::string output_directory{};
+  // copy unchanged PixelData bytes from input instead of re-encoding them
+  bool pixel_passthrough{false};
+  // shared limit on bytes of files loaded at once, nullptr = unlimited
+  MemoryBudget *memory_budget{nullptr};
+  // persistent pseudoname and UID mappings, nullptr = per run only
+  MappingStore *mapping_store{nullptr};
+  // checkpoint log of the run, nullptr = no checkpoints
+  Journal *journal{nullptr};
+  // stream of output files instead of a tree below `output_directory`
+  TarWriter *tar_writer{nullptr};
+  // transfer syntax of written files, EXS_Unknown = same as input
+  E_TransferSyntax output_xfer{EXS_Unknown};
+  // compression ratio and encode time of transcoded files
+  TranscodeStats *transcode_stats{nullptr};
+  // pairs of --pseudoname-file, nullptr unless P_FROM_FILE
+  const PseudonymIndex *pseudonyms{nullptr};
+  // checksums of written files go into a manifest per study
+  E_CHECKSUM_TYPE checksum_type{CS_NONE};
+
+  // new UID under `uid_root` replacing `old_uid`, derived from
+  // HMAC-SHA-256(uid_secret, old_uid) if a secret is set, random otherwise
+  std::string newUid(const std::string &old_uid) const;
+  // newUid() remembered in the mapping store if there is one
+  std::string mapUid(E_MAPPING_KIND kind, const std::string &old_uid) const;
+  // referenced UIDs can only be remapped consistently with keyed or stored
+  // UIDs
+  bool remapsReferences() const {
+    return mapping_store != nullptr || !uid_secret.empty();
+  };
+  // output directory of a study relative to `output_directory`; with a
+  // mapping store all studies of a patient share the pseudoname, so each
+  // gets `<pseudoname>/<new StudyInstanceUID>` instead of `<pseudoname>`
+  std::string studyPath(const std::string &pseudoname,
+                        const std::string &new_study_uid) const;
+};
+
+// shortest digit count under a root accepted for keyed UIDs
+constexpr std::size_t MIN_KEYED_UID_DIGITS{20};
+
+// `root`.<decimal digits of HMAC-SHA-256(secret, old_uid)>, truncated to the
+// 64 character UID limit
+std::string deriveUid(std::string_view secret, std::string_view root,
+                      std::string_view old_uid);
+
+// identifying attributes read from the header of a dicom file, parsing stops
+// before PixelData
+struct DicomHeader {
+  std::string patient_id{};
+  std::string patient_name{};
+  std::string study_uid{};
+  std::string study_date{};
+  std::string series_uid{};
+  std::string sop_uid{};
+};
+
+OFCondition readDicomHeader(const std::string &path, DicomHeader &header);
+// same for file contents in memory, `name` is used in log messages
+OFCondition readDicomHeader(const std::vector<char> &data,
+                            const std::string &name, DicomHeader &header);
+// same for a dataset already parsed, e.g. received over the network
+void copyHeader(DcmDataset *dataset, DicomHeader &header);
+
+// parse file contents held in memory like loadFileUntilTag()
+OFCondition readFromBuffer(DcmFileFormat &fileformat,
+                           const std::vector<char> &data,
+                           const DcmTagKey &stop_tag = DCM_UndefinedTagKey);
+// serialize `fileformat` like saveFile() does, for streamed output
+OFCondition writeToBuffer(DcmFileFormat &fileformat, E_TransferSyntax xfer,
+                          std::vector<char> &buffer);
+
+struct DicomInputFile {
+  std::string path{};
+  std::uintmax_t size{0};
+  // hex filename of the output, position in the sorted file list unless an
+  // incremental run keeps earlier numbering
+  unsigned int output_index{0};
+  // contents of an archive member, loaded instead of `path`
+  std::shared_ptr<const std::vector<char>> data{};
+};
+
+// pseudoname and UIDs assigned to a study by an earlier run
+struct StudyIdentity {
+  std::string pseudoname{};
+  std::string new_study_uid{};
+  std::unordered_map<std::string, std::string> series_uids{};
+};
+
+// files of one study, collected before anonymization so studies can be
+// scheduled by size
+struct StudyInput {
+  std::filesystem::path source{};
+  std::vector<DicomInputFile> files{};
+  std::uintmax_t total_bytes{0};
+  // 1-based position of the study in the sorted study list, used for
+  // P_INTEGER_ORDER pseudonames
+  unsigned int study_number{0};
+  // header of files[0] from the prescan, reused by setBasicTags
+  std::optional<DicomHeader> header{};
+  // reused instead of assigning a new identity
+  std::optional<StudyIdentity> identity{};
+  // files below `source` that are not DICOM
+  std::vector<RejectedFile> rejected{};
+  // set for studies read from an archive, `files` stays empty and members are
+  // streamed during anonymization; members below `archive_folder` only if set
+  std::filesystem::path archive{};
+  std::string archive_folder{};
+};
+
+// list files of a study directory in parallel on `pool`, sizes are only read
+// with `with_sizes`; files failing sniffDicomFile go to `study.rejected`.
+// a study is only anonymized once it is listed completely: hex filenames,
+// incremental runs and the journal rely on the sorted file list, so
+// streaming (--stream-studies) overlaps listing with work per study
+OFCondition findDicomFiles(const std::filesystem::path &study_directory,
+                           StudyInput &study, ThreadPool &pool,
+                           bool with_sizes = true);
+
+// set up `study` for the members of `archive` below top-level folder `folder`
+// (all members if empty) and prescan the header of the first DICOM member
+OFCondition findArchiveStudy(const std::filesystem::path &archive,
+                             const std::string &folder, StudyInput &study);
+
+class FilePipeline;
+struct ProfileTable;
+
+// per-study state, files of the study are anonymized concurrently
 class StudyAnonymizer {
 public:
-  StudyAnonymizer() = default;
-  StudyAnonymizer(const std::string &pseudoname_prefix,
-                  E_PSEUDONAME_TYPE pseudoname_type = P_RANDOM_STRING,
-                  E_FILENAMES filename_type = F_HEX)
-      : m_pseudoname_prefix{pseudoname_prefix},
-        m_pseudoname_type{pseudoname_type}, m_filename_type{filename_type} {};
+  explicit StudyAnonymizer(const AnonymizerConfig &config);
 
   ~StudyAnonymizer() = default;
 
-  OFCondition findDicomFiles(const std::filesystem::path &study_directory);
-
-  OFCondition anonymizeStudy(const std::filesystem::path &study_directory,
-                             const std::string &output_directory,
-                             const std::set<E_ADDIT_ANONYM_METHODS> &methods,
-                             const std::string &uid_root);
-  void anonymizeBasicProfile();
-  void anonymizePatientCharacteristicsProfile();
-  void anonymizeInstitutionProfile();
-  void anonymizeDeviceProfile();
-  void setPseudoname();
+  // files run as `pool` tasks, or through the staged `pipeline` if given
+  OFCondition anonymizeStudy(const StudyInput &study, ThreadPool &pool,
+                             FilePipeline *pipeline = nullptr);
+  // assign pseudoname and new StudyInstanceUID and create the output
+  // directory; files are anonymized afterwards
+  OFCondition beginStudy(const StudyInput &study);
+  OFCondition anonymizeFile(const DicomInputFile &file,
+                            unsigned int file_index);
+  OFCondition loadDicomFile(const DicomInputFile &file,
+                            DcmFileFormat &fileformat) const;
+  // block until `file` fits into the memory budget, empty if unlimited
+  MemoryBudget::Reservation reserveMemory(const DicomInputFile &file) const;
+  OFCondition anonymizeDataset(DcmDataset *dataset,
+                               const DicomInputFile &file);
+  void setPseudoname(unsigned int study_number);
 
   std::string getSeriesUids(const std::string &old_series_uid,
                             const char *root = nullptr);
 
-  OFCondition readPseudonamesFromFile(const std::string &filename);
-  OFCondition removeInvalidTags() const;
-  OFCondition setBasicTags();
-  OFCondition writeDicomFile();
+  // remove elements unknown to the data dictionary, `removed` is set to their
+  // count
+  static OFCondition removeInvalidTags(DcmDataset *dataset,
+                                       unsigned long &removed);
+  OFCondition setBasicTags(const StudyInput &study);
+  OFCondition writeDicomFile(DcmFileFormat &fileformat,
+                             const DicomInputFile &file,
+                             unsigned int file_index);
   OFCondition writeTags() const;
+  // `checksums.csv` of the files written for the study, nothing without
+  // `checksum_type`
+  OFCondition writeChecksums();
+  // with a journal, sync the directories of the study's output up to the
+  // output directory, its files are synced as they are written
+  OFCondition syncOutput() const;
+  // replace UIDs of other instances, series and studies referenced in
+  // sequences of `item`
+  void remapReferencedUids(DcmItem *item) const;
 
-  E_FILENAMES m_filename_type{F_HEX};
-  E_PSEUDONAME_TYPE m_pseudoname_type{P_RANDOM_STRING};
-  unsigned int m_study_count{1};
-  unsigned short m_count_width{2};
-  std::string m_pseudoname_prefix{};
+  // formatted `anonym_output.csv` row of last anonymized study
+  std::string csvRow() const;
+  std::unordered_map<std::string, std::string> seriesUids();
+  // [input path, output path] of files written for the last study
+  std::vector<std::pair<std::string, std::string>> writtenFiles();
+  // archive members of the last study that are not DICOM
+  const std::vector<RejectedFile> &rejectedFiles() const {
+    return m_rejected;
+  };
+  void logStudySummary() const;
 
   std::string m_pseudoname{};
   std::string m_old_name{};
@@ -75,16 +247,38 @@ public:
   std::string m_old_studyuid{};
   std::string m_new_studyuid{};
   std::string m_study_date{};
+  // studyPath() of the study, prefix of tar members
+  std::string m_study_path{};
   std::string m_output_study_dir{};
 
 private:
-  unsigned int m_files_processed{0};
-  std::vector<std::string> m_dicom_files{};
+  std::string makePseudoname(unsigned int study_number) const;
+  // inflate members one at a time and anonymize them as pool tasks while the
+  // next member is inflated
+  OFCondition anonymizeArchive(const StudyInput &study, ThreadPool &pool);
+  // manifest row of a file written to `file` below the study directory,
+  // nothing without `checksum`
+  void addChecksum(std::optional<FileChecksum> &checksum, DcmDataset *dataset,
+                   const std::string &file);
+
+  const AnonymizerConfig &m_config;
+  const ProfileTable &m_profile;
+  // journal key of the current study
+  std::string m_study_key{};
+  std::atomic<unsigned long> m_invalid_tags_removed{0};
+  std::mutex m_series_mutex{};
   std::unordered_map<std::string, std::string>
       m_series_uids{}; // unordered_map[old_uid, new_uid]
-  std::unordered_map<std::string, std::string> m_id_pseudoname_map{};
-  DcmFileFormat m_fileformat;
-  DcmDataset *m_dataset{nullptr};
+  std::mutex m_written_mutex{};
+  std::vector<std::pair<std::string, std::string>> m_written_files{};
+  // old SOPInstanceUIDs of anonymized instances not written yet, only
+  // collected with `checksum_type`
+  std::unordered_map<std::string, std::string>
+      m_old_sop_uids{}; // unordered_map[new_uid, old_uid]
+  ChecksumManifest m_checksums{};
+  // durations of the phases of the current study's files
+  mutable PhaseTimes m_phase_times{};
+  std::vector<RejectedFile> m_rejected{};
 };
 
 #endif // DICOMANONYMIZER_HPP
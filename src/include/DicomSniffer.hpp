@@ -0,0 +1,34 @@
+#ifndef DICOMSNIFFER_HPP
+#define DICOMSNIFFER_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// input file left out of anonymization
+struct RejectedFile {
+  std::string path{};
+  std::string reason{};
+};
+
+// classify `path` from its first 132 bytes: preamble + "DICM", or for files
+// without preamble a plausible first data element of group 0002/0008 in
+// little endian implicit or explicit VR. `reason` is set for rejected files
+bool sniffDicomFile(const std::string &path, std::string &reason);
+// same for file contents already in memory, e.g. archive members
+bool sniffDicomBuffer(const char *data, std::size_t length,
+                      std::string &reason);
+
+// `path,reason` rows of all rejected files
+OFCondition writeRejectedReport(const std::string &filename,
+                                const std::vector<RejectedFile> &rejected);
+void writeRejectedReport(std::ostream &report,
+                         const std::vector<RejectedFile> &rejected);
+// the rows only, appended to a report as files are rejected
+void writeRejectedRows(std::ostream &report,
+                       const std::vector<RejectedFile> &rejected);
+
+#endif // DICOMSNIFFER_HPP
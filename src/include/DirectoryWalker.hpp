@@ -0,0 +1,38 @@
+#ifndef DIRECTORYWALKER_HPP
+#define DIRECTORYWALKER_HPP
+
+#include <filesystem>
+#include <functional>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "DicomAnonymizer.hpp"
+#include "ThreadPool.hpp"
+
+// recursive listing of regular files below a directory; every subdirectory
+// is read as its own pool task, so listing scales with threads on high
+// latency network filesystems. on Linux directories are read with batched
+// getdents64 and entry types come from d_type, stat is only needed for
+// sizes (`with_sizes`) and filesystems not reporting d_type
+class DirectoryWalker {
+public:
+  // called concurrently from pool threads for every regular file
+  using FileCallback = std::function<void(DicomInputFile &&file)>;
+
+  DirectoryWalker(ThreadPool &pool, bool with_sizes)
+      : m_pool{pool}, m_with_sizes{with_sizes} {};
+
+  // returns after all files below `root` were reported; unreadable
+  // subdirectories are logged and skipped
+  OFCondition walk(const std::filesystem::path &root,
+                   const FileCallback &on_file);
+
+private:
+  void readDirectory(const std::string &directory, TaskGroup &group,
+                     const FileCallback &on_file);
+
+  ThreadPool &m_pool;
+  const bool m_with_sizes;
+};
+
+#endif // DIRECTORYWALKER_HPP
@@ -0,0 +1,76 @@
+#ifndef FILEPIPELINE_HPP
+#define FILEPIPELINE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "BoundedQueue.hpp"
+#include "DicomAnonymizer.hpp"
+#include "MemoryBudget.hpp"
+
+struct PipelineConfig {
+  unsigned int read_threads{2};
+  unsigned int transform_threads{2};
+  unsigned int write_threads{2};
+  std::size_t read_queue_depth{16};  // parsed files waiting for transform
+  std::size_t write_queue_depth{16}; // anonymized files waiting for write
+  // load all element values in the read stage, off for pixel passthrough
+  bool load_all_data{true};
+};
+
+// staged read -> transform -> write pipeline shared by all studies of a run;
+// each stage has its own threads so disk reads, tag processing and disk
+// writes of different files overlap
+class FilePipeline {
+public:
+  explicit FilePipeline(const PipelineConfig &config);
+  ~FilePipeline();
+
+  FilePipeline(const FilePipeline &) = delete;
+  FilePipeline &operator=(const FilePipeline &) = delete;
+
+  // queue all files of `study` and block until they are written; the first
+  // failing file fails the study and its remaining files are skipped
+  OFCondition processStudy(StudyAnonymizer &anonymizer,
+                           const StudyInput &study);
+
+private:
+  struct StudyJob {
+    StudyAnonymizer &anonymizer;
+    std::size_t remaining{0};
+    std::atomic<bool> failed{false};
+    OFCondition first_error{};
+    std::mutex mutex{};
+    std::condition_variable done{};
+  };
+
+  struct Item {
+    StudyJob *job{nullptr};
+    const DicomInputFile *file{nullptr};
+    unsigned int index{0};
+    std::unique_ptr<DcmFileFormat> fileformat{};
+    MemoryBudget::Reservation reservation{};
+  };
+
+  void readStage();
+  void transformStage();
+  void writeStage();
+  static void finish(Item &item, const OFCondition &cond);
+
+  const bool m_load_all_data;
+  BoundedQueue<Item> m_input;
+  BoundedQueue<Item> m_loaded;
+  BoundedQueue<Item> m_transformed;
+  std::vector<std::thread> m_readers{};
+  std::vector<std::thread> m_transformers{};
+  std::vector<std::thread> m_writers{};
+};
+
+#endif // FILEPIPELINE_HPP
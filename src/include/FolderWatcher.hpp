@@ -0,0 +1,79 @@
+#ifndef FOLDERWATCHER_HPP
+#define FOLDERWATCHER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// reports study folders and archives landing in `root` once nothing below
+// them changed for the quiet period; changes are taken from inotify on Linux
+// and from periodic snapshots elsewhere. Every entry is reported once
+class FolderWatcher {
+public:
+  FolderWatcher(const std::filesystem::path &root,
+                std::chrono::seconds quiet_period);
+  ~FolderWatcher();
+
+  FolderWatcher(const FolderWatcher &) = delete;
+  FolderWatcher &operator=(const FolderWatcher &) = delete;
+
+  // start watching, entries already in `root` count as changed right now
+  OFCondition open();
+  // block until entries became quiet and set `ready` to their paths; false
+  // once SIGINT/SIGTERM was received
+  bool wait(std::vector<std::filesystem::path> &ready);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // top-level entry `name` changed
+  void touch(const std::string &name);
+  // start tracking top-level entry `name` if it is a folder or archive
+  void addEntry(const std::string &name);
+  void removeEntry(const std::string &name);
+  // wait up to `timeout` for changes and record them
+  void poll(Clock::duration timeout);
+
+#ifdef __linux__
+  struct Watch {
+    std::string entry{};
+    std::filesystem::path directory{};
+  };
+  // watch `directory` and all folders below it for changes of `entry`
+  void addWatches(const std::filesystem::path &directory,
+                  const std::string &entry);
+  void readEvents();
+
+  int m_fd{-1};
+  int m_root_wd{-1};
+  std::unordered_map<int, Watch> m_watches{}; // unordered_map[wd, watch]
+#else
+  // file count, bytes and newest modification time below an entry
+  struct Snapshot {
+    std::uint64_t files{0};
+    std::uint64_t bytes{0};
+    std::filesystem::file_time_type newest{};
+
+    bool operator==(const Snapshot &) const = default;
+  };
+  Snapshot snapshot(const std::string &name) const;
+
+  std::map<std::string, Snapshot> m_snapshots{};
+  Clock::time_point m_next_scan{};
+#endif
+
+  const std::filesystem::path m_root;
+  const std::chrono::seconds m_quiet_period;
+  // last change of entries not reported yet
+  std::map<std::string, Clock::time_point> m_pending{};
+  // reported entries, true once a later change was logged
+  std::map<std::string, bool> m_reported{};
+};
+
+#endif // FOLDERWATCHER_HPP
@@ -0,0 +1,71 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// tab separated record line, tabs, newlines and backslashes in fields are
+// escaped
+std::string joinRecord(const std::vector<std::string> &fields);
+std::vector<std::string> splitRecord(const std::string &line);
+
+// flush a written file, or the entries of a directory, to stable storage;
+// directories are skipped on Windows, which cannot open them for flushing
+OFCondition syncPath(const std::string &path, bool directory);
+
+// state of one study recorded by an earlier run
+struct JournalStudy {
+  std::string pseudoname{};
+  std::string new_study_uid{};
+  // output files written so far
+  std::vector<std::string> files{};
+  // `anonym_output.csv` row once the study completed
+  std::optional<std::string> csv_row{};
+};
+
+// append-only checkpoint log of a run in the output directory, one record
+// per line:
+//   BEGIN <study> <pseudoname> <new study uid>
+//   FILE  <study> <output path>
+//   DONE  <study> <csv row>
+// BEGIN and DONE are fsync'd, FILE records are flushed to the OS only; the
+// files of a study are synced before its DONE record, so a study skipped by
+// --resume survives a power loss as well
+class Journal {
+public:
+  static constexpr const char *FILENAME{".fnodcmanon.journal"};
+
+  Journal() = default;
+  ~Journal();
+
+  Journal(const Journal &) = delete;
+  Journal &operator=(const Journal &) = delete;
+
+  // start a new journal, or with `resume` load and continue an existing one
+  OFCondition open(const std::string &path, bool resume);
+  OFCondition close();
+
+  // state from earlier runs, nullptr if the study was never started
+  const JournalStudy *previous(const std::string &study) const;
+
+  OFCondition begin(const std::string &study, const std::string &pseudoname,
+                    const std::string &new_study_uid);
+  OFCondition file(const std::string &study, const std::string &path);
+  OFCondition done(const std::string &study, const std::string &csv_row);
+
+private:
+  OFCondition load(const std::string &path);
+  OFCondition append(const std::vector<std::string> &fields, bool sync);
+
+  std::mutex m_mutex{};
+  std::FILE *m_file{nullptr};
+  std::unordered_map<std::string, JournalStudy> m_previous{};
+};
+
+#endif // JOURNAL_HPP
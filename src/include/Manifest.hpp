@@ -0,0 +1,62 @@
+#ifndef MANIFEST_HPP
+#define MANIFEST_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// identifies an unchanged input file between runs
+struct FileFingerprint {
+  std::uintmax_t size{0};
+  std::int64_t mtime{0};
+  // hex content hash, empty unless requested
+  std::string hash{};
+
+  bool operator==(const FileFingerprint &other) const = default;
+};
+
+OFCondition fingerprintFile(const std::string &path, bool content_hash,
+                            FileFingerprint &fingerprint);
+
+struct ManifestFile {
+  FileFingerprint fingerprint{};
+  std::string output_path{};
+  unsigned int output_index{0};
+};
+
+// everything needed to add instances to an anonymized study later
+struct ManifestStudy {
+  std::string pseudoname{};
+  std::string new_study_uid{};
+  std::string csv_row{};
+  // next free hex filename index
+  unsigned int next_index{0};
+  std::unordered_map<std::string, std::string> series_uids{};
+  std::map<std::string, ManifestFile> files{}; // map[input path, file]
+};
+
+// input fingerprints and assigned identities of all studies anonymized into
+// an output directory, rewritten as a whole at the end of every run
+class Manifest {
+public:
+  static constexpr const char *FILENAME{".fnodcmanon.manifest"};
+
+  // missing file = empty manifest
+  OFCondition load(const std::string &path);
+  // write to a temporary file and replace `path`
+  OFCondition save(const std::string &path) const;
+
+  // copy of the study state, false if never anonymized
+  bool find(const std::string &study, ManifestStudy &entry) const;
+  void update(const std::string &study, ManifestStudy entry);
+
+private:
+  mutable std::mutex m_mutex{};
+  std::map<std::string, ManifestStudy> m_studies{};
+};
+
+#endif // MANIFEST_HPP
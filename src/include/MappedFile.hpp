@@ -0,0 +1,42 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// read-write shared memory mapping of a whole file, locked against other
+// processes while open; read-only mappings take no lock
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // create `path` if missing and grow it to at least `min_size` bytes
+  OFCondition open(const std::string &path, std::uint64_t min_size);
+  // map existing non-empty `path` for reading only, writes to data() crash
+  OFCondition openReadOnly(const std::string &path);
+  // write dirty pages back to the file
+  OFCondition flush();
+  void close();
+
+  bool isOpen() const { return m_data != nullptr; };
+  std::uint8_t *data() const { return m_data; };
+  std::uint64_t size() const { return m_size; };
+
+private:
+#if defined(_WIN32)
+  void *m_file{nullptr};
+  void *m_mapping{nullptr};
+#else
+  int m_fd{-1};
+#endif
+  std::uint8_t *m_data{nullptr};
+  std::uint64_t m_size{0};
+};
+
+#endif // MAPPEDFILE_HPP
@@ -0,0 +1,68 @@
+#ifndef MAPPINGSTORE_HPP
+#define MAPPINGSTORE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "MappedFile.hpp"
+
+enum E_MAPPING_KIND : std::uint8_t {
+  MK_PATIENT_ID = 1, // PatientID -> pseudoname
+  MK_STUDY_UID,
+  MK_SERIES_UID,
+  MK_SOP_UID
+};
+
+// persistent old -> new value map kept in a memory mapped open addressing
+// hash table, so pseudonames and UIDs stay the same across runs; lookups take
+// a shared lock, inserts an exclusive one
+class MappingStore {
+public:
+  // longest key or value, the DICOM limit of LO and UI values
+  static constexpr std::size_t MAX_LENGTH{64};
+
+  MappingStore() = default;
+  ~MappingStore();
+
+  MappingStore(const MappingStore &) = delete;
+  MappingStore &operator=(const MappingStore &) = delete;
+
+  // open existing store or create an empty one
+  OFCondition open(const std::string &path);
+  OFCondition close();
+
+  std::optional<std::string> find(E_MAPPING_KIND kind,
+                                  std::string_view key) const;
+  // value of `key`, inserting the result of `make` if there is none;
+  // concurrent callers for the same key all get the first inserted value.
+  // keys or values over MAX_LENGTH are returned without being stored
+  std::string getOrInsert(E_MAPPING_KIND kind, std::string_view key,
+                          const std::function<std::string()> &make);
+
+  std::uint64_t size() const;
+
+private:
+  struct Header;
+  struct Slot;
+
+  Header *header() const;
+  Slot *slots() const;
+  // slot holding `key` or the empty slot where it belongs
+  Slot *probe(std::uint64_t hash, E_MAPPING_KIND kind,
+              std::string_view key) const;
+  // rebuild the table with twice the capacity in a new file replacing the
+  // old one
+  OFCondition grow();
+
+  std::string m_path{};
+  MappedFile m_file{};
+  mutable std::shared_mutex m_mutex{};
+};
+
+#endif // MAPPINGSTORE_HPP
@@ -0,0 +1,57 @@
+#ifndef MEMORYBUDGET_HPP
+#define MEMORYBUDGET_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// limits bytes of files loaded at the same time across all workers; a file
+// larger than the whole budget waits for a dedicated slot (one such file at
+// a time) instead of blocking forever
+class MemoryBudget {
+public:
+  // releases its bytes when destroyed
+  class Reservation {
+  public:
+    Reservation() = default;
+    Reservation(Reservation &&other) noexcept;
+    Reservation &operator=(Reservation &&other) noexcept;
+    ~Reservation();
+
+    Reservation(const Reservation &) = delete;
+    Reservation &operator=(const Reservation &) = delete;
+
+  private:
+    friend class MemoryBudget;
+    Reservation(MemoryBudget *budget, std::uint64_t bytes, bool dedicated)
+        : m_budget{budget}, m_bytes{bytes}, m_dedicated{dedicated} {};
+
+    MemoryBudget *m_budget{nullptr};
+    std::uint64_t m_bytes{0};
+    bool m_dedicated{false};
+  };
+
+  explicit MemoryBudget(std::uint64_t budget_bytes)
+      : m_budget{budget_bytes} {};
+
+  MemoryBudget(const MemoryBudget &) = delete;
+  MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+  // block until `bytes` fit into the budget
+  Reservation acquire(std::uint64_t bytes);
+  // acquire() without blocking, false if `bytes` do not fit right now
+  bool tryAcquire(std::uint64_t bytes, Reservation &reservation);
+
+  std::uint64_t budget() const { return m_budget; };
+
+private:
+  void release(std::uint64_t bytes, bool dedicated);
+
+  const std::uint64_t m_budget;
+  std::mutex m_mutex{};
+  std::condition_variable m_cv{};
+  std::uint64_t m_in_use{0};
+  bool m_dedicated_in_use{false};
+};
+
+#endif // MEMORYBUDGET_HPP
@@ -0,0 +1,77 @@
+#ifndef OUTPUTVERIFIER_HPP
+#define OUTPUTVERIFIER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "PatternMatcher.hpp"
+#include "ThreadPool.hpp"
+
+// exit code of `verify` when original identifiers were found
+constexpr int EXITCODE_IDENTIFIERS_FOUND{80};
+
+// original value that must not survive anonymization
+struct Identifier {
+  std::string value{};
+  std::string kind{};       // column of anonym_output.csv or `custom`
+  std::string pseudoname{}; // study it belongs to, empty for custom ones
+};
+
+// PatientID, PatientName (whole and its components) and old
+// StudyInstanceUID of every row of an `anonym_output.csv` or shard fragment
+OFCondition readIdentifiers(const std::string &filename,
+                            std::vector<Identifier> &identifiers);
+// one custom identifier per line, e.g. institution names
+OFCondition readIdentifierFile(const std::string &filename,
+                               std::vector<Identifier> &identifiers);
+
+// occurrence of an identifier in an output file
+struct IdentifierHit {
+  std::string path{};
+  // e.g. `(0008,1115)[0]/(0020,000E)`, empty if the file did not parse
+  std::string tag_path{};
+  // byte offset in the file, for deflated files in the inflated dataset
+  std::uint64_t offset{0};
+  std::size_t identifier{0};
+};
+
+// searches every byte of the DICOM files below a directory for the
+// identifiers at once, ASCII case-insensitive; files are scanned as pool
+// tasks straight from a read-only memory mapping, deflated datasets are
+// inflated first
+class OutputVerifier {
+public:
+  // identifiers shorter than `min_length` are left out, they would match
+  // all over binary data
+  OutputVerifier(std::vector<Identifier> identifiers, std::size_t min_length);
+
+  OFCondition verify(const std::filesystem::path &directory, ThreadPool &pool);
+
+  const std::vector<Identifier> &identifiers() const { return m_identifiers; };
+  // sorted by file and offset
+  const std::vector<IdentifierHit> &hits() const { return m_hits; };
+  std::uint64_t fileCount() const { return m_files; };
+  std::uint64_t byteCount() const { return m_bytes; };
+
+  // `File,TagPath,Offset,Kind,Pseudoname,Identifier` rows of all hits
+  OFCondition writeReport(const std::string &filename) const;
+
+private:
+  void verifyFile(const std::string &path);
+
+  std::vector<Identifier> m_identifiers{};
+  std::unique_ptr<PatternMatcher> m_matcher{};
+  std::mutex m_mutex{};
+  std::vector<IdentifierHit> m_hits{};
+  std::atomic<std::uint64_t> m_files{0};
+  std::atomic<std::uint64_t> m_bytes{0};
+};
+
+#endif // OUTPUTVERIFIER_HPP
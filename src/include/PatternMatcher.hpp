@@ -0,0 +1,45 @@
+#ifndef PATTERNMATCHER_HPP
+#define PATTERNMATCHER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ASCII case-insensitive search for many patterns at once: an Aho-Corasick
+// automaton compiled to a DFA over byte classes, so every input byte costs
+// one table lookup. Outside of partial matches, bytes that cannot start any
+// pattern are skipped 16 at a time with SSE2 where available
+class PatternMatcher {
+public:
+  // called with the index of the pattern and the offset just past its end
+  using MatchCallback = std::function<void(std::size_t, std::size_t)>;
+
+  explicit PatternMatcher(const std::vector<std::string> &patterns);
+
+  void scan(const std::uint8_t *data, std::size_t size,
+            const MatchCallback &on_match) const;
+
+  std::size_t states() const { return m_outputs.size(); };
+
+private:
+  // first position from `pos` holding a byte that starts some pattern
+  std::size_t skip(const std::uint8_t *data, std::size_t pos,
+                   std::size_t size) const;
+
+  // byte -> column of m_next, 0 for bytes in no pattern
+  std::array<std::uint8_t, 256> m_class{};
+  std::size_t m_class_count{1};
+  // bytes leaving the start state
+  std::array<bool, 256> m_start{};
+  // up to 4 [low, low + span] byte ranges covering m_start, for the SSE2 skip
+  std::vector<std::pair<std::uint8_t, std::uint8_t>> m_start_ranges{};
+  // transitions, m_next[state * m_class_count + class]
+  std::vector<std::uint32_t> m_next{};
+  // patterns ending in each state, including those of its suffix states
+  std::vector<std::vector<std::uint32_t>> m_outputs{};
+};
+
+#endif // PATTERNMATCHER_HPP
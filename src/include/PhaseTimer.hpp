@@ -0,0 +1,158 @@
+#ifndef PHASETIMER_HPP
+#define PHASETIMER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+enum E_PHASE {
+  PH_STUDY,        // whole study
+  PH_FILE,         // whole file, load to rename
+  PH_WALK,         // listing one directory
+  PH_LOAD,         // reading and parsing a file
+  PH_PROFILE,      // confidentiality profile table
+  PH_UIDS,         // new series, SOP and referenced UIDs
+  PH_INVALID_TAGS, // removeInvalidTags
+  PH_ENCODE,       // transcoding pixel data
+  PH_SAVE,         // serializing, writing and renaming a file
+  PH_COUNT
+};
+
+const char *phaseName(E_PHASE phase);
+
+// durations of one phase in log-linear buckets, 8 per power of two so a
+// percentile is off by less than 12.5 %; lock-free
+class PhaseHistogram {
+public:
+  void add(std::uint64_t ns);
+  void clear();
+
+  std::uint64_t count() const { return m_count; };
+  std::uint64_t total() const { return m_total; };
+  std::uint64_t max() const { return m_max; };
+  // duration at or below which `fraction` of the samples fall, in ns
+  std::uint64_t percentile(double fraction) const;
+
+private:
+  static constexpr std::size_t SUB_BUCKETS{8};
+  static constexpr std::size_t BUCKETS{SUB_BUCKETS * 62};
+
+  std::array<std::atomic<std::uint64_t>, BUCKETS> m_buckets{};
+  std::atomic<std::uint64_t> m_count{0};
+  std::atomic<std::uint64_t> m_total{0};
+  std::atomic<std::uint64_t> m_max{0};
+};
+
+// one histogram per phase, of a study or a whole run
+class PhaseTimes {
+public:
+  void add(E_PHASE phase, std::uint64_t ns) { m_phases[phase].add(ns); };
+  void clear();
+
+  const PhaseHistogram &operator[](E_PHASE phase) const {
+    return m_phases[phase];
+  };
+  // `phase: n, p50, p95, p99, max` of every phase with samples
+  std::vector<std::string> summary() const;
+
+private:
+  std::array<PhaseHistogram, PH_COUNT> m_phases{};
+};
+
+// `1.2 ms` and the like
+std::string formatDuration(std::uint64_t ns);
+
+// timing of a run: per-run histograms and, if tracing, one Chrome trace event
+// per timed scope; ScopedPhase only measures while a profiler is installed
+class PhaseProfiler {
+public:
+  explicit PhaseProfiler(bool trace);
+  ~PhaseProfiler();
+
+  PhaseProfiler(const PhaseProfiler &) = delete;
+  PhaseProfiler &operator=(const PhaseProfiler &) = delete;
+
+  // make this the profiler of all threads, before any work starts
+  void install();
+  void uninstall();
+  static PhaseProfiler *active() {
+    return s_active.load(std::memory_order_relaxed);
+  };
+
+  void record(E_PHASE phase, std::chrono::steady_clock::time_point start,
+              std::chrono::steady_clock::time_point end, PhaseTimes *study,
+              std::string_view detail);
+
+  const PhaseTimes &runTimes() const { return m_run; };
+  // table of all phases of the run
+  void print() const;
+  // Chrome trace event JSON, loadable in chrome://tracing and Perfetto;
+  // only once all timed work has finished
+  OFCondition writeTrace(const std::string &path);
+
+private:
+  struct TraceEvent {
+    E_PHASE phase{PH_STUDY};
+    std::uint64_t start_ns{0}; // since the profiler was created
+    std::uint64_t duration_ns{0};
+    std::string detail{};
+  };
+  // events of one thread, appended without locking
+  struct ThreadTrace {
+    unsigned int tid{0};
+    std::vector<TraceEvent> events{};
+  };
+
+  ThreadTrace &threadTrace();
+
+  static std::atomic<PhaseProfiler *> s_active;
+
+  const bool m_trace;
+  const std::chrono::steady_clock::time_point m_epoch;
+  const std::uint64_t m_id;
+  PhaseTimes m_run{};
+  std::mutex m_mutex{};
+  std::vector<std::unique_ptr<ThreadTrace>> m_threads{};
+};
+
+// times its scope as `phase` into the run, `study` (if given) and the trace;
+// without an installed profiler it costs a load and a branch. `detail`, e.g.
+// the file path, is only copied for the trace and must outlive the scope
+class ScopedPhase {
+public:
+  explicit ScopedPhase(E_PHASE phase, PhaseTimes *study = nullptr,
+                       std::string_view detail = {})
+      : m_profiler{PhaseProfiler::active()} {
+    if (m_profiler == nullptr)
+      return;
+    m_phase = phase;
+    m_study = study;
+    m_detail = detail;
+    m_start = std::chrono::steady_clock::now();
+  };
+  ~ScopedPhase() {
+    if (m_profiler != nullptr)
+      m_profiler->record(m_phase, m_start, std::chrono::steady_clock::now(),
+                         m_study, m_detail);
+  };
+
+  ScopedPhase(const ScopedPhase &) = delete;
+  ScopedPhase &operator=(const ScopedPhase &) = delete;
+
+private:
+  PhaseProfiler *const m_profiler;
+  E_PHASE m_phase{PH_STUDY};
+  PhaseTimes *m_study{nullptr};
+  std::string_view m_detail{};
+  std::chrono::steady_clock::time_point m_start{};
+};
+
+#endif // PHASETIMER_HPP
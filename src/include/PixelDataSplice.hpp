@@ -0,0 +1,33 @@
+#ifndef PIXELDATASPLICE_HPP
+#define PIXELDATASPLICE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "Checksum.hpp"
+
+// byte range of the complete PixelData element (header + value) in a file
+struct FileRange {
+  std::uint64_t offset{0};
+  std::uint64_t length{0};
+};
+
+// locate native PixelData stored as the last element of `path`; returns false
+// when the element cannot be copied verbatim (encapsulated, deflated or big
+// endian transfer syntax, undefined or odd length, trailing elements, 7FE0
+// group length, or file bytes not matching the parsed element)
+bool findPixelDataRange(const std::string &path, DcmDataset *dataset,
+                        FileRange &range);
+
+// append `range` of `source` to the end of `destination`; uses
+// copy_file_range/sendfile where available (server-side copy or reflink on
+// filesystems supporting it), buffered copy otherwise; with a `checksum`
+// the copy is always buffered so the appended bytes can be fed to it
+OFCondition appendFileRange(const std::string &source, const FileRange &range,
+                            const std::string &destination,
+                            FileChecksum *checksum = nullptr);
+
+#endif // PIXELDATASPLICE_HPP
@@ -0,0 +1,61 @@
+#ifndef PSEUDONYMINDEX_HPP
+#define PSEUDONYMINDEX_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "MappedFile.hpp"
+
+// `PatientID,Pseudoname` pairs of a --pseudoname-file, read in place from the
+// memory mapped file through an index of line offsets sorted by the hash of
+// the normalized PatientID; the index can be kept in a sidecar file next to
+// the pairs so later runs skip parsing
+class PseudonymIndex {
+public:
+  static constexpr const char *SIDECAR_SUFFIX{".idx"};
+
+  PseudonymIndex() = default;
+
+  PseudonymIndex(const PseudonymIndex &) = delete;
+  PseudonymIndex &operator=(const PseudonymIndex &) = delete;
+
+  // index the pairs in `path`; with `sidecar` the index is loaded from
+  // `<path>.idx` if it matches size and modification time of `path`, and
+  // (re)written otherwise
+  OFCondition open(const std::string &path, bool sidecar);
+
+  // pseudoname of `patient_id`, the first line of a PatientID wins
+  std::optional<std::string> find(std::string_view patient_id) const;
+
+  // distinct PatientIDs
+  std::uint64_t size() const { return m_unique; };
+
+private:
+  struct Entry {
+    std::uint64_t hash;
+    std::uint64_t offset; // start of the line in the mapped file
+  };
+  struct SidecarHeader;
+
+  void build();
+  bool loadSidecar(const std::string &path, std::uint64_t csv_size,
+                   std::int64_t csv_time);
+  OFCondition writeSidecar(const std::string &path, std::uint64_t csv_size,
+                           std::int64_t csv_time) const;
+  std::string_view line(std::uint64_t offset) const;
+
+  MappedFile m_file{};
+  MappedFile m_sidecar{};
+  // entries built from the pairs, unused when loaded from the sidecar
+  std::vector<Entry> m_built{};
+  const Entry *m_entries{nullptr};
+  std::uint64_t m_count{0};
+  std::uint64_t m_unique{0};
+};
+
+#endif // PSEUDONYMINDEX_HPP
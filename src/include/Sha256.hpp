@@ -0,0 +1,39 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// SHA-256 (FIPS 180-4)
+class Sha256 {
+public:
+  using Digest = std::array<std::uint8_t, 32>;
+
+  Sha256();
+
+  void update(const void *data, std::size_t length);
+  void update(std::string_view data) {
+    this->update(data.data(), data.size());
+  };
+  Digest finish();
+
+  static Digest hash(std::string_view data);
+
+private:
+  void transform(const std::uint8_t *block);
+
+  std::array<std::uint32_t, 8> m_state{};
+  std::array<std::uint8_t, 64> m_buffer{};
+  std::size_t m_buffered{0};
+  std::uint64_t m_length{0};
+};
+
+// HMAC-SHA-256 (RFC 2104)
+Sha256::Digest hmacSha256(std::string_view key, std::string_view message);
+
+std::string toHex(const std::uint8_t *data, std::size_t length);
+
+#endif // SHA256_HPP
@@ -0,0 +1,29 @@
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+// node `index` of `count` nodes splitting one export, studies are assigned by
+// a stable hash of their key so nodes need no coordination
+struct ShardSpec {
+  unsigned int index{1}; // 1-based
+  unsigned int count{1};
+
+  bool contains(std::string_view study_key) const;
+  // `shard-<index>-of-<count>`
+  std::string name() const;
+};
+
+// parse `k/N` with 1 <= k <= N
+OFCondition parseShard(const std::string &value, ShardSpec &shard);
+
+// combine `anonym_output.csv` fragments of all shards into `output`, rows in
+// global study order
+OFCondition mergeShardFragments(const std::vector<std::string> &fragments,
+                                const std::string &output);
+
+#endif // SHARD_HPP
@@ -0,0 +1,99 @@
+#ifndef STORAGELISTENER_HPP
+#define STORAGELISTENER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "AnonymOutputWriter.hpp"
+#include "DicomAnonymizer.hpp"
+
+// Storage SCP writing received instances anonymized to the output, without
+// landing them on disk first; instances are grouped into studies by
+// StudyInstanceUID. a study is closed once no instance of it arrived for the
+// quiet period: its checksums are written and only its identity is kept, so
+// instances arriving later continue it
+class StorageListener {
+public:
+  static constexpr const char *DEFAULT_AE_TITLE{"FNODCMANON"};
+
+  // `output` gets a row per study, in order of the first received instance
+  StorageListener(const AnonymizerConfig &config, AnonymOutputWriter &output);
+  ~StorageListener();
+
+  StorageListener(const StorageListener &) = delete;
+  StorageListener &operator=(const StorageListener &) = delete;
+
+  // accept associations on `port` until SIGINT/SIGTERM or stop(), up to
+  // `max_associations` are handled in parallel
+  OFCondition listen(unsigned short port, const std::string &ae_title,
+                     unsigned int max_associations,
+                     std::chrono::seconds quiet_period);
+  // let running associations finish and return from listen()
+  void stop();
+
+  // anonymize and write an instance received from `peer`, called by the
+  // association threads; `write_failed` is set if the instance could not be
+  // written to the output, which a later retry may get past
+  OFCondition store(DcmFileFormat &fileformat, const std::string &peer,
+                    bool &write_failed);
+
+  std::size_t studyCount();
+  std::uint64_t instanceCount() const { return m_instances; };
+
+private:
+  struct Pool;
+  // identity of a study is assigned once by the first of its instances
+  struct ReceivedStudy {
+    ReceivedStudy(const AnonymizerConfig &config, std::size_t index)
+        : anonymizer{config}, index{index} {};
+
+    StudyAnonymizer anonymizer;
+    const std::size_t index; // row in `anonym_output.csv`
+    std::mutex mutex{};
+    bool started{false};
+    OFCondition start_cond{};
+    // set when continuing a closed study, whose row is already written
+    std::optional<StudyIdentity> identity{};
+    std::atomic<unsigned int> next_index{0};
+    // instances being stored and arrival of the last one, guarded by m_mutex
+    unsigned int storing{0};
+    std::chrono::steady_clock::time_point last_instance{};
+  };
+  // what is kept of a closed study
+  struct ClosedStudy {
+    std::size_t index{0};
+    StudyIdentity identity{};
+    unsigned int next_index{0};
+  };
+
+  OFCondition storeInStudy(ReceivedStudy &study, DcmFileFormat &fileformat,
+                           DicomInputFile &file, const DicomHeader &header,
+                           const std::string &peer, bool &write_failed);
+  // write checksums of studies without instances for `quiet_period`, or of
+  // all studies, and drop them
+  OFCondition closeStudies(std::chrono::steady_clock::duration quiet_period,
+                           bool all);
+
+  const AnonymizerConfig &m_config;
+  AnonymOutputWriter &m_output;
+  std::unique_ptr<Pool> m_pool;
+  std::mutex m_mutex{};
+  std::unordered_map<std::string, std::unique_ptr<ReceivedStudy>>
+      m_studies{}; // unordered_map[old StudyInstanceUID, study]
+  std::unordered_map<std::string, ClosedStudy>
+      m_closed{}; // unordered_map[old StudyInstanceUID, closed study]
+  std::size_t m_rows{0};
+  std::atomic<std::uint64_t> m_instances{0};
+};
+
+#endif // STORAGELISTENER_HPP
@@ -0,0 +1,53 @@
+#ifndef STUDYINDEX_HPP
+#define STUDYINDEX_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "DicomAnonymizer.hpp"
+#include "ThreadPool.hpp"
+
+// in-memory index of an input tree keyed by StudyInstanceUID -> series ->
+// instances, built from one directory walk and header-only reads, so studies
+// spread over several directories (or sharing one) are grouped correctly
+class StudyIndex {
+public:
+  StudyIndex() = default;
+  ~StudyIndex() = default;
+
+  OFCondition build(const std::filesystem::path &root, ThreadPool &pool);
+
+  // one StudyInput per StudyInstanceUID, sorted by UID; files are ordered by
+  // series and path
+  std::vector<StudyInput> studies() const;
+
+  std::size_t fileCount() const { return m_file_count; };
+  std::size_t skippedCount() const { return m_skipped_count; };
+  // non-DICOM files and files without StudyInstanceUID
+  const std::vector<RejectedFile> &rejected() const { return m_rejected; };
+
+private:
+  struct StudyEntry {
+    // header of the file with the lowest path, used as study identity
+    std::string header_path{};
+    DicomHeader header{};
+    // map[SeriesInstanceUID, instances]
+    std::map<std::string, std::vector<DicomInputFile>> series{};
+  };
+
+  void add(const DicomInputFile &file, const DicomHeader &header);
+
+  std::mutex m_mutex{};
+  std::map<std::string, StudyEntry> m_studies{};
+  std::size_t m_file_count{0};
+  std::size_t m_skipped_count{0};
+  std::vector<RejectedFile> m_rejected{};
+};
+
+#endif // STUDYINDEX_HPP
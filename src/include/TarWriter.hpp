@@ -0,0 +1,61 @@
+#ifndef TARWRITER_HPP
+#define TARWRITER_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dcmtk/ofstd/ofcond.h"
+
+enum E_TAR_COMPRESSION { TC_NONE, TC_GZIP, TC_ZSTD };
+
+// compression implied by the suffix of `path`: .gz/.tgz, .zst/.tzst
+E_TAR_COMPRESSION tarCompression(const std::string &path);
+// parse `none`, `gzip` or `zstd`, false for anything else
+bool parseTarCompression(const std::string &value,
+                         E_TAR_COMPRESSION &compression);
+
+// ustar stream of whole files, optionally gzip or zstd compressed, written to
+// a file or stdout; members are added concurrently and never seek back
+class TarWriter {
+public:
+  // path of the stdout stream
+  static constexpr const char *STDOUT{"-"};
+
+  TarWriter();
+  ~TarWriter();
+
+  TarWriter(const TarWriter &) = delete;
+  TarWriter &operator=(const TarWriter &) = delete;
+
+  // with STDOUT the original stdout is kept for the stream and stdout is
+  // redirected to stderr, so progress output cannot corrupt the archive
+  OFCondition open(const std::string &path, E_TAR_COMPRESSION compression);
+  // one member, written whole before any other
+  OFCondition addFile(const std::string &name, const char *data,
+                      std::uint64_t size);
+  // end of archive blocks and compressor trailer
+  OFCondition close();
+
+  // true if the stream was built with zstd support
+  static bool hasZstd();
+
+private:
+  struct Compressor;
+
+  OFCondition writeHeader(const std::string &name, std::uint64_t size,
+                          char type);
+  // tar bytes, through the compressor if there is one
+  OFCondition write(const char *data, std::size_t size);
+
+  std::mutex m_mutex{};
+  std::FILE *m_file{nullptr};
+  std::unique_ptr<Compressor> m_compressor{};
+  std::int64_t m_mtime{0};
+  OFCondition m_status{};
+};
+
+#endif // TARWRITER_HPP
@@ -0,0 +1,83 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// work-stealing thread pool
+//
+// tasks submitted from outside the pool go to a shared FIFO queue, tasks
+// submitted by a worker go to that worker's own deque; a worker pops its own
+// deque newest-first, then steals oldest-first from other workers and only
+// then takes new work from the shared queue
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned int threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task);
+
+  // run queued tasks on the calling thread until `done` returns true; only
+  // worker deques are helped, the shared queue is left to idle workers so a
+  // waiting study never starts another study on its stack
+  void waitUntil(const std::function<bool()> &done);
+
+  // wake threads blocked in waitUntil to re-check their condition
+  void notifyAll();
+
+  unsigned int size() const {
+    return static_cast<unsigned int>(m_workers.size());
+  };
+
+private:
+  struct Worker {
+    std::mutex mutex{};
+    std::deque<std::function<void()>> tasks{};
+  };
+
+  void workerLoop(std::size_t index);
+  bool popLocal(std::size_t index, std::function<void()> &task);
+  bool steal(std::size_t thief, std::function<void()> &task);
+  bool popShared(std::function<void()> &task);
+  bool runOne(bool use_shared);
+  // count a task popped from a worker deque as no longer queued
+  void taken();
+
+  std::vector<std::unique_ptr<Worker>> m_workers{};
+  std::deque<std::function<void()>> m_shared{};
+  std::mutex m_mutex{}; // guards m_shared, m_queued and sleeping
+  std::condition_variable m_work_cv{}; // idle workers
+  std::condition_variable m_wait_cv{}; // threads blocked in waitUntil
+  std::size_t m_queued{0}; // tasks in m_shared and all worker deques
+  bool m_stop{false};
+  std::vector<std::thread> m_threads{};
+};
+
+// set of tasks that can be waited for together
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool &pool) : m_pool{pool} {};
+  ~TaskGroup() { this->wait(); };
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  void run(std::function<void()> task);
+  void wait();
+
+private:
+  ThreadPool &m_pool;
+  std::atomic<std::size_t> m_pending{0};
+};
+
+#endif // THREADPOOL_HPP
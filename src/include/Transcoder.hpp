@@ -0,0 +1,50 @@
+#ifndef TRANSCODER_HPP
+#define TRANSCODER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+
+// `deflated`, `jpeg-ls`, `rle` or `jpeg-lossless`, false for anything else
+bool parseOutputXfer(const std::string &value, E_TransferSyntax &xfer);
+
+// dcmdata codecs registered while alive: encoders of all output transfer
+// syntaxes and decoders for compressed input
+class CodecRegistration {
+public:
+  CodecRegistration();
+  ~CodecRegistration();
+
+  CodecRegistration(const CodecRegistration &) = delete;
+  CodecRegistration &operator=(const CodecRegistration &) = delete;
+};
+
+// switch pixel data of `dataset` to the representation of `xfer`; false if
+// no codec can encode it, the dataset then stays in its current transfer
+// syntax
+bool encodePixelData(DcmDataset *dataset, E_TransferSyntax xfer);
+
+// sizes and encode time of all transcoded files of a run
+class TranscodeStats {
+public:
+  void add(std::uint64_t input_bytes, std::uint64_t output_bytes,
+           std::chrono::steady_clock::duration encode_time);
+  // file written in its input transfer syntax instead
+  void addFallback() { ++m_fallbacks; };
+
+  // compression ratio and encode time summary
+  void print(E_TransferSyntax xfer) const;
+
+private:
+  std::atomic<std::uint64_t> m_files{0};
+  std::atomic<std::uint64_t> m_fallbacks{0};
+  std::atomic<std::uint64_t> m_input_bytes{0};
+  std::atomic<std::uint64_t> m_output_bytes{0};
+  std::atomic<std::int64_t> m_encode_ns{0};
+};
+
+#endif // TRANSCODER_HPP
@@ -1,9 +1,17 @@
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include "fmt/format.h"
@@ -15,7 +23,25 @@
 #include "dcmtk/ofstd/ofcond.h"
 #include "dcmtk/ofstd/ofexit.h"
 
+#include "AnonymOutputWriter.hpp"
+#include "ArchiveReader.hpp"
+#include "ChecksumManifest.hpp"
 #include "DicomAnonymizer.hpp"
+#include "FilePipeline.hpp"
+#include "FolderWatcher.hpp"
+#include "Journal.hpp"
+#include "Manifest.hpp"
+#include "MappingStore.hpp"
+#include "MemoryBudget.hpp"
+#include "OutputVerifier.hpp"
+#include "PhaseTimer.hpp"
+#include "PseudonymIndex.hpp"
+#include "Shard.hpp"
+#include "StorageListener.hpp"
+#include "StudyIndex.hpp"
+#include "TarWriter.hpp"
+#include "ThreadPool.hpp"
+#include "Transcoder.hpp"
 
 void checkConflict(OFConsoleApplication &app, const char *first_opt,
                    const char *second_opt) {
@@ -31,18 +57,226 @@ void checkConflict(OFConsoleApplication &app, const char *first_opt,
   app.printError(str.c_str(), EXITCODE_COMMANDLINE_SYNTAX_ERROR);
 };
 
+// study directories and archives in `root_path`; with `archive_folders`
+// every top-level folder of an archive is a study of its own, named
+// `<archive>/<folder>`
 std::vector<std::filesystem::path>
-findStudyDirectories(const OFString &root_path) {
+findStudyDirectories(const OFString &root_path, bool archive_folders) {
   std::vector<std::filesystem::path> dirs{};
 
   for (const auto &entry : std::filesystem::directory_iterator(root_path)) {
     if (entry.is_directory()) {
       dirs.push_back(entry.path());
+      continue;
+    }
+    if (!entry.is_regular_file() || archiveType(entry.path()) == A_NONE)
+      continue;
+
+    std::vector<std::string> folders{};
+    if (archive_folders) {
+      const OFCondition cond =
+          ArchiveReader::listTopLevelFolders(entry.path(), folders);
+      if (cond.bad()) {
+        OFLOG_ERROR(mainLogger, "unable to list archive `"
+                                    << entry.path().string()
+                                    << "`: " << cond.text());
+      }
+    }
+    // members outside any folder only make a study if there are no folders
+    if (folders.size() > 1 && folders.front().empty()) {
+      OFLOG_WARN(mainLogger, "skipping files outside of top-level folders in `"
+                                 << entry.path().string() << "`");
+      folders.erase(folders.begin());
+    }
+    if (folders.empty() || folders.front().empty()) {
+      dirs.push_back(entry.path());
+      continue;
+    }
+    for (const std::string &folder : folders) {
+      dirs.push_back(entry.path() / folder);
     }
   }
+
+  // directory_iterator order is unspecified, sort to keep study order (and
+  // integer pseudonames) stable between runs
+  std::sort(dirs.begin(), dirs.end());
   return dirs;
 };
 
+// list files of one study directory and prescan the header of its first file
+OFCondition scanStudy(const std::filesystem::path &studyDir,
+                      unsigned int studyNumber, ThreadPool &pool,
+                      bool withSizes, StudyInput &study) {
+  study.study_number = studyNumber;
+  std::filesystem::path archive{};
+  std::string folder{};
+  if (splitArchivePath(studyDir, archive, folder)) {
+    study.source = studyDir;
+    return findArchiveStudy(archive, folder, study);
+  }
+
+  const OFCondition cond = findDicomFiles(studyDir, study, pool, withSizes);
+  if (cond.good()) {
+    // header-only prescan of the first file, cached for setBasicTags
+    DicomHeader header{};
+    if (readDicomHeader(study.files[0].path, header).good())
+      study.header = std::move(header);
+  }
+  return cond;
+};
+
+// `studyNumbers[i]` is the position of `studyDirs[i]` in the full sorted
+// directory list
+void scanStudyDirectories(const std::vector<std::filesystem::path> &studyDirs,
+                          const std::vector<unsigned int> &studyNumbers,
+                          ThreadPool &pool, std::vector<StudyInput> &studies,
+                          std::vector<OFCondition> &scanConds) {
+  studies.assign(studyDirs.size(), {});
+  scanConds.assign(studyDirs.size(), EC_Normal);
+
+  TaskGroup scans{pool};
+  for (std::size_t i = 0; i < studyDirs.size(); ++i) {
+    scans.run([&, i]() {
+      scanConds[i] =
+          scanStudy(studyDirs[i], studyNumbers[i], pool, true, studies[i]);
+    });
+  }
+  scans.wait();
+};
+
+// remove output of studies interrupted in an earlier run, including files
+// still being written when it stopped
+void cleanupPartialStudies(const Journal &journal,
+                           const std::vector<StudyInput> &studies,
+                           const AnonymizerConfig &config) {
+  std::size_t removed{0};
+  std::error_code error{};
+  for (const StudyInput &study : studies) {
+    const JournalStudy *previous = journal.previous(study.source.string());
+    if (previous == nullptr || previous->csv_row.has_value())
+      continue;
+
+    for (const std::string &file : previous->files) {
+      removed += std::filesystem::remove(file, error) ? 1 : 0;
+    }
+
+    const std::filesystem::path dicomDir =
+        std::filesystem::path(config.output_directory) /
+        config.studyPath(previous->pseudoname, previous->new_study_uid) /
+        "DICOM";
+    if (previous->pseudoname.empty() ||
+        !std::filesystem::is_directory(dicomDir, error))
+      continue;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(dicomDir, error)) {
+      if (entry.path().extension() == ".part")
+        removed += std::filesystem::remove(entry.path(), error) ? 1 : 0;
+    }
+  }
+
+  if (removed > 0) {
+    OFLOG_INFO(mainLogger,
+               "removed " << removed << " files of partial studies");
+  }
+};
+
+// partial studies are redone under the identity they started with
+void reuseJournalIdentities(const Journal &journal,
+                            std::vector<StudyInput> &studies) {
+  for (StudyInput &study : studies) {
+    const JournalStudy *previous = journal.previous(study.source.string());
+    if (previous != nullptr && !previous->csv_row.has_value() &&
+        !previous->pseudoname.empty()) {
+      study.identity = StudyIdentity{previous->pseudoname,
+                                     previous->new_study_uid, {}};
+    }
+  }
+};
+
+// reduce `study` to files that are new or changed since `next` was recorded
+// and reuse its identity; outputs of changed and vanished inputs are removed.
+// false if there is nothing to anonymize
+bool prepareIncremental(StudyInput &study, bool found, bool content_hash,
+                        ManifestStudy &next) {
+  std::error_code error{};
+
+  // members are not listed upfront, an archive is compared as a whole and
+  // redone completely once it changes
+  if (!study.archive.empty()) {
+    FileFingerprint fingerprint{};
+    if (fingerprintFile(study.archive.string(), content_hash, fingerprint)
+            .bad())
+      fingerprint = {};
+    const std::string key = study.archive.string();
+    const auto it = next.files.find(key);
+    if (found && it != next.files.end() &&
+        it->second.fingerprint == fingerprint && fingerprint.size > 0)
+      return false;
+
+    for (const auto &[input, file] : next.files) {
+      if (!file.output_path.empty())
+        (void)std::filesystem::remove(file.output_path, error);
+    }
+    next.files.clear();
+    next.files[key] = {fingerprint, {}, 0};
+    next.next_index = 0;
+    if (found) {
+      study.identity = StudyIdentity{next.pseudoname, next.new_study_uid,
+                                     next.series_uids};
+    }
+    return true;
+  }
+
+  std::set<std::string> inputs{};
+  std::vector<DicomInputFile> changed{};
+  for (DicomInputFile &file : study.files) {
+    inputs.insert(file.path);
+
+    // unreadable fingerprints never match, the file is redone
+    FileFingerprint fingerprint{};
+    if (fingerprintFile(file.path, content_hash, fingerprint).bad())
+      fingerprint = {};
+
+    const auto it = next.files.find(file.path);
+    if (it != next.files.end()) {
+      if (it->second.fingerprint == fingerprint && fingerprint.size > 0)
+        continue;
+      (void)std::filesystem::remove(it->second.output_path, error);
+      file.output_index = it->second.output_index;
+    } else if (found) {
+      file.output_index = next.next_index++;
+    }
+    next.files[file.path] = {fingerprint, {}, file.output_index};
+    changed.push_back(file);
+  }
+  if (!found) {
+    next.next_index = static_cast<unsigned int>(study.files.size());
+  }
+
+  for (auto it = next.files.begin(); it != next.files.end();) {
+    if (inputs.contains(it->first)) {
+      ++it;
+      continue;
+    }
+    (void)std::filesystem::remove(it->second.output_path, error);
+    it = next.files.erase(it);
+  }
+
+  if (changed.empty())
+    return false;
+
+  if (found) {
+    study.identity = StudyIdentity{next.pseudoname, next.new_study_uid,
+                                   next.series_uids};
+  }
+  study.files = std::move(changed);
+  study.total_bytes = 0;
+  for (const DicomInputFile &file : study.files) {
+    study.total_bytes += file.size;
+  }
+  return true;
+};
+
 void printMethods() {
   struct AnonProfiles {
     std::string_view option{};
@@ -72,6 +306,233 @@ void printMethods() {
   }
 };
 
+// `fnodcmanon merge <out.csv> <fragment.csv>...`
+int mergeCommand(int argc, char *argv[], const char *rcsid) {
+  OFConsoleApplication app{"fnodcmanon merge",
+                           "merge anonym_output.csv fragments of shards",
+                           rcsid};
+  OFCommandLine cmd{};
+  cmd.addParam("out-file", "merged anonym_output.csv to write");
+  cmd.addParam("fragment", "anonym_output.csv fragment of one shard",
+               OFCommandLine::PM_MultiMandatory);
+  cmd.addGroup("general options:");
+  cmd.addOption("--help", "-h", "print this help text and exit",
+                OFCommandLine::AF_Exclusive);
+  OFLog::addOptions(cmd);
+
+  std::string outFile{};
+  std::vector<std::string> fragments{};
+  if (app.parseCommandLine(cmd, argc, argv)) {
+    OFLog::configureFromCommandLine(cmd, app);
+    OFString value{};
+    cmd.getParam(1, value);
+    outFile = value.c_str();
+    for (int i = 2; i <= cmd.getParamCount(); ++i) {
+      cmd.getParam(i, value);
+      fragments.emplace_back(value.c_str());
+    }
+  }
+
+  const OFCondition cond = mergeShardFragments(fragments, outFile);
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, cond.text());
+    return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+  }
+  return 0;
+};
+
+// `fnodcmanon verify <out-directory> [options]`
+int verifyCommand(int argc, char *argv[], const char *rcsid) {
+  OFConsoleApplication app{"fnodcmanon verify",
+                           "search anonymized output for original identifiers",
+                           rcsid};
+  OFCommandLine cmd{};
+  cmd.addParam("out-directory", "output directory of an anonymization run");
+  cmd.addGroup("general options:");
+  cmd.addOption("--help", "-h", "print this help text and exit",
+                OFCommandLine::AF_Exclusive);
+  OFLog::addOptions(cmd);
+  cmd.addGroup("verify options:");
+  cmd.addOption("--identifiers", "-id", 1, "file: path/to/.csv",
+                "anonym_output.csv of the run (default "
+                "out-directory/anonym_output.csv)");
+  cmd.addOption("--identifier-file", "-if", 1, "file: path/to/.txt",
+                "more identifiers to search, one per line (e.g. institution "
+                "names)");
+  cmd.addOption("--min-length", "-ml", 1, "[n]umber: integer (default 4)",
+                "skip identifiers shorter than n characters");
+  cmd.addOption("--jobs", "-j", 1, "[n]umber: integer (default 0)",
+                "verify with n worker threads, 0 = number of CPU cores");
+  cmd.addOption("--report", "-r", 1, "file: path/to/.csv",
+                "write every hit with its identifier to a csv file; keep it "
+                "out of the released output");
+
+  std::string outDirectory{};
+  std::string identifiersPath{};
+  std::string identifierFile{};
+  std::string reportPath{};
+  signed long minLength{4};
+  signed long jobs{0};
+  if (app.parseCommandLine(cmd, argc, argv)) {
+    OFLog::configureFromCommandLine(cmd, app);
+    OFString value{};
+    cmd.getParam(1, value);
+    outDirectory = value.c_str();
+
+    if (cmd.findOption("--identifiers"))
+      app.checkValue(cmd.getValue(identifiersPath));
+    if (cmd.findOption("--identifier-file"))
+      app.checkValue(cmd.getValue(identifierFile));
+    if (cmd.findOption("--min-length"))
+      app.checkValue(cmd.getValueAndCheckMin(minLength, 1));
+    if (cmd.findOption("--jobs"))
+      app.checkValue(cmd.getValueAndCheckMin(jobs, 0));
+    if (cmd.findOption("--report"))
+      app.checkValue(cmd.getValue(reportPath));
+  }
+  if (identifiersPath.empty())
+    identifiersPath = fmt::format("{}/anonym_output.csv", outDirectory);
+
+  std::vector<Identifier> identifiers{};
+  OFCondition cond = readIdentifiers(identifiersPath, identifiers);
+  if (cond.good() && !identifierFile.empty())
+    cond = readIdentifierFile(identifierFile, identifiers);
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, cond.text());
+    return EXITCODE_CANNOT_READ_INPUT_FILE;
+  }
+
+  OutputVerifier verifier{std::move(identifiers),
+                          static_cast<std::size_t>(minLength)};
+  if (verifier.identifiers().empty()) {
+    OFLOG_ERROR(mainLogger, "no identifiers to search for");
+    return EXITCODE_CANNOT_READ_INPUT_FILE;
+  }
+
+  unsigned int threads = static_cast<unsigned int>(jobs);
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  ThreadPool pool{threads};
+  const auto start = std::chrono::steady_clock::now();
+  cond = verifier.verify(outDirectory, pool);
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, cond.text());
+    return EXITCODE_CANNOT_READ_INPUT_FILE;
+  }
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  const double megabytes = static_cast<double>(verifier.byteCount()) / 1e6;
+  fmt::print("verified {} files, {:.1f} MB in {:.1f} s ({:.0f} MB/s) "
+             "against {} identifiers\n",
+             verifier.fileCount(), megabytes, seconds,
+             seconds > 0 ? megabytes / seconds : 0.0,
+             verifier.identifiers().size());
+
+  // the log names the study, not the identifier itself
+  constexpr std::size_t LOGGED_HITS{20};
+  const std::vector<IdentifierHit> &hits = verifier.hits();
+  for (std::size_t i = 0; i < std::min(hits.size(), LOGGED_HITS); ++i) {
+    const Identifier &identifier = verifier.identifiers()[hits[i].identifier];
+    OFLOG_WARN(mainLogger,
+               "`" << hits[i].path << "` "
+                   << (hits[i].tag_path.empty() ? "?" : hits[i].tag_path)
+                   << " at " << hits[i].offset << ": " << identifier.kind
+                   << " of `" << identifier.pseudoname << "`");
+  }
+  if (hits.size() > LOGGED_HITS) {
+    OFLOG_WARN(mainLogger, hits.size() - LOGGED_HITS << " more hits");
+  }
+
+  if (!reportPath.empty()) {
+    cond = verifier.writeReport(reportPath);
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, cond.text());
+      return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+    }
+  }
+
+  if (!hits.empty()) {
+    OFLOG_ERROR(mainLogger,
+                hits.size() << " original identifiers found in the output");
+    return EXITCODE_IDENTIFIERS_FOUND;
+  }
+  fmt::print("no original identifiers found\n");
+  return 0;
+};
+
+// `fnodcmanon check <out-directory> [options]`
+int checkCommand(int argc, char *argv[], const char *rcsid) {
+  OFConsoleApplication app{"fnodcmanon check",
+                           "check anonymized output against its checksums",
+                           rcsid};
+  OFCommandLine cmd{};
+  cmd.addParam("out-directory",
+               "output directory of a run with --checksums, or one study "
+               "directory of it");
+  cmd.addGroup("general options:");
+  cmd.addOption("--help", "-h", "print this help text and exit",
+                OFCommandLine::AF_Exclusive);
+  OFLog::addOptions(cmd);
+  cmd.addGroup("check options:");
+  cmd.addOption("--jobs", "-j", 1, "[n]umber: integer (default 0)",
+                "check with n worker threads, 0 = number of CPU cores");
+
+  std::string outDirectory{};
+  signed long jobs{0};
+  if (app.parseCommandLine(cmd, argc, argv)) {
+    OFLog::configureFromCommandLine(cmd, app);
+    OFString value{};
+    cmd.getParam(1, value);
+    outDirectory = value.c_str();
+
+    if (cmd.findOption("--jobs"))
+      app.checkValue(cmd.getValueAndCheckMin(jobs, 0));
+  }
+
+  unsigned int threads = static_cast<unsigned int>(jobs);
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  ThreadPool pool{threads};
+  OutputChecker checker{};
+  const auto start = std::chrono::steady_clock::now();
+  const OFCondition cond = checker.check(outDirectory, pool);
+  if (cond.bad()) {
+    OFLOG_ERROR(mainLogger, cond.text() << " in `" << outDirectory << "`");
+    return EXITCODE_CANNOT_READ_INPUT_FILE;
+  }
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  const double megabytes = static_cast<double>(checker.byteCount()) / 1e6;
+  fmt::print("checked {} files of {} studies, {:.1f} MB in {:.1f} s "
+             "({:.0f} MB/s)\n",
+             checker.fileCount(), checker.studyCount(), megabytes, seconds,
+             seconds > 0 ? megabytes / seconds : 0.0);
+
+  constexpr std::size_t LOGGED_PROBLEMS{20};
+  const std::vector<ChecksumProblem> &problems = checker.problems();
+  for (std::size_t i = 0; i < std::min(problems.size(), LOGGED_PROBLEMS);
+       ++i) {
+    OFLOG_ERROR(mainLogger,
+                "`" << problems[i].path << "`: " << problems[i].problem);
+  }
+  if (problems.size() > LOGGED_PROBLEMS) {
+    OFLOG_ERROR(mainLogger, problems.size() - LOGGED_PROBLEMS
+                                << " more files do not match");
+  }
+
+  if (!problems.empty()) {
+    OFLOG_ERROR(mainLogger,
+                problems.size() << " files do not match their checksums");
+    return EXITCODE_CHECKSUM_MISMATCH;
+  }
+  fmt::print("all files match their checksums\n");
+  return 0;
+};
+
 int main(int argc, char *argv[]) {
   constexpr auto FNO_CONSOLE_APPLICATION{"fnodcmanon"};
   constexpr auto APP_VERSION{"0.5.0"};
@@ -81,6 +542,16 @@ int main(int argc, char *argv[]) {
       APP_VERSION, RELEASE_DATE, OFFIS_DCMTK_VERSION, OFFIS_DCMTK_RELEASEDATE);
 
   setupLogger(fmt::format("fno.apps.{}", FNO_CONSOLE_APPLICATION));
+  if (argc > 1 && std::string_view(argv[1]) == "merge") {
+    return mergeCommand(argc - 1, argv + 1, rcsid.c_str());
+  }
+  if (argc > 1 && std::string_view(argv[1]) == "verify") {
+    return verifyCommand(argc - 1, argv + 1, rcsid.c_str());
+  }
+  if (argc > 1 && std::string_view(argv[1]) == "check") {
+    return checkCommand(argc - 1, argv + 1, rcsid.c_str());
+  }
+
   OFConsoleApplication app{FNO_CONSOLE_APPLICATION, "DICOM anonymization tool",
                            rcsid.c_str()};
   OFCommandLine cmd{};
@@ -92,18 +563,48 @@ int main(int argc, char *argv[]) {
   std::string opt_anonymizedPrefix{};
   E_PSEUDONAME_TYPE opt_pseudonameType = P_RANDOM_STRING;
   std::string opt_pseudonameFile{};
+  bool opt_pseudonameIndex{false};
 
   // optional output methods
   std::string opt_outDirectory{"./anonymized_output"};
+  std::string opt_outputTar{};
+  std::optional<E_TAR_COMPRESSION> opt_tarCompression{};
+  E_TransferSyntax opt_outputXfer{EXS_Unknown};
   std::string FNO_UID_ROOT{"1.2.840.113619.2"};
   std::string opt_rootUID{FNO_UID_ROOT};
+  std::string opt_uidSecret{};
+  std::string opt_mappingStore{};
   E_FILENAMES opt_filenameType = F_HEX;
   std::set<E_ADDIT_ANONYM_METHODS> opt_anonymizationMethods{};
 
+  // optional processing params
+  signed long opt_jobs{1};
+  bool opt_pipeline{false};
+  bool opt_streamStudies{false};
+  bool opt_archiveFolders{false};
+  bool opt_groupByStudyUID{false};
+  bool opt_pixelPassthrough{false};
+  E_CHECKSUM_TYPE opt_checksumType{CS_NONE};
+  bool opt_resume{false};
+  bool opt_incremental{false};
+  bool opt_incrementalHash{false};
+  std::optional<ShardSpec> opt_shard{};
+  PipelineConfig opt_pipelineConfig{};
+  signed long opt_transformThreads{0};
+  signed long opt_memoryBudgetMB{0};
+  signed long opt_listenPort{0};
+  std::string opt_aeTitle{StorageListener::DEFAULT_AE_TITLE};
+  bool opt_watch{false};
+  signed long opt_quietPeriod{30};
+  bool opt_phaseTimes{false};
+  std::string opt_tracePath{};
+
   constexpr int LONGCOL{20};
   constexpr int SHORTCOL{4};
   cmd.setParamColumn(LONGCOL + SHORTCOL + 4);
-  cmd.addParam("in-directory", "input directory with DICOM studies");
+  cmd.addParam("in-directory",
+               "input directory with DICOM studies (not with --listen)",
+               OFCommandLine::PM_Optional);
 
   cmd.setOptionColumns(LONGCOL, SHORTCOL);
   cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
@@ -128,6 +629,9 @@ int main(int argc, char *argv[]) {
   cmd.addOption(
       "--pseudoname-file", "-pf", 1, "file: path/to/.csv",
       "read .csv with existing pseudonames and append to <anonymized-prefix>");
+  cmd.addOption("--pseudoname-index", "-pix",
+                "with --pseudoname-file, keep its index in <file>.idx so "
+                "later runs start without parsing it");
 
   cmd.addSubGroup("additional anonymization profiles:");
   cmd.addOption("--retain-patient-charac-tags", "-rpt",
@@ -149,11 +653,101 @@ int main(int argc, char *argv[]) {
 
   cmd.addOption("--custom-uid-root", "-cuid", 1, "uid root: string",
                 "use custom UID root");
+  cmd.addOption("--uid-secret", "-us", 1, "secret: string",
+                "derive new UIDs from keyed hash of old UIDs, same secret and "
+                "root give same UIDs across runs and machines");
+  cmd.addOption("--uid-secret-file", "-usf", 1, "file: path",
+                "as --uid-secret, read secret from first line of file");
+
+  cmd.addSubGroup("persistent mapping options:");
+  cmd.addOption("--mapping-store", "-ms", 1, "file: path",
+                "keep PatientID -> pseudoname and old -> new UID mappings in "
+                "file, reused by later runs; references in sequences are "
+                "remapped through it");
+
+  cmd.addGroup("input options:");
+  cmd.addOption("--group-by-study-uid", "-g",
+                "scan whole input tree once and group files by "
+                "StudyInstanceUID instead of one study per directory");
+  cmd.addOption("--archive-folders", "-af",
+                "one study per top-level folder of .zip/.tar/.tar.gz input "
+                "archives instead of one study per archive");
+  cmd.addOption("--listen", "-l", 1, "[p]ort: integer",
+                "receive studies as storage SCP on port p instead of reading "
+                "in-directory, until interrupted");
+  cmd.addOption("--ae-title", "-aet", 1, "[a]etitle: string",
+                "AE title of the storage SCP (default FNODCMANON)");
+  cmd.addOption("--watch", "-w",
+                "keep running and anonymize study folders and archives "
+                "landing in in-directory, until interrupted");
+  cmd.addOption("--quiet-period", "-qp", 1, "[s]econds: integer (default 30)",
+                "with --watch, a study is complete once nothing in it "
+                "changed for s seconds; with --listen, a study is closed "
+                "once none of its instances arrived for s seconds");
+
+  cmd.addGroup("processing options:");
+  cmd.addOption("--jobs", "-j", 1, "[n]umber: integer (default 1)",
+                "anonymize with n worker threads, 0 = number of CPU cores");
+  cmd.addOption("--stream-studies", "-ss",
+                "start each study as soon as its directory is listed instead "
+                "of after listing the whole input (no largest-first order)");
+  cmd.addOption("--shard", "-sh", 1, "k/N: shard",
+                "anonymize only studies of shard k of N (1 <= k <= N), "
+                "assigned by a stable hash; combine outputs with `merge`");
+  cmd.addOption("--memory-budget", "-mb", 1, "[m]egabytes: integer",
+                "max. total size of files loaded at once across all workers; "
+                "larger files run one at a time");
+  cmd.addSubGroup("pipeline options:");
+  cmd.addOption("--pipeline", "-pl",
+                "run files through separate read, transform and write stages "
+                "connected by bounded queues");
+  cmd.addOption("--read-threads", 1, "[n]umber: integer (default 2)",
+                "threads loading files in the read stage");
+  cmd.addOption("--transform-threads", 1,
+                "[n]umber: integer (default --jobs)",
+                "threads applying anonymization profiles");
+  cmd.addOption("--write-threads", 1, "[n]umber: integer (default 2)",
+                "threads saving files in the write stage");
+  cmd.addOption("--read-queue-depth", 1, "[n]umber: integer (default 16)",
+                "max. parsed files waiting for the transform stage");
+  cmd.addOption("--write-queue-depth", 1, "[n]umber: integer (default 16)",
+                "max. anonymized files waiting for the write stage");
+  cmd.addOption("--phase-times", "-pt",
+                "time load, profile, UID, save and other phases of every "
+                "file, print p50/p95/p99 per study and run");
+  cmd.addOption("--trace", "-tr", 1, "file: path/to/.json",
+                "as --phase-times, also write a Chrome/Perfetto trace with "
+                "an event per phase, file and thread");
 
   cmd.addGroup("output options:");
   cmd.addOption("--out-directory", "-od", 1,
                 "directory: string (default `./anonymized_output`",
                 "write modified files to output directory");
+  cmd.addOption("--output-tar", "-ot", 1, "file: path or -",
+                "stream anonymized files and anonym_output.csv as one tar "
+                "archive to file (- = stdout) instead of a directory tree");
+  cmd.addOption("--tar-compression", "-tc", 1, "none|gzip|zstd",
+                "compression of --output-tar (default from file suffix "
+                ".gz/.tgz, .zst/.tzst)");
+  cmd.addOption("--output-xfer", "-ox", 1,
+                "deflated|jpeg-ls|rle|jpeg-lossless",
+                "write files in this lossless transfer syntax instead of "
+                "the input one");
+  cmd.addOption("--pixel-passthrough", "-pp",
+                "copy unchanged pixel data bytes from input files instead of "
+                "re-encoding them, falls back to normal write if unsafe");
+  cmd.addOption("--checksums", "-cs", 1, "crc32c|sha256",
+                "checksum files while writing them into checksums.csv of "
+                "each study (sha256 = CRC-32C and SHA-256)");
+  cmd.addOption("--resume", "-rs",
+                "continue an interrupted run in the same output directory, "
+                "skip finished studies and redo partial ones");
+  cmd.addOption("--incremental", "-inc",
+                "anonymize only files added or changed since the last run "
+                "into the same output directory, keep existing pseudonames "
+                "and UIDs");
+  cmd.addOption("--incremental-hash", "-inch",
+                "as --incremental, also compare content hashes of files");
   cmd.addOption("--filename-hex", "-f", "filenames in hex format (default)");
   cmd.addOption("--filename-modality-sop", "+f",
                 "filenames in MODALITY_SOPINSTUID format");
@@ -191,6 +785,12 @@ int main(int argc, char *argv[]) {
     }
     cmd.endOptionBlock();
 
+    if (cmd.findOption("--pseudoname-index")) {
+      app.checkDependence("--pseudoname-index", "--pseudoname-file",
+                          opt_pseudonameType == P_FROM_FILE);
+      opt_pseudonameIndex = true;
+    }
+
     if (cmd.findOption("--fno-uid-root") &&
         cmd.findOption("--offis-uid-root") &&
         cmd.findOption("--custom-uid-root")) {
@@ -216,10 +816,102 @@ int main(int argc, char *argv[]) {
       app.checkValue(cmd.getValue(opt_rootUID));
     cmd.endOptionBlock();
 
+    if (cmd.findOption("--uid-secret") &&
+        cmd.findOption("--uid-secret-file")) {
+      checkConflict(app, "--uid-secret", "--uid-secret-file");
+    }
+    if (cmd.findOption("--uid-secret")) {
+      app.checkValue(cmd.getValue(opt_uidSecret));
+    }
+    if (cmd.findOption("--uid-secret-file")) {
+      std::string secretFile{};
+      app.checkValue(cmd.getValue(secretFile));
+      std::ifstream file{secretFile, std::ios::in};
+      if (!file.is_open() || !std::getline(file, opt_uidSecret)) {
+        OFLOG_ERROR(mainLogger,
+                    "error reading uid secret file `" << secretFile << "`");
+        return EXITCODE_CANNOT_READ_INPUT_FILE;
+      }
+      if (!opt_uidSecret.empty() && opt_uidSecret.back() == '\r')
+        opt_uidSecret.pop_back();
+    }
+    if ((cmd.findOption("--uid-secret") ||
+         cmd.findOption("--uid-secret-file")) &&
+        opt_uidSecret.empty()) {
+      OFLOG_ERROR(mainLogger, "uid secret is empty");
+      return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
+    }
+    if (!opt_uidSecret.empty() &&
+        opt_rootUID.size() + 1 + MIN_KEYED_UID_DIGITS > 64) {
+      OFLOG_ERROR(mainLogger, "uid root `" << opt_rootUID
+                                           << "` too long for keyed UIDs");
+      return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
+    }
+
+    if (cmd.findOption("--mapping-store")) {
+      app.checkValue(cmd.getValue(opt_mappingStore));
+    }
+
     if (cmd.findOption("--out-directory")) {
       app.checkValue(cmd.getValue(opt_outDirectory));
     }
 
+    if (cmd.findOption("--output-tar")) {
+      app.checkValue(cmd.getValue(opt_outputTar));
+    }
+    if (cmd.findOption("--tar-compression")) {
+      std::string value{};
+      app.checkValue(cmd.getValue(value));
+      E_TAR_COMPRESSION compression{};
+      if (!parseTarCompression(value, compression)) {
+        OFLOG_ERROR(mainLogger, "invalid tar compression `" << value << "`");
+        return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
+      }
+      opt_tarCompression = compression;
+    }
+
+    if (cmd.findOption("--output-xfer")) {
+      std::string value{};
+      app.checkValue(cmd.getValue(value));
+      if (!parseOutputXfer(value, opt_outputXfer)) {
+        OFLOG_ERROR(mainLogger, "invalid output transfer syntax `" << value
+                                                                   << "`");
+        return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
+      }
+    }
+
+    if (cmd.findOption("--pixel-passthrough"))
+      opt_pixelPassthrough = true;
+
+    if (cmd.findOption("--checksums")) {
+      std::string value{};
+      app.checkValue(cmd.getValue(value));
+      if (!parseChecksumType(value, opt_checksumType)) {
+        OFLOG_ERROR(mainLogger, "invalid checksum type `" << value << "`");
+        return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
+      }
+    }
+
+    if (cmd.findOption("--resume"))
+      opt_resume = true;
+
+    if (cmd.findOption("--incremental"))
+      opt_incremental = true;
+    if (cmd.findOption("--incremental-hash")) {
+      opt_incremental = true;
+      opt_incrementalHash = true;
+    }
+
+    // a stream cannot be resumed or have single outputs replaced
+    if (cmd.findOption("--output-tar") && cmd.findOption("--resume")) {
+      checkConflict(app, "--output-tar", "--resume");
+    }
+    if (cmd.findOption("--output-tar") &&
+        (cmd.findOption("--incremental") ||
+         cmd.findOption("--incremental-hash"))) {
+      checkConflict(app, "--output-tar", "--incremental");
+    }
+
     if (cmd.findOption("--filename-hex") &&
         cmd.findOption("--filename-modality-sop")) {
       checkConflict(app, "--filename-hex", "--filename-modality-sop");
@@ -244,17 +936,126 @@ int main(int argc, char *argv[]) {
       opt_anonymizationMethods.insert(E_ADDIT_ANONYM_METHODS::M_113112);
     }
 
+    if (cmd.findOption("--jobs")) {
+      app.checkValue(cmd.getValueAndCheckMin(opt_jobs, 0));
+    }
+
+    if (cmd.findOption("--group-by-study-uid"))
+      opt_groupByStudyUID = true;
+
+    if (cmd.findOption("--archive-folders") &&
+        cmd.findOption("--group-by-study-uid")) {
+      checkConflict(app, "--archive-folders", "--group-by-study-uid");
+    }
+    if (cmd.findOption("--archive-folders"))
+      opt_archiveFolders = true;
+
+    if (cmd.findOption("--stream-studies") &&
+        cmd.findOption("--group-by-study-uid")) {
+      checkConflict(app, "--stream-studies", "--group-by-study-uid");
+    }
+    if (cmd.findOption("--stream-studies"))
+      opt_streamStudies = true;
+
+    if (cmd.findOption("--listen")) {
+      app.checkValue(cmd.getValueAndCheckMinMax(opt_listenPort, 1, 65535));
+      // instances arrive one at a time, there is no input tree to list,
+      // split, resume or compare, nor a study count to number studies by
+      for (const char *other :
+           {"--group-by-study-uid", "--archive-folders", "--stream-studies",
+            "--shard", "--pipeline", "--pixel-passthrough", "--resume",
+            "--incremental", "--incremental-hash", "--pseudoname-integer"}) {
+        if (cmd.findOption(other))
+          checkConflict(app, "--listen", other);
+      }
+      if (cmd.getParamCount() > 0) {
+        app.printError("in-directory not allowed with --listen",
+                       EXITCODE_COMMANDLINE_SYNTAX_ERROR);
+      }
+    } else if (cmd.getParamCount() == 0) {
+      app.printError("Missing parameter in-directory",
+                     EXITCODE_COMMANDLINE_SYNTAX_ERROR);
+    }
+    if (cmd.findOption("--ae-title")) {
+      app.checkValue(cmd.getValue(opt_aeTitle));
+    }
+
+    if (cmd.findOption("--watch")) {
+      // studies are picked up one by one as they become quiet, their count
+      // is unknown and numbering would restart with every daemon run
+      for (const char *other :
+           {"--listen", "--group-by-study-uid", "--archive-folders",
+            "--stream-studies", "--shard", "--incremental",
+            "--incremental-hash", "--pseudoname-integer"}) {
+        if (cmd.findOption(other))
+          checkConflict(app, "--watch", other);
+      }
+      opt_watch = true;
+    }
+    if (cmd.findOption("--quiet-period")) {
+      app.checkValue(cmd.getValueAndCheckMin(opt_quietPeriod, 1));
+    }
+
+    if (cmd.findOption("--shard")) {
+      std::string value{};
+      app.checkValue(cmd.getValue(value));
+      ShardSpec shard{};
+      const OFCondition cond = parseShard(value, shard);
+      if (cond.bad()) {
+        app.printError(cond.text(), EXITCODE_COMMANDLINE_SYNTAX_ERROR);
+      }
+      opt_shard = shard;
+    }
+
+    if (cmd.findOption("--memory-budget")) {
+      app.checkValue(cmd.getValueAndCheckMin(opt_memoryBudgetMB, 1));
+    }
+
+    if (cmd.findOption("--pipeline"))
+      opt_pipeline = true;
+
+    signed long value{0};
+    if (cmd.findOption("--read-threads")) {
+      app.checkValue(cmd.getValueAndCheckMin(value, 1));
+      opt_pipelineConfig.read_threads = static_cast<unsigned int>(value);
+    }
+    if (cmd.findOption("--transform-threads")) {
+      app.checkValue(cmd.getValueAndCheckMin(opt_transformThreads, 1));
+    }
+    if (cmd.findOption("--write-threads")) {
+      app.checkValue(cmd.getValueAndCheckMin(value, 1));
+      opt_pipelineConfig.write_threads = static_cast<unsigned int>(value);
+    }
+    if (cmd.findOption("--read-queue-depth")) {
+      app.checkValue(cmd.getValueAndCheckMin(value, 1));
+      opt_pipelineConfig.read_queue_depth = static_cast<std::size_t>(value);
+    }
+    if (cmd.findOption("--write-queue-depth")) {
+      app.checkValue(cmd.getValueAndCheckMin(value, 1));
+      opt_pipelineConfig.write_queue_depth = static_cast<std::size_t>(value);
+    }
+
+    if (cmd.findOption("--phase-times"))
+      opt_phaseTimes = true;
+    if (cmd.findOption("--trace")) {
+      app.checkValue(cmd.getValue(opt_tracePath));
+      opt_phaseTimes = true;
+    }
+
     OFLOG_DEBUG(mainLogger, rcsid.c_str() << OFendl);
   }
 
-  if (std::filesystem::exists(opt_inDirectory)) {
+  if (opt_listenPort > 0) {
+    // studies are received after the setup below
+  } else if (std::filesystem::exists(opt_inDirectory)) {
     if (!std::filesystem::is_directory(opt_inDirectory)) {
       OFLOG_ERROR(mainLogger,
                   "invalid path, not directory `" << opt_inDirectory << "`");
       return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
     }
 
-    if (std::filesystem::is_empty(opt_inDirectory)) {
+    // a watched directory may start out empty
+    if (!opt_watch && std::filesystem::is_empty(opt_inDirectory)) {
       OFLOG_ERROR(mainLogger,
                   "invalid path, empty directory `" << opt_inDirectory << "`");
       return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
@@ -265,18 +1066,134 @@ int main(int argc, char *argv[]) {
     return EXITCODE_COMMANDLINE_SYNTAX_ERROR;
   }
 
-  std::vector<std::filesystem::path> studyDirs =
-      findStudyDirectories(opt_inDirectory);
+  unsigned int jobs = static_cast<unsigned int>(opt_jobs);
+  if (jobs == 0) {
+    jobs = std::max(1U, std::thread::hardware_concurrency());
+  }
+  ThreadPool pool{jobs};
+
+  // timers cost a branch until a profiler is installed
+  std::optional<PhaseProfiler> profiler{};
+  if (opt_phaseTimes) {
+    profiler.emplace(!opt_tracePath.empty());
+    profiler->install();
+  }
+
+  std::vector<StudyInput> studies{};
+  std::vector<OFCondition> scanConds{};
+  // studies in the whole input, more than `studies` when sharding
+  std::size_t totalStudies{0};
+  std::vector<RejectedFile> rejectedFiles{};
+  if (opt_listenPort > 0 || opt_watch) {
+    // no input to scan, watched studies are scanned once they are quiet
+  } else if (opt_groupByStudyUID) {
+    StudyIndex index{};
+    const OFCondition cond = index.build(opt_inDirectory, pool);
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, cond.text());
+      return EXITCODE_CANNOT_READ_INPUT_FILE;
+    }
+    studies = index.studies();
+    rejectedFiles = index.rejected();
+    totalStudies = studies.size();
+    // every shard indexes the whole tree, so study numbers agree
+    if (opt_shard.has_value()) {
+      std::erase_if(studies, [&](const StudyInput &study) {
+        return !opt_shard->contains(study.source.string());
+      });
+    }
+    scanConds.resize(studies.size());
+  } else {
+    // shards keep numbers from the full directory list and scan only their
+    // own directories
+    const std::vector<std::filesystem::path> allDirs =
+        findStudyDirectories(opt_inDirectory, opt_archiveFolders);
+    totalStudies = allDirs.size();
+    std::vector<std::filesystem::path> studyDirs{};
+    std::vector<unsigned int> studyNumbers{};
+    for (std::size_t i = 0; i < allDirs.size(); ++i) {
+      // archive folders are keyed with their archive name
+      if (opt_shard.has_value() &&
+          !opt_shard->contains(
+              allDirs[i].lexically_relative(opt_inDirectory).generic_string()))
+        continue;
+      studyDirs.push_back(allDirs[i]);
+      studyNumbers.push_back(static_cast<unsigned int>(i + 1));
+    }
+    if (opt_streamStudies) {
+      // listed by the study tasks themselves
+      studies.assign(studyDirs.size(), {});
+      scanConds.assign(studyDirs.size(), EC_Normal);
+      for (std::size_t i = 0; i < studyDirs.size(); ++i) {
+        studies[i].source = studyDirs[i];
+        studies[i].study_number = studyNumbers[i];
+      }
+    } else {
+      scanStudyDirectories(studyDirs, studyNumbers, pool, studies, scanConds);
+    }
+  }
+  if (opt_shard.has_value()) {
+    OFLOG_INFO(mainLogger, opt_shard->name() << ": " << studies.size()
+                                             << " of " << totalStudies
+                                             << " studies");
+  }
+
+  AnonymizerConfig config{};
+  config.pseudoname_prefix = opt_anonymizedPrefix;
+  config.pseudoname_type = opt_pseudonameType;
+  config.filename_type = opt_filenameType;
+  config.methods = opt_anonymizationMethods;
+  config.uid_root = opt_rootUID;
+  config.uid_secret = opt_uidSecret;
+  config.output_directory = opt_outDirectory;
+  config.pixel_passthrough = opt_pixelPassthrough;
+  config.checksum_type = opt_checksumType;
 
-  StudyAnonymizer anonymizer{opt_anonymizedPrefix, opt_pseudonameType,
-                             opt_filenameType};
+  // files are encoded by the worker (or pipeline writer) saving them
+  std::optional<CodecRegistration> codecs{};
+  TranscodeStats transcodeStats{};
+  if (opt_outputXfer != EXS_Unknown) {
+    codecs.emplace();
+    config.output_xfer = opt_outputXfer;
+    config.transcode_stats = &transcodeStats;
+    OFLOG_INFO(mainLogger, "writing files as "
+                               << DcmXfer(opt_outputXfer).getXferName());
+  }
 
-  if (anonymizer.m_pseudoname_type == P_INTEGER_ORDER) {
+  MappingStore mappingStore{};
+  if (!opt_mappingStore.empty()) {
+    const OFCondition cond = mappingStore.open(opt_mappingStore);
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "unable to open mapping store `"
+                                  << opt_mappingStore << "`: " << cond.text());
+      return EXITCODE_CANNOT_READ_INPUT_FILE;
+    }
+    config.mapping_store = &mappingStore;
+    OFLOG_INFO(mainLogger, "using mapping store `"
+                               << opt_mappingStore << "` with "
+                               << mappingStore.size() << " entries");
+    if (config.pseudoname_type == P_INTEGER_ORDER) {
+      OFLOG_WARN(mainLogger, "integer pseudonames restart at 1 every run and "
+                             "may repeat pseudonames stored by earlier runs");
+    }
+  }
+
+  std::unique_ptr<MemoryBudget> memoryBudget{};
+  if (opt_memoryBudgetMB > 0) {
+    memoryBudget = std::make_unique<MemoryBudget>(
+        static_cast<std::uint64_t>(opt_memoryBudgetMB) * 1024 * 1024);
+    config.memory_budget = memoryBudget.get();
+    OFLOG_INFO(mainLogger,
+               "limiting files in flight to " << opt_memoryBudgetMB << " MB");
+  }
+
+  PseudonymIndex pseudonyms{};
+  if (config.pseudoname_type == P_INTEGER_ORDER) {
     fmt::print("using pseudonames as integer count order\n");
-    anonymizer.m_count_width =
-        static_cast<unsigned short>(std::to_string(studyDirs.size()).length());
-    ++anonymizer.m_count_width;
-    /* increment m_count_width by 1 for always at least one leading zero in
+    config.count_width =
+        static_cast<unsigned short>(std::to_string(totalStudies).length());
+    ++config.count_width;
+    /* increment count_width by 1 for always at least one leading zero in
     formatted pseudoname:
 
     studies found: 5 -> string length = 1
@@ -284,53 +1201,379 @@ int main(int argc, char *argv[]) {
     - incremented: width = 2, PSEUDONAME_01, ..., PSEUDONAME_05
     */
 
-  } else if (anonymizer.m_pseudoname_type == P_FROM_FILE) {
+  } else if (config.pseudoname_type == P_FROM_FILE) {
     fmt::print("using PatientID-pseudoname pairs from file `{}`\n",
                opt_pseudonameFile);
-    OFCondition cond = anonymizer.readPseudonamesFromFile(opt_pseudonameFile);
+    const OFCondition cond =
+        pseudonyms.open(opt_pseudonameFile, opt_pseudonameIndex);
     if (cond.bad()) {
       OFLOG_ERROR(mainLogger, cond.text());
       return cond.code();
     }
+    config.pseudonyms = &pseudonyms;
 
   } else {
     fmt::print("using pseudonames from random string generation\n");
   }
 
-  (void)std::filesystem::create_directories(opt_outDirectory);
-  OFLOG_INFO(mainLogger,
-             fmt::format("created output directory `{}`", opt_outDirectory));
+  TarWriter tarWriter{};
+  if (!opt_outputTar.empty()) {
+    const E_TAR_COMPRESSION compression =
+        opt_tarCompression.value_or(tarCompression(opt_outputTar));
+    const OFCondition cond = tarWriter.open(opt_outputTar, compression);
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "unable to open tar output `"
+                                  << opt_outputTar << "`: " << cond.text());
+      return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+    }
+    config.tar_writer = &tarWriter;
+    OFLOG_INFO(mainLogger, "writing tar output to `" << opt_outputTar << "`");
+  } else {
+    (void)std::filesystem::create_directories(opt_outDirectory);
+    OFLOG_INFO(mainLogger, fmt::format("created output directory `{}`",
+                                       opt_outDirectory));
+  }
 
-  std::string csvFilename{"anonym_output.csv"};
+  // shards write fragments with a leading study number column for `merge`
+  std::string csvFilename{
+      opt_shard.has_value()
+          ? fmt::format("anonym_output.{}.csv", opt_shard->name())
+          : "anonym_output.csv"};
   if (!opt_anonymizedPrefix.empty()) {
     csvFilename.insert(0, opt_anonymizedPrefix);
   }
+  AnonymOutputWriter outputAnonymFile{};
+  const auto writeRow = [&](std::size_t i, const StudyInput &study,
+                            const std::string &row) {
+    if (opt_shard.has_value()) {
+      outputAnonymFile.write(i,
+                             fmt::format("{},{}", study.study_number, row));
+    } else {
+      outputAnonymFile.write(i, row);
+    }
+  };
+
+  // tar output has no directory to keep a journal in and cannot be resumed,
+  // received studies have no input to redo them from
+  Journal journal{};
+  const std::string journalPath =
+      fmt::format("{}/{}", opt_outDirectory, Journal::FILENAME);
+  if (config.tar_writer == nullptr && opt_listenPort == 0) {
+    if (journal.open(journalPath, opt_resume).bad()) {
+      OFLOG_ERROR(mainLogger,
+                  "unable to open journal `" << journalPath << "`");
+      return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+    }
+    config.journal = &journal;
+  }
+  if (opt_resume) {
+    cleanupPartialStudies(journal, studies, config);
+  }
+  reuseJournalIdentities(journal, studies);
+
+  Manifest manifest{};
+  const std::string manifestPath =
+      fmt::format("{}/{}", opt_outDirectory, Manifest::FILENAME);
+  if (opt_incremental) {
+    const OFCondition cond = manifest.load(manifestPath);
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "unable to read manifest `"
+                                  << manifestPath << "`: " << cond.text());
+      return EXITCODE_CANNOT_READ_INPUT_FILE;
+    }
+  }
 
-  std::ofstream outputAnonymFile{opt_outDirectory + '/' + csvFilename,
-                                 std::ios::out};
-  outputAnonymFile << "PatientID,PatientName,Pseudoname,StudyDate,"
-                      "OldStudyInstanceUID,NewStudyInstanceUID\n";
+  if (config.tar_writer != nullptr) {
+    // added to the stream once every row is known
+    outputAnonymFile.openInMemory(opt_shard.has_value());
+  } else if (outputAnonymFile
+                 .open(opt_outDirectory + '/' + csvFilename,
+                       opt_shard.has_value())
+                 .bad()) {
+    return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+  }
 
-  for (const auto &study_dir : studyDirs) {
+  std::unique_ptr<FilePipeline> pipeline{};
+  if (opt_pipeline) {
+    opt_pipelineConfig.transform_threads =
+        opt_transformThreads > 0
+            ? static_cast<unsigned int>(opt_transformThreads)
+            : jobs;
+    opt_pipelineConfig.load_all_data = !opt_pixelPassthrough;
+    pipeline = std::make_unique<FilePipeline>(opt_pipelineConfig);
+    OFLOG_INFO(mainLogger, "using pipeline with "
+                               << opt_pipelineConfig.read_threads << " reader, "
+                               << opt_pipelineConfig.transform_threads
+                               << " transform and "
+                               << opt_pipelineConfig.write_threads
+                               << " writer thread(s)");
+  }
 
-    OFCondition cond{};
-    cond = anonymizer.anonymizeStudy(study_dir, opt_outDirectory,
-                                     opt_anonymizationMethods, opt_rootUID);
+  // largest studies first, their files are spread over idle workers while
+  // small studies fill the remaining gaps
+  std::vector<std::size_t> order(studies.size());
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&](std::size_t lhs, std::size_t rhs) {
+                     return studies[lhs].total_bytes >
+                            studies[rhs].total_bytes;
+                   });
+
+  OFLOG_INFO(mainLogger, "anonymizing " << studies.size() << " studies with "
+                                        << jobs << " worker(s)");
+
+  // anonymize `study` and write its row `i` of anonym_output.csv
+  const auto runStudy = [&](StudyInput &study, std::size_t i) {
+    const std::string key = study.source.string();
+
+    // finished by an earlier run
+    const JournalStudy *previous = journal.previous(key);
+    if (previous != nullptr && previous->csv_row.has_value()) {
+      OFLOG_INFO(mainLogger, "skipping finished study `" << key << "`");
+      writeRow(i, study, *previous->csv_row);
+      return;
+    }
+
+    // sizes are only needed for the memory budget once ordering is skipped
+    if (opt_streamStudies || opt_watch) {
+      const OFCondition cond = scanStudy(study.source, study.study_number,
+                                         pool, opt_memoryBudgetMB > 0, study);
+      if (cond.bad()) {
+        OFLOG_ERROR(mainLogger, "error while searching dicom files");
+        OFLOG_ERROR(mainLogger, cond.text());
+        outputAnonymFile.skip(i);
+        return;
+      }
+    }
+
+    ManifestStudy next{};
+    if (opt_incremental) {
+      const bool found = manifest.find(key, next);
+      if (!prepareIncremental(study, found, opt_incrementalHash, next)) {
+        OFLOG_INFO(mainLogger, "study `" << key << "` unchanged");
+        manifest.update(key, next);
+        (void)journal.done(key, next.csv_row);
+        writeRow(i, study, next.csv_row);
+        return;
+      }
+    }
+
+    StudyAnonymizer anonymizer{config};
+    const OFCondition cond =
+        anonymizer.anonymizeStudy(study, pool, pipeline.get());
+    // archive members are only sniffed while the study is anonymized
+    study.rejected.insert(study.rejected.end(),
+                          anonymizer.rejectedFiles().begin(),
+                          anonymizer.rejectedFiles().end());
 
     // something bad happened
     if (cond.bad()) {
       const std::string msg =
-          fmt::format("error while anonymizing study `{}`", study_dir.string());
+          fmt::format("error while anonymizing study `{}`", key);
       OFLOG_ERROR(mainLogger, msg.c_str());
+      outputAnonymFile.skip(i);
+      return;
+    }
+
+    const std::string row = anonymizer.csvRow();
+    if (opt_incremental) {
+      for (const auto &[input, output] : anonymizer.writtenFiles()) {
+        next.files[input].output_path = output;
+      }
+      next.pseudoname = anonymizer.m_pseudoname;
+      next.new_study_uid = anonymizer.m_new_studyuid;
+      next.series_uids = anonymizer.seriesUids();
+      next.csv_row = row;
+      manifest.update(key, std::move(next));
+    }
+
+    if (config.journal != nullptr && journal.done(key, row).bad()) {
+      OFLOG_ERROR(mainLogger, "error while writing journal");
+    }
+    writeRow(i, study, row);
+  };
+
+  TaskGroup studyTasks{pool};
+  for (const std::size_t i : order) {
+    if (scanConds[i].bad()) {
+      OFLOG_ERROR(mainLogger, "error while searching dicom files");
+      OFLOG_ERROR(mainLogger, scanConds[i].text());
+      outputAnonymFile.skip(i);
       continue;
     }
 
-    outputAnonymFile << fmt::format(
-        "{},{},{},{},{},{}\n", anonymizer.m_old_id, anonymizer.m_old_name,
-        anonymizer.m_pseudoname, anonymizer.m_study_date,
-        anonymizer.m_old_studyuid, anonymizer.m_new_studyuid);
+    studyTasks.run([&, i]() { runStudy(studies[i], i); });
+  }
+  studyTasks.wait();
+
+  if (opt_listenPort > 0) {
+    // every association runs on its own thread, so `jobs` associations are
+    // anonymized in parallel
+    StorageListener listener{config, outputAnonymFile};
+    const OFCondition cond = listener.listen(
+        static_cast<unsigned short>(opt_listenPort), opt_aeTitle, jobs,
+        std::chrono::seconds(opt_quietPeriod));
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "storage listener failed: " << cond.text());
+      return EXITCODE_CANNOT_INITIALIZE_NETWORK;
+    }
+  }
+
+  std::string reportFilename{
+      opt_shard.has_value()
+          ? fmt::format("rejected_files.{}.csv", opt_shard->name())
+          : "rejected_files.csv"};
+  reportFilename.insert(0, opt_anonymizedPrefix);
+  const std::string reportPath =
+      config.tar_writer != nullptr
+          ? reportFilename
+          : fmt::format("{}/{}", opt_outDirectory, reportFilename);
+
+  // watched studies are dropped once finished, their rejected files go to
+  // the report right away; a tar member is only written at the end
+  std::mutex rejectedMutex{};
+  std::ofstream rejectedReport{};
+  std::size_t rejectedCount{0};
+  const auto reportRejected = [&](const StudyInput &study) {
+    if (study.rejected.empty())
+      return;
+    std::scoped_lock lock{rejectedMutex};
+    rejectedCount += study.rejected.size();
+    if (config.tar_writer != nullptr) {
+      rejectedFiles.insert(rejectedFiles.end(), study.rejected.begin(),
+                           study.rejected.end());
+      return;
+    }
+    if (!rejectedReport.is_open()) {
+      rejectedReport.open(reportPath, std::ios::out);
+      rejectedReport << "Path,Reason\n";
+    }
+    writeRejectedRows(rejectedReport, study.rejected);
+    rejectedReport.flush();
+    if (!rejectedReport) {
+      OFLOG_ERROR(mainLogger, "error while writing `" << reportPath << "`");
+    }
+  };
+
+  if (opt_watch) {
+    FolderWatcher watcher{opt_inDirectory,
+                          std::chrono::seconds(opt_quietPeriod)};
+    const OFCondition cond = watcher.open();
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "unable to watch `" << opt_inDirectory
+                                                  << "`: " << cond.text());
+      return EXITCODE_CANNOT_READ_INPUT_FILE;
+    }
+    OFLOG_INFO(mainLogger, "watching `" << opt_inDirectory
+                                        << "` for studies, quiet period "
+                                        << opt_quietPeriod << " s");
+
+    // rows of anonym_output.csv handed out so far
+    std::size_t watchedRows{0};
+    std::vector<std::filesystem::path> ready{};
+    while (watcher.wait(ready)) {
+      std::vector<StudyInput> batch(ready.size());
+      for (std::size_t i = 0; i < ready.size(); ++i) {
+        batch[i].source = ready[i];
+        batch[i].study_number =
+            static_cast<unsigned int>(watchedRows + i + 1);
+      }
+      if (opt_resume) {
+        cleanupPartialStudies(journal, batch, config);
+      }
+      reuseJournalIdentities(journal, batch);
+
+      for (StudyInput &study : batch) {
+        const std::size_t row = watchedRows++;
+        // owned by its task and freed when the task is done
+        auto queued = std::make_shared<StudyInput>(std::move(study));
+        studyTasks.run([&runStudy, &reportRejected, queued, row]() {
+          runStudy(*queued, row);
+          reportRejected(*queued);
+        });
+      }
+    }
+    OFLOG_INFO(mainLogger, "stopping after running studies");
+    studyTasks.wait();
   }
   outputAnonymFile.close();
 
+  if (rejectedReport.is_open()) {
+    rejectedReport.close();
+    OFLOG_WARN(mainLogger, rejectedCount << " input files rejected, see `"
+                                         << reportPath << "`");
+  }
+  for (const StudyInput &study : studies) {
+    rejectedFiles.insert(rejectedFiles.end(), study.rejected.begin(),
+                         study.rejected.end());
+  }
+  if (!rejectedFiles.empty()) {
+    OFLOG_WARN(mainLogger, rejectedFiles.size()
+                               << " input files rejected, see `"
+                               << reportPath << "`");
+    OFCondition cond{};
+    if (config.tar_writer != nullptr) {
+      std::ostringstream report{};
+      writeRejectedReport(report, rejectedFiles);
+      const std::string contents = report.str();
+      cond = tarWriter.addFile(reportFilename, contents.data(),
+                               contents.size());
+    } else {
+      cond = writeRejectedReport(reportPath, rejectedFiles);
+    }
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "error while writing `" << reportPath << "`");
+    }
+  }
+  (void)journal.close();
+
+  if (config.transcode_stats != nullptr)
+    transcodeStats.print(config.output_xfer);
+
+  if (profiler.has_value()) {
+    profiler->uninstall();
+    profiler->print();
+    if (!opt_tracePath.empty()) {
+      const OFCondition cond = profiler->writeTrace(opt_tracePath);
+      if (cond.bad()) {
+        OFLOG_ERROR(mainLogger, "error while writing trace `"
+                                    << opt_tracePath << "`: " << cond.text());
+      } else {
+        OFLOG_INFO(mainLogger, "wrote trace `" << opt_tracePath << "`");
+      }
+    }
+  }
+
+  if (config.tar_writer != nullptr) {
+    const std::string csv = outputAnonymFile.contents();
+    OFCondition cond = tarWriter.addFile(csvFilename, csv.data(), csv.size());
+    if (cond.good())
+      cond = tarWriter.close();
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "error while writing tar output `"
+                                  << opt_outputTar << "`: " << cond.text());
+      return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+    }
+  }
+
+  if (opt_incremental) {
+    const OFCondition cond = manifest.save(manifestPath);
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "error while saving manifest: " << cond.text());
+      return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+    }
+  }
+
+  if (config.mapping_store != nullptr) {
+    const OFCondition cond = mappingStore.close();
+    if (cond.bad()) {
+      OFLOG_ERROR(mainLogger, "error while saving mapping store: "
+                                  << cond.text());
+      return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+    }
+  }
+
   return 0;
 }
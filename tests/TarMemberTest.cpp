@@ -0,0 +1,109 @@
+// writes deflated datasets as tar members the way --output-tar does and
+// reads them back
+
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcuid.h"
+
+#include "ArchiveReader.hpp"
+#include "DicomAnonymizer.hpp"
+#include "TarWriter.hpp"
+
+namespace {
+int failures{0};
+
+void expect(bool ok, const char *what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++failures;
+  }
+};
+
+// dataset with an undefined length sequence and `pixel_bytes` of pixel data
+void makeDataset(DcmFileFormat &fileformat, std::size_t pixel_bytes) {
+  DcmDataset *dataset = fileformat.getDataset();
+  dataset->putAndInsertString(DCM_SOPClassUID,
+                              UID_SecondaryCaptureImageStorage);
+  dataset->putAndInsertString(DCM_SOPInstanceUID, "1.2.826.0.1.3680043.2.1");
+  dataset->putAndInsertString(DCM_PatientID, "ANON01");
+
+  DcmItem *item = nullptr;
+  dataset->findOrCreateSequenceItem(DCM_ReferencedSeriesSequence, item, -2);
+  item->putAndInsertString(DCM_SeriesInstanceUID, "1.2.826.0.1.3680043.2.2");
+
+  // varied but compressible, so deflate keeps output pending in its filter
+  std::vector<Uint8> pixels(pixel_bytes);
+  for (std::size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = static_cast<Uint8>((i * 7) ^ (i >> 9));
+  }
+  dataset->putAndInsertUint8Array(DCM_PixelData, pixels.data(),
+                                  static_cast<unsigned long>(pixels.size()));
+};
+
+void roundTrip(std::size_t pixel_bytes) {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "fnodcmanon_tar_member.tar";
+  const E_TransferSyntax xfer = EXS_DeflatedLittleEndianExplicit;
+
+  DcmFileFormat written{};
+  makeDataset(written, pixel_bytes);
+  std::vector<char> buffer{};
+  expect(writeToBuffer(written, xfer, buffer).good(), "writeToBuffer");
+
+  TarWriter tar{};
+  expect(tar.open(path.string(), TC_NONE).good(), "open tar");
+  expect(tar.addFile("P/DICOM/00000000", buffer.data(), buffer.size()).good(),
+         "add tar member");
+  expect(tar.close().good(), "close tar");
+
+  ArchiveReader reader{};
+  ArchiveMember member{};
+  std::vector<char> data{};
+  expect(reader.open(path).good(), "open archive");
+  expect(reader.next(member), "find tar member");
+  expect(reader.read(data).good(), "read tar member");
+  expect(data == buffer, "member bytes equal written bytes");
+  std::filesystem::remove(path);
+
+  DcmFileFormat read{};
+  expect(readFromBuffer(read, data).good(), "parse tar member");
+  DcmDataset *dataset = read.getDataset();
+  expect(dataset->getOriginalXfer() == xfer, "deflated transfer syntax");
+
+  OFString value{};
+  dataset->findAndGetOFString(DCM_PatientID, value);
+  expect(value == "ANON01", "PatientID");
+  DcmItem *item = nullptr;
+  expect(dataset->findAndGetSequenceItem(DCM_ReferencedSeriesSequence, item)
+                 .good() &&
+             item->findAndGetOFString(DCM_SeriesInstanceUID, value).good() &&
+             value == "1.2.826.0.1.3680043.2.2",
+         "sequence item");
+
+  const Uint8 *pixels = nullptr;
+  unsigned long count = 0;
+  expect(dataset->findAndGetUint8Array(DCM_PixelData, pixels, &count).good() &&
+             count == pixel_bytes,
+         "PixelData length");
+  bool same = pixels != nullptr;
+  for (std::size_t i = 0; same && i < count; ++i) {
+    same = pixels[i] == static_cast<Uint8>((i * 7) ^ (i >> 9));
+  }
+  expect(same, "PixelData contents");
+};
+} // namespace
+
+int main() {
+  // within one stream chunk and spanning several
+  roundTrip(64 * 1024);
+  roundTrip(8 * 1024 * 1024);
+
+  if (failures > 0)
+    return 1;
+  std::printf("tar member round trip passed\n");
+  return 0;
+};